@@ -1,7 +1,10 @@
 C_SRC+= \
 	threadlib.c memory.c listlib.c testlib.c \
 	sampler.c audio.c game.c vector.c \
-	gambitmain.c realmain.c stb_image.c
+	gambitmain.c realmain.c stb_image.c \
+	imageconv.c mixer.c osc.c biquad.c pcm.c \
+	sfxcache.c resample.c envelope.c sequencer.c \
+	audiograph.c cpu.c
 
 SCM_LIB_SRC=link.scm
 
@@ -49,15 +52,70 @@ clean:
 	rm -rf *.o* $(SCM_LIB_C) $(BIN)
 	$(MAKE_XML2) clean $(patsubst %.scm,%.c,$(SCM_FILES))
 
-test_bin: memory.o testlib_test.o
-	$(CC) $(CFLAGS) -o $@ memory.o testlib_test.o $(LDFLAGS)
+TEST_OBJS=memory.o threadlib.o listlib.o testlib_test.o
 
-test: test_bin
+test_bin: $(TEST_OBJS)
+	$(CC) $(CFLAGS) -o $@ $(TEST_OBJS) $(LDFLAGS)
+
+IMAGE_TEST_OBJS=imageconv.o stb_image.o cpu.o image_test.o
+
+image_test_bin: $(IMAGE_TEST_OBJS)
+	$(CC) $(CFLAGS) -o $@ $(IMAGE_TEST_OBJS) $(LDFLAGS)
+
+MIXER_TEST_OBJS=audio.o audio_null.o sampler.o osc.o biquad.o pcm.o \
+	sfxcache.o resample.o envelope.o sequencer.o audiograph.o mixer.o \
+	cpu.o memory.o threadlib.o listlib.o mixer_test.o
+
+mixer_test_bin: $(MIXER_TEST_OBJS)
+	$(CC) $(CFLAGS) -o $@ $(MIXER_TEST_OBJS) $(LDFLAGS)
+
+test: test_bin image_test_bin mixer_test_bin
 	./test_bin
+	./image_test_bin
+	./mixer_test_bin
+
+# mixer throughput without an audio device: seconds voices realtime
+# [out.wav]
+AUDIO_RENDER_ARGS?=10 16 0
+AUDIO_RENDER_OBJS=audio.o audio_null.o sampler.o osc.o biquad.o pcm.o \
+	resample.o envelope.o sequencer.o audiograph.o mixer.o cpu.o \
+	memory.o threadlib.o listlib.o audio_render.o
+
+audio_render_bin: $(AUDIO_RENDER_OBJS)
+	$(CC) $(CFLAGS) -o $@ $(AUDIO_RENDER_OBJS) $(LDFLAGS)
+
+audio_render: audio_render_bin
+	./audio_render_bin $(AUDIO_RENDER_ARGS)
+
+# decode timings for the shipped images, tab separated on stdout. built
+# from source with optimization so it measures what ships
+BENCH_ITERATIONS?=10
+BENCH_THREADS?=0
+BENCH_CFLAGS?=-O2
+
+bench_images_bin: stb_image.c cpu.c bench_images.c
+	$(CC) $(CFLAGS) $(BENCH_CFLAGS) -o $@ stb_image.c cpu.c bench_images.c \
+		$(LDFLAGS)
+
+bench_images: bench_images_bin
+	./bench_images_bin $(BENCH_ITERATIONS) $(BENCH_THREADS)
+
+# voices the mixer can keep up with at each device rate, tab separated
+# on stdout. built from source with optimization like bench_images
+AUDIO_BENCH_SECONDS?=2
+AUDIO_BENCH_SRC=audio.c audio_null.c sampler.c osc.c biquad.c pcm.c \
+	resample.c envelope.c sequencer.c audiograph.c mixer.c cpu.c \
+	memory.c threadlib.c listlib.c audio_bench.c
+
+audio_bench_bin: $(AUDIO_BENCH_SRC)
+	$(CC) $(CFLAGS) $(BENCH_CFLAGS) -o $@ $(AUDIO_BENCH_SRC) $(LDFLAGS)
+
+audio_bench: audio_bench_bin
+	./audio_bench_bin $(AUDIO_BENCH_SECONDS)
 
 xml2.o1.o: xml2.scm
 	$(MAKE_XML2)
 
 xml2: xml2.o1.o
 
-.phony: all
+.phony: all test bench_images audio_render audio_bench
@@ -1,94 +1,350 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime under -std=c99 */
+#include <float.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef AUDIO_DEADLINE_CHECK
+#include <assert.h>
+#endif
+
 #include "threadlib.h"
 #include "audio.h"
 #include "memory.h"
+#include "mixer.h"
+#include "osc.h"
+
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
 
 PlayList playlist;
-Queue audio_queue;
-Filter global_filter;
+AtomicStack audio_queue;
 FixedAllocator pls_allocator;
+int target_fill = AUDIO_DEFAULT_TARGET_FILL;
+
+/* settings from audio_set_bus_filter waiting for the mixer. whoever
+   moves bus_state out of idle or staged owns them until it moves it
+   back */
+enum { BUS_IDLE, BUS_STAGED, BUS_WRITING, BUS_TAKING };
+static int bus_state = BUS_IDLE;
+static BiquadType bus_type;
+static float bus_cutoff, bus_q;
+static int bus_nsections;
+
+/* mix rate to device rate, or NULL when they're the same */
+static Resampler resampler;
+static int device_rate = SAMPLE_FREQ;
+
+/* a graph from audio_set_graph waiting for the mixer, and the one it
+   replaced waiting to be freed off the audio thread. the mixer only
+   swaps when the second is empty */
+static AudioGraph staged_graph;
+static AudioGraph retired_graph;
+
+/* each field has one writer: the device callback, the mixer or
+   audio_enqueue */
+static struct AudioStats_ stats;
+
+/* when the current audio_fill_buffer started, in wall clock and
+   sample clock */
+static double fill_start_us;
+static int64_t fill_start_sample;
+
+/* every voice audio_enqueue has handed the mixer that hasn't been
+   collected yet, under enqueue_mutex. nplaying leaves out the ones
+   that are stolen */
+static pthread_mutex_t enqueue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PlayListSample voices[NUM_SAMPLERS];
+static int nvoices;
+static int nplaying;
+static AudioStealPolicy steal_policy = AUDIO_STEAL_QUIETEST;
+
+/* where the fill in progress, if any, ends. see audio_schedule_sample */
+static int64_t mixed_until;
+
+static double audio_now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+/* bucket b of a time histogram holds [2^b, 2^(b+1)) microseconds */
+static int time_bucket(double us) {
+  int bucket = 0;
+  while(us >= 2.0 && bucket < AUDIO_TIME_BUCKETS - 1) {
+    us *= 0.5;
+    ++bucket;
+  }
+  return bucket;
+}
+
+/* a voice is about to be heard for the first time at sample. it was
+   enqueued at enqueued_us and has to wait for the mixer to get there
+   and then for the queued audio ahead of it to drain */
+static void stats_voice_started(PlayListSample pls, int64_t sample) {
+  double us;
+  if(pls->enqueued_us == 0) return;
+
+  us = fill_start_us - pls->enqueued_us
+    + (sample - fill_start_sample) * 1e6 / (NUM_CHANNELS * SAMPLE_FREQ)
+    + stats.queued * 1e6 / (NUM_CHANNELS * device_rate);
+  if(us < 0) us = 0;
+
+  stats.latencies += 1;
+  stats.latency_us_total += us;
+  if(us > stats.latency_us_max) stats.latency_us_max = us;
+  stats.latency_us[time_bucket(us)] += 1;
+}
 
 PlayListSample playlistsample_make(Sampler sampler) {
-  PlayListSample pl = (PlayListSample)fixed_allocator_alloc(pls_allocator);
+  PlayListSample pl = (PlayListSample)fixed_allocator_try_alloc(pls_allocator);
+  if(!pl) return NULL;
   pl->sampler = sampler;
+  pl->enqueued_us = 0;
+  pl->delay = 0;
+  pl->index = -1;
+  pl->bus = 0;
+  pl->stolen = 0;
+  pl->level = FLT_MAX; /* not heard yet, so not the quietest */
+  pl->fade_start = INT64_MAX;
+  pl->fade_end = INT64_MAX;
   return pl;
 }
 
 void playlistsample_free(PlayListSample pls) {
+  if(pls->index >= 0) {
+    if(!pls->stolen) nplaying -= 1;
+    voices[pls->index] = voices[--nvoices];
+    voices[pls->index]->index = pls->index;
+  }
   RELEASE_SAMPLER(pls->sampler);
   fixed_allocator_free(pls_allocator, pls);
 }
 
 PlayList playlist_make() {
   PlayList pl = malloc(sizeof(struct PlayList_));
-  pl->head = NULL;
+  pl->retired = atomicstack_make();
+  pl->npending = 0;
+  pl->nactive = 0;
+  pl->voices_mixed = 0;
+  pl->graph = audiograph_make();
   pl->next_sample = 0;
+  biquad_init(&pl->bus_filter, BIQUAD_LOWPASS, 0, 0, 0, SAMPLE_FREQ);
   return pl;
 }
 
+/* where the mixer plays a voice on the sample clock */
+#define VOICE_START(pls) (START((pls)->sampler) + (pls)->delay)
+#define VOICE_END(pls) (END((pls)->sampler) + (pls)->delay)
+
+#define HEAP_BEFORE(a, b) (START((a)->sampler) < START((b)->sampler))
+
+/* pending is a binary min-heap on START so inserting a whole bar of
+   notes costs log n each, wherever they land in the queue. there are
+   never more than NUM_SAMPLERS PlayListSamples so it can't overflow */
 void playlist_insert_sampler(PlayList list, PlayListSample sample) {
-  if(list->head == NULL) {
-    list->head = sample;
-    sample->node.next = NULL;
-    return;
+  int ii = list->npending++;
+  while(ii > 0) {
+    int parent = (ii - 1) / 2;
+    if(!HEAP_BEFORE(sample, list->pending[parent])) break;
+    list->pending[ii] = list->pending[parent];
+    ii = parent;
   }
+  list->pending[ii] = sample;
+}
 
-  if(START(sample->sampler) < START(list->head->sampler)) {
-    sample->node.next = (DLLNode)list->head;
-    list->head = sample;
-    return;
+static PlayListSample playlist_pop_pending(PlayList list) {
+  PlayListSample top = list->pending[0];
+  PlayListSample last = list->pending[--list->npending];
+  int n = list->npending;
+  int ii = 0;
+
+  for(;;) {
+    int child = 2 * ii + 1;
+    if(child >= n) break;
+    if(child + 1 < n && HEAP_BEFORE(list->pending[child + 1],
+                                    list->pending[child])) {
+      ++child;
+    }
+    if(!HEAP_BEFORE(list->pending[child], last)) break;
+    list->pending[ii] = list->pending[child];
+    ii = child;
   }
+  if(n > 0) list->pending[ii] = last;
+  return top;
+}
 
-  PlayListSample last_node = list->head;
-  PlayListSample current_node = (PlayListSample)list->head->node.next;
+/* move everything that starts in a block, or before it, into the
+   active set */
+static void playlist_promote(PlayList list, int64_t block_start,
+                             int64_t block_end) {
+  while(list->npending > 0 && START(list->pending[0]->sampler) < block_end) {
+    PlayListSample pls = playlist_pop_pending(list);
+    /* it was meant to start at once but the fill its START fell in
+       took the queue before it got there */
+    if(pls->enqueued_us != 0 && START(pls->sampler) < block_start) {
+      pls->delay = block_start - START(pls->sampler);
+    }
+    stats_voice_started(pls, VOICE_START(pls));
+    list->active[list->nactive++] = pls;
+  }
+}
 
-  while(current_node != NULL) {
-    if(START(sample->sampler) < START(current_node->sampler)) {
-      // insert before this node
-      sample->node.next = (DLLNode)current_node;
-      last_node->node.next = (DLLNode)sample;
-      return; // done
+/* hand active voices that are done by sample to retired, keeping the
+   rest packed at the front */
+static void playlist_retire(PlayList list, int64_t sample) {
+  int ii, kept = 0;
+  for(ii = 0; ii < list->nactive; ++ii) {
+    PlayListSample pls = list->active[ii];
+    if(MIN(VOICE_END(pls), pls->fade_end) <= sample) {
+      atomicstack_push(list->retired, (DLLNode)pls);
+    } else {
+      list->active[kept++] = pls;
     }
+  }
+  list->nactive = kept;
+}
 
-    last_node = current_node;
-    current_node = (PlayListSample)current_node->node.next;
+/* first frame of a block starting at sample clock block_start whose
+   clock is at or after sample, clamped to [0, nframes] */
+static int frame_at_or_after(int64_t block_start, int64_t sample,
+                             int nframes) {
+  int64_t frames = (sample - block_start + NUM_CHANNELS - 1) / NUM_CHANNELS;
+  if(sample <= block_start) return 0;
+  return frames > nframes ? nframes : frames;
+}
+
+/* a stolen voice fades from wherever the mixer is when it notices,
+   unless it hasn't been heard yet, in which case it never is */
+static void playlist_start_fade(PlayListSample pls, int64_t block_start) {
+  if(VOICE_START(pls) >= block_start) {
+    pls->fade_start = pls->fade_end = VOICE_START(pls);
+  } else {
+    pls->fade_start = block_start;
+    pls->fade_end = block_start + AUDIO_STEAL_FADE;
   }
+}
 
-  // must be after the end
-  sample->node.next = NULL;
-  last_node->node.next = (DLLNode)sample;
+/* scale n frames from sample clock start by the voice's fade */
+static void playlist_apply_fade(PlayListSample pls, int64_t start, int n,
+                                float* voice) {
+  float length = pls->fade_end - pls->fade_start;
+  float gain = (pls->fade_end - start) / length;
+  float step = -NUM_CHANNELS / length;
+  int ii;
+  for(ii = 0; ii < n; ++ii, gain += step) {
+    voice[ii] *= gain;
+  }
 }
 
-void playlist_fill_buffer(PlayList list, int16_t* buffer, int nsamples) {
+/* peak of a rendered voice, which is what stealing calls loud */
+static float voice_peak(const float* voice, int n) {
+  float peak = 0.0f;
   int ii;
-  long next_sample = list->next_sample;
-  list->next_sample += nsamples;
+  for(ii = 0; ii < n; ++ii) {
+    float v = voice[ii] < 0 ? -voice[ii] : voice[ii];
+    if(v > peak) peak = v;
+  }
+  return peak;
+}
 
-  for(ii = 0; ii < nsamples; ii+=2) {
-    long sample = next_sample + ii;
-    PlayListSample node;
+/* mix one block of frames. each sampler renders the span of the block
+   that falls in [START, END) straight into a scratch buffer, so the
+   per sample cost is a multiply-add rather than an indirect call.
+   oscillators are gathered into their bus's bank and mixed together.
+   then the graph takes the buses down to the master */
+static void playlist_mix_block(PlayList list, int64_t block_start,
+                               float* mix, int nframes) {
+  float voice[MIX_BLOCK_FRAMES];
+  int64_t block_end = block_start + nframes * NUM_CHANNELS;
+  AudioGraph graph = list->graph;
+  int ii;
+
+  audiograph_clear(graph);
+
+  playlist_promote(list, block_start, block_end);
+  list->voices_mixed = list->nactive;
+  for(ii = 0; ii < list->nactive; ++ii) {
+    PlayListSample pls = list->active[ii];
+    Sampler sampler = pls->sampler;
+    AudioBus bus = &graph->buses[pls->bus < graph->nbuses ? pls->bus : 0];
+    int64_t from;
+    float level;
+    int first, last;
+
+    if(pls->fade_end == INT64_MAX
+       && __atomic_load_n(&pls->stolen, __ATOMIC_ACQUIRE)) {
+      playlist_start_fade(pls, block_start);
+    }
+    first = frame_at_or_after(block_start, VOICE_START(pls), nframes);
+    last = frame_at_or_after(block_start, MIN(VOICE_END(pls), pls->fade_end),
+                             nframes);
+    if(first >= last) continue;
+
+    /* fading voices go through the render path for their ramp */
+    if(sampler_is_osc(sampler) && pls->fade_end == INT64_MAX) {
+      osc_bank_add(&bus->bank, (OscSampler)sampler, block_start - pls->delay,
+                   first, last);
+      level = ((OscSampler)sampler)->amp;
+      __atomic_store(&pls->level, &level, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    from = block_start + first * NUM_CHANNELS;
+    RENDER(sampler, from - pls->delay, last - first, voice);
+    if(pls->fade_end != INT64_MAX) {
+      playlist_apply_fade(pls, from, last - first, voice);
+    }
+    level = voice_peak(voice, last - first);
+    __atomic_store(&pls->level, &level, __ATOMIC_RELAXED);
 
     /* mixing strategy outlined at:
      * http://www.vttoth.com/CMS/index.php/technical-notes/68
      */
-    float value = 0;
-    for(node = list->head; node != NULL;
-        node = (PlayListSample)node->node.next) {
-      if(START(node->sampler) > sample) break;
-      int16_t sampled = SAMPLE(node->sampler, sample);
-      float normalized = (float)sampled / INT16_MAX;
-      value = value + normalized - (value * normalized);
+    mixer_accumulate(&bus->buffer[first], voice, last - first);
+  }
+
+  audiograph_process(graph, mix, nframes);
+  playlist_retire(list, block_end);
+}
+
+void playlist_fill_float(PlayList list, float* mix, int nframes) {
+  int frame = 0;
+  int64_t next_sample = list->next_sample;
+
+  while(frame < nframes) {
+    int block = MIN(nframes - frame, MIX_BLOCK_FRAMES);
+    playlist_mix_block(list, next_sample + frame * NUM_CHANNELS,
+                       &mix[frame], block);
+    if(list->bus_filter.nsections > 0) {
+      biquad_process(&list->bus_filter, &mix[frame], block);
     }
+    frame += block;
+  }
+
+  /* readers on other threads see the clock move only once the audio
+     behind it exists */
+  __atomic_store_n(&list->next_sample, next_sample + nframes * NUM_CHANNELS,
+                   __ATOMIC_RELEASE);
+}
 
-    buffer[ii] = INT16_MAX * value; //filter_value(global_filter, value);
-    buffer[ii+1] = buffer[ii];
+void playlist_fill_buffer(PlayList list, int16_t* buffer, int nsamples) {
+  float mix[MIX_BLOCK_FRAMES];
+  int nframes = nsamples / NUM_CHANNELS;
+  int frame = 0;
+
+  while(frame < nframes) {
+    int block = MIN(nframes - frame, MIX_BLOCK_FRAMES);
+    playlist_fill_float(list, mix, block);
+    mixer_output_stereo(buffer + frame * NUM_CHANNELS, mix, block);
+    frame += block;
   }
+}
 
-  /* remove any nodes that are no longer playable */
-  while(list->head != NULL &&
-        END(list->head->sampler) < list->next_sample) {
-    PlayListSample node = list->head;
-    list->head = (PlayListSample)node->node.next;
-    playlistsample_free(node);
+void playlist_collect(PlayList list) {
+  DLLNode node = atomicstack_take_all(list->retired);
+  while(node != NULL) {
+    DLLNode next = node->next;
+    playlistsample_free((PlayListSample)node);
+    node = next;
   }
 }
 
@@ -99,26 +355,276 @@ void audio_init() {
                                        "pls_allocator");
 
   playlist = playlist_make();
-  audio_queue = queue_make();
-  global_filter = lowpass_make(0, 0);
+  audio_queue = atomicstack_make();
 
   native_audio_init();
 }
 
+/* pick a voice by steal_policy and tell the mixer to fade it out. it
+   stays in voices until it's collected */
+static void audio_steal_voice() {
+  PlayListSample victim = NULL;
+  int ii;
+
+  for(ii = 0; ii < nvoices; ++ii) {
+    PlayListSample pls = voices[ii];
+    float level, victim_level;
+    if(pls->stolen) continue;
+    if(victim == NULL) {
+      victim = pls;
+      continue;
+    }
+
+    if(steal_policy == AUDIO_STEAL_QUIETEST) {
+      __atomic_load(&pls->level, &level, __ATOMIC_RELAXED);
+      __atomic_load(&victim->level, &victim_level, __ATOMIC_RELAXED);
+      if(level < victim_level) {
+        victim = pls;
+        continue;
+      }
+      if(level > victim_level) continue;
+    }
+    if(START(pls->sampler) < START(victim->sampler)) victim = pls;
+  }
+
+  if(victim == NULL) return;
+  __atomic_store_n(&victim->stolen, 1, __ATOMIC_RELEASE);
+  nplaying -= 1;
+  stats.voices_stolen += 1;
+}
+
+/* free the graph the mixer let go of, if there is one */
+static void audio_collect_graph() {
+  AudioGraph old = __atomic_exchange_n(&retired_graph, NULL, __ATOMIC_ACQ_REL);
+  if(old) audiograph_free(old);
+}
+
 void audio_enqueue(Sampler sampler) {
-  enqueue(audio_queue, (DLLNode)playlistsample_make(sampler));
+  audio_enqueue_bus(sampler, 0);
+}
+
+void audio_enqueue_bus(Sampler sampler, int bus) {
+  PlayListSample pls;
+
+  /* the game and the sequencer both enqueue. the mixer never waits on
+     this */
+  pthread_mutex_lock(&enqueue_mutex);
+
+  /* the mixer never frees, so this is where finished voices go back
+     to their allocators, just before we take one out */
+  playlist_collect(playlist);
+  audio_collect_graph();
+  if(sampler == sampler_silence()) {
+    pthread_mutex_unlock(&enqueue_mutex);
+    return;
+  }
+
+  /* stealing only makes room for later, so a voice that doesn't fit
+     now takes nothing else down with it */
+  pls = playlistsample_make(sampler);
+  if(pls == NULL) {
+    RELEASE_SAMPLER(sampler);
+    stats.voices_dropped += 1;
+    pthread_mutex_unlock(&enqueue_mutex);
+    return;
+  }
+  if(nplaying >= AUDIO_MAX_VOICES) audio_steal_voice();
+  pls->bus = bus;
+  pls->index = nvoices;
+  voices[nvoices++] = pls;
+  nplaying += 1;
+
+  /* latency only means something for voices that want to start
+     right away, not ones scheduled ahead */
+  if(START(sampler) <= audio_schedule_sample()) {
+    pls->enqueued_us = audio_now_us();
+  }
+  atomicstack_push(audio_queue, (DLLNode)pls);
+  pthread_mutex_unlock(&enqueue_mutex);
+}
+
+void audio_set_graph(AudioGraph graph) {
+  AudioGraph replaced;
+
+  pthread_mutex_lock(&enqueue_mutex);
+  audio_collect_graph();
+  /* one the mixer never took was never played */
+  replaced = __atomic_exchange_n(&staged_graph, graph, __ATOMIC_ACQ_REL);
+  if(replaced) audiograph_free(replaced);
+  pthread_mutex_unlock(&enqueue_mutex);
+}
+
+/* on the mixer thread, between blocks */
+static void audio_take_graph() {
+  AudioGraph graph;
+  if(__atomic_load_n(&retired_graph, __ATOMIC_ACQUIRE) != NULL) return;
+
+  graph = __atomic_exchange_n(&staged_graph, NULL, __ATOMIC_ACQ_REL);
+  if(graph == NULL) return;
+  __atomic_store_n(&retired_graph, playlist->graph, __ATOMIC_RELEASE);
+  playlist->graph = graph;
+}
+
+void audio_set_steal_policy(AudioStealPolicy policy) {
+  steal_policy = policy;
+}
+
+void audio_set_target_fill(int nsamples) {
+  /* whole frames only */
+  nsamples &= ~(NUM_CHANNELS - 1);
+  target_fill = nsamples < NUM_CHANNELS ? NUM_CHANNELS : nsamples;
+}
+
+int audio_target_fill() {
+  return target_fill;
+}
+
+int64_t audio_current_sample() {
+  return __atomic_load_n(&playlist->next_sample, __ATOMIC_ACQUIRE);
+}
+
+int64_t audio_schedule_sample() {
+  int64_t until = __atomic_load_n(&mixed_until, __ATOMIC_ACQUIRE);
+  int64_t current = audio_current_sample();
+  return until > current ? until : current;
 }
 
-long audio_current_sample() {
-  /* race condition but we don't care */
-  return playlist->next_sample;
+void audio_set_bus_filter(BiquadType type, float cutoff, float q,
+                          int nsections) {
+  int state;
+
+  /* settings the mixer hasn't taken yet are simply replaced. it only
+     holds them while it copies them out, so this spin is short */
+  do {
+    state = __atomic_load_n(&bus_state, __ATOMIC_ACQUIRE);
+  } while(state == BUS_TAKING ||
+          !__atomic_compare_exchange_n(&bus_state, &state, BUS_WRITING, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+  bus_type = type;
+  bus_cutoff = cutoff;
+  bus_q = q;
+  bus_nsections = nsections;
+  __atomic_store_n(&bus_state, BUS_STAGED, __ATOMIC_RELEASE);
 }
 
+/* on the mixer thread. if the settings are being written right now
+   they'll be there next fill */
+static void audio_take_bus_filter() {
+  int state = BUS_STAGED;
+  BiquadType type;
+  float cutoff, q;
+  int nsections;
+
+  if(!__atomic_compare_exchange_n(&bus_state, &state, BUS_TAKING, 0,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return;
+  }
+  type = bus_type;
+  cutoff = bus_cutoff;
+  q = bus_q;
+  nsections = bus_nsections;
+  __atomic_store_n(&bus_state, BUS_IDLE, __ATOMIC_RELEASE);
+
+  biquad_design(&playlist->bus_filter, type, cutoff, q, nsections,
+                SAMPLE_FREQ);
+}
+
+void audio_set_device_rate(int rate) {
+  if(resampler) {
+    resampler_free(resampler);
+    resampler = NULL;
+  }
+  device_rate = rate > 0 ? rate : SAMPLE_FREQ;
+  if(device_rate != SAMPLE_FREQ) {
+    resampler = resampler_make(SAMPLE_FREQ, device_rate);
+  }
+}
+
+int audio_device_rate() {
+  return device_rate;
+}
+
+/* mix just as much as the resampler needs to make nframes at the
+   device rate */
+static void audio_fill_resampled(int16_t* buffer, int nframes) {
+  float out[RESAMPLE_CHUNK];
+  int frame = 0;
+
+  while(frame < nframes) {
+    int chunk = MIN(nframes - frame, RESAMPLE_CHUNK);
+    int needed = resampler_input_frames(resampler, chunk);
+    playlist_fill_float(playlist, resampler_input(resampler, needed), needed);
+    resampler_output(resampler, out, chunk);
+    mixer_output_stereo(buffer + frame * NUM_CHANNELS, out, chunk);
+    frame += chunk;
+  }
+}
+
+int audio_voices_mixed() {
+  return playlist->voices_mixed;
+}
+
+AudioStats audio_stats() {
+  return &stats;
+}
+
+void audio_stats_reset() {
+  memset(&stats, 0, sizeof(stats));
+}
+
+void audio_stats_device(int queued, int capacity, int wanted) {
+  int bucket = capacity > 0 ? queued * AUDIO_FILL_BUCKETS / capacity : 0;
+  bucket = MIN(MAX(bucket, 0), AUDIO_FILL_BUCKETS - 1);
+
+  stats.queued = queued;
+  stats.callbacks += 1;
+  stats.fill_level[bucket] += 1;
+  if(queued < wanted) stats.underruns += 1;
+}
+
+/* takes no locks and allocates nothing, so it's safe to call from the
+   device callback */
 void audio_fill_buffer(int16_t* buffer, int nsamples) {
-  PlayListSample sample;
-  while((sample = (PlayListSample)dequeue_noblock(audio_queue)) != NULL) {
-    playlist_insert_sampler(playlist, sample);
+  int mixing = nsamples;
+  fill_start_us = audio_now_us();
+  fill_start_sample = playlist->next_sample;
+  if(resampler) {
+    mixing = resampler_input_frames(resampler, nsamples / NUM_CHANNELS)
+      * NUM_CHANNELS;
+  }
+
+  /* anything enqueued from here on waits for the next fill */
+  __atomic_store_n(&mixed_until, fill_start_sample + mixing,
+                   __ATOMIC_RELEASE);
+
+  DLLNode node = atomicstack_take_all(audio_queue);
+  while(node != NULL) {
+    DLLNode next = node->next;
+    playlist_insert_sampler(playlist, (PlayListSample)node);
+    node = next;
+  }
+  audio_take_bus_filter();
+  audio_take_graph();
+
+  if(resampler) {
+    audio_fill_resampled(buffer, nsamples / NUM_CHANNELS);
+  } else {
+    playlist_fill_buffer(playlist, buffer, nsamples);
   }
 
-  playlist_fill_buffer(playlist, buffer, nsamples);
+  double us = audio_now_us() - fill_start_us;
+  stats.fills += 1;
+  stats.fill_us_total += us;
+  if(us > stats.fill_us_max) stats.fill_us_max = us;
+  stats.fill_us[time_bucket(us)] += 1;
+  stats.voices = playlist->voices_mixed;
+  if(stats.voices > stats.max_voices) stats.max_voices = stats.voices;
+
+#ifdef AUDIO_DEADLINE_CHECK
+  /* mixing has to stay well inside the time the audio lasts or the
+     device will underrun once the scheduler gets in the way */
+  double lasts = 1e6 * nsamples / (NUM_CHANNELS * device_rate);
+  assert(us <= AUDIO_DEADLINE_FRACTION * lasts);
+#endif
 }
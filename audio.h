@@ -2,30 +2,177 @@
 #define AUDIO_H
 
 #include "sampler.h"
+#include "biquad.h"
+#include "pcm.h"
+#include "envelope.h"
+#include "sfxcache.h"
+#include "resample.h"
+#include "sequencer.h"
+#include "audiograph.h"
 #include "listlib.h"
+#include "threadlib.h"
+
+/* build with -DAUDIO_DEADLINE_CHECK to assert that every
+   audio_fill_buffer finishes within this fraction of the time the audio
+   it mixed lasts */
+#ifndef AUDIO_DEADLINE_FRACTION
+#define AUDIO_DEADLINE_FRACTION 0.5
+#endif
+
+/* voices audio_enqueue lets play at once. past it, one is stolen for
+   each new voice: faded out over AUDIO_STEAL_FADE ticks of the sample
+   clock and dropped. the rest of the pool holds stolen voices until
+   they're collected, and once that's gone too new voices are dropped */
+#ifndef AUDIO_MAX_VOICES
+#define AUDIO_MAX_VOICES (NUM_SAMPLERS - 16)
+#endif
+#define AUDIO_STEAL_FADE (NUM_CHANNELS * SAMPLE_FREQ / 200)
+
+typedef enum {
+  AUDIO_STEAL_QUIETEST, /* the lowest peak last block, then the oldest */
+  AUDIO_STEAL_OLDEST /* the earliest START */
+} AudioStealPolicy;
 
 typedef struct PlayListSample_ {
   struct DLLNode_ node;
   Sampler sampler;
+  double enqueued_us; /* by audio_enqueue to start at once, else 0 */
+  /* ticks it plays later than its START. a voice enqueued to start at
+     once that missed the fill its START fell in is moved to the block
+     it's promoted in, so it's never cut short */
+  int64_t delay;
+  int bus; /* in the graph, the master if the graph has no such bus */
+  int index; /* in audio_enqueue's voices, -1 if it isn't there */
+  int stolen; /* set atomically by whoever steals it */
+  float level; /* peak of the last block, written by the mixer */
+  int64_t fade_start; /* the mixer's once it sees stolen */
+  int64_t fade_end; /* INT64_MAX until then */
 } *PlayListSample;
 
+/* voices wait in pending until the block they start in, then play
+   from active until they end. then they wait in retired for
+   playlist_collect, since freeing isn't safe on the audio thread */
 typedef struct PlayList_ {
-  PlayListSample head;
-  long next_sample;
+  PlayListSample pending[NUM_SAMPLERS]; /* min-heap on START */
+  int npending;
+  PlayListSample active[NUM_SAMPLERS];
+  int nactive;
+  AtomicStack retired;
+  int voices_mixed; /* active in the last block mixed */
+  AudioGraph graph; /* the mixer's own, see audio_set_graph */
+  struct Biquad_ bus_filter; /* over the whole mix, off at 0 sections */
+  int64_t next_sample; /* published atomically */
 } *PlayList;
 
+/* NULL once every PlayListSample is taken */
 PlayListSample playlistsample_make(Sampler sampler);
 void playlistsample_free(PlayListSample pls);
-void playlist_insert_sample(PlayList list, PlayListSample sample);
+PlayList playlist_make();
+void playlist_insert_sampler(PlayList list, PlayListSample sample);
 void playlist_fill_buffer(PlayList list, int16_t* buffer, int nsamples);
+/* the same mono, before it's converted to int16 */
+void playlist_fill_float(PlayList list, float* mix, int nframes);
+/* free the retired voices. call from any thread but the mixer's, and
+   for the audio playlist only with nothing else enqueueing */
+void playlist_collect(PlayList list);
 
 /* high level api */
 void audio_init();
+/* takes ownership of sampler. call from any thread but the mixer's */
 void audio_enqueue(Sampler sampler);
-long audio_current_sample();
+/* to a bus of the graph rather than the master */
+void audio_enqueue_bus(Sampler sampler, int bus);
 
+/* route everything enqueued through graph from the next fill on. the
+   graph belongs to the audio system from here; it frees the one it
+   replaces. only gains may change once it's handed over */
+void audio_set_graph(AudioGraph graph);
+
+/* which voice audio_enqueue steals, AUDIO_STEAL_QUIETEST at first */
+void audio_set_steal_policy(AudioStealPolicy policy);
+/* the next sample the mixer will mix. everything before it has been
+   mixed and is queued for the device or already played */
+int64_t audio_current_sample();
+/* the earliest sample a voice enqueued now is guaranteed to start on
+   time at: the end of whatever the mixer is working on. queued audio
+   is already mixed so it's behind this too. if a fill starts between
+   reading this and the enqueue, the voice starts with the next fill
+   instead, late but from its first sample */
+int64_t audio_schedule_sample();
+int audio_voices_mixed();
+
+/* filter everything that's mixed from the next fill on. the filter's
+   state carries over so it can be swept smoothly. 0 sections turns it
+   off. call from one thread; it never waits on the mixer for longer
+   than it takes to copy the settings */
+void audio_set_bus_filter(BiquadType type, float cutoff, float q,
+                          int nsections);
+
+/* nsamples at the device rate */
 void audio_fill_buffer(int16_t* buffer, int nsamples);
 
+/* what backends ask the device for. a device that won't do it says
+   what it does instead through audio_set_device_rate */
+#ifndef AUDIO_DEVICE_FREQ
+#define AUDIO_DEVICE_FREQ 48000
+#endif
+
+/* the rate audio_fill_buffer produces. anything but SAMPLE_FREQ is
+   converted from the mix with a Resampler. set it before the first
+   fill; it starts at SAMPLE_FREQ */
+void audio_set_device_rate(int rate);
+int audio_device_rate();
+
+/* how many int16 samples the backend tries to keep queued ahead of
+   the device. lower is less latency, higher rides out longer stalls
+   of the producer. backends clamp it to what their buffers hold */
+#define AUDIO_DEFAULT_TARGET_FILL (2048 * NUM_CHANNELS)
+void audio_set_target_fill(int nsamples);
+int audio_target_fill();
+
+/** Counters for how close the audio path runs to its deadline. The
+ * audio threads update them as they go without any locking, so a
+ * reader may see one that is a callback behind. Time histograms are
+ * log2 microseconds: bucket b counts [2^b, 2^(b+1)) us and the last
+ * bucket everything longer.
+ */
+#define AUDIO_FILL_BUCKETS 8
+#define AUDIO_TIME_BUCKETS 20
+
+typedef struct AudioStats_ {
+  /* reported by the backend each time the device takes audio */
+  long callbacks;
+  long underruns; /* the device wanted more than was queued */
+  int queued; /* int16 samples queued at the last callback */
+  long fill_level[AUDIO_FILL_BUCKETS]; /* queued in eighths of capacity */
+
+  /* each audio_fill_buffer */
+  long fills;
+  double fill_us_total;
+  double fill_us_max;
+  long fill_us[AUDIO_TIME_BUCKETS];
+  int voices; /* mixed in the last block */
+  int max_voices;
+
+  /* by audio_enqueue, past AUDIO_MAX_VOICES */
+  long voices_stolen;
+  long voices_dropped; /* with nothing left to steal */
+
+  /* from audio_enqueue to the first sample of the voice reaching the
+     device, for voices that start as soon as possible */
+  long latencies;
+  double latency_us_total;
+  double latency_us_max;
+  long latency_us[AUDIO_TIME_BUCKETS];
+} *AudioStats;
+
+AudioStats audio_stats();
+void audio_stats_reset();
+
+/* backends call this whenever the device takes wanted int16 samples
+   with queued of capacity waiting for it */
+void audio_stats_device(int queued, int capacity, int wanted);
+
 /* provided by the system specific library */
 void native_audio_init();
 
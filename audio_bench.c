@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "audio.h"
+
+/**
+ * Polyphony benchmark for the mixer. For each device rate it plays 1
+ * up to AUDIO_MAX_VOICES voices at once, a third each sine, saw and
+ * saw through a two section lowpass, and times audio_fill_buffer on
+ * them offline. Output is tab separated on stdout, one row per rate
+ * and voice count:
+ *
+ *   rate voices ns_per_sample_voice realtime
+ *
+ * where a sample is a frame at the device rate and realtime is how
+ * many times faster than the audio lasts it mixed. Then one row per
+ * rate:
+ *
+ *   rate max_voices
+ *
+ * the most voices whose fills stay within AUDIO_DEADLINE_FRACTION of
+ * the time they last, from a straight line fit to the rows above. It
+ * can be more than the pool holds. usage: audio_bench_bin [seconds]
+ */
+
+#define BENCH_FILL_FRAMES 512
+
+static const int rates[] = {22050, 44100, 48000};
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void enqueue_voices(int nvoices, int64_t duration) {
+  static const float notes[] = {C_(1), D_(1), E_(1), F_(1), G_(1), A_(1),
+                                B_(1), C_(2)};
+  int64_t start = audio_schedule_sample();
+  float amp = 16000.0f / (nvoices + 1);
+  int vv;
+
+  for(vv = 0; vv < nvoices; ++vv) {
+    float freq = notes[vv % array_size(notes)] * (1 + vv / 8);
+    switch(vv % 3) {
+    case 0:
+      audio_enqueue(sinsampler_make(start, duration, freq, amp, 0));
+      break;
+    case 1:
+      audio_enqueue(sawsampler_make(start, duration, freq, amp, 0));
+      break;
+    default:
+      audio_enqueue(filtersampler_make(sawsampler_make(start, duration, freq,
+                                                       amp, 0),
+                                       BIQUAD_LOWPASS, 4 * freq, 0.707f, 2));
+      break;
+    }
+  }
+}
+
+/* wall clock seconds audio_fill_buffer takes for nframes at the
+   device rate */
+static double time_fills(long nframes) {
+  int16_t buffer[BENCH_FILL_FRAMES * NUM_CHANNELS];
+  double start = now_seconds();
+  long done;
+
+  for(done = 0; done < nframes; done += BENCH_FILL_FRAMES) {
+    audio_fill_buffer(buffer, array_size(buffer));
+  }
+  return now_seconds() - start;
+}
+
+int main(int argc, char ** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  int rr;
+
+  if(seconds <= 0) seconds = 2.0;
+  audio_init();
+
+  for(rr = 0; rr < array_size(rates); ++rr) {
+    int rate = rates[rr];
+    long nframes = (long)(seconds * rate);
+    /* least squares of cpu time per audio second on voices */
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, slope, intercept;
+    int npoints = 0, nvoices = 1;
+
+    audio_set_device_rate(rate);
+    for(;;) {
+      double cpu;
+
+      /* the voices outlast the warm up and the timed fills, and the
+         drain afterwards lets them finish so the next count starts
+         from nothing */
+      enqueue_voices(nvoices, (int64_t)((seconds + 0.2) * SAMPLE_FREQ)
+                     * NUM_CHANNELS);
+      time_fills(rate / 10);
+      cpu = time_fills(nframes) / seconds;
+      time_fills(rate / 5);
+
+      printf("%d\t%d\t%.3f\t%.1f\n", rate, nvoices,
+             cpu * 1e9 / ((double)rate * nvoices), 1.0 / cpu);
+      sx += nvoices;
+      sy += cpu;
+      sxx += (double)nvoices * nvoices;
+      sxy += nvoices * cpu;
+      npoints += 1;
+
+      if(nvoices == AUDIO_MAX_VOICES) break;
+      nvoices = nvoices * 2 > AUDIO_MAX_VOICES ? AUDIO_MAX_VOICES : nvoices * 2;
+    }
+
+    slope = (npoints * sxy - sx * sy) / (npoints * sxx - sx * sx);
+    intercept = (sy - slope * sx) / npoints;
+    printf("%d\t%ld\n", rate, slope > 0
+           ? (long)((AUDIO_DEADLINE_FRACTION - intercept) / slope) : -1L);
+  }
+  return 0;
+}
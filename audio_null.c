@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime and nanosleep */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "audio.h"
+#include "audio_null.h"
+#include "memory.h"
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_until(double when) {
+  double delta = when - now_seconds();
+  if(delta > 0) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)delta;
+    ts.tv_nsec = (long)((delta - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* wav is little endian whatever we're running on */
+static void write_u32(FILE* f, uint32_t v) {
+  unsigned char b[4] = {v, v >> 8, v >> 16, v >> 24};
+  fwrite(b, 1, 4, f);
+}
+
+static void write_u16(FILE* f, uint16_t v) {
+  unsigned char b[2] = {v, v >> 8};
+  fwrite(b, 1, 2, f);
+}
+
+static void write_wav_header(FILE* f, uint32_t data_bytes) {
+  fwrite("RIFF", 1, 4, f);
+  write_u32(f, 36 + data_bytes);
+  fwrite("WAVEfmt ", 1, 8, f);
+  write_u32(f, 16); /* fmt chunk size */
+  write_u16(f, 1); /* pcm */
+  write_u16(f, NUM_CHANNELS);
+  write_u32(f, audio_device_rate());
+  write_u32(f, audio_device_rate() * NUM_CHANNELS * 2); /* bytes per second */
+  write_u16(f, NUM_CHANNELS * 2); /* bytes per frame */
+  write_u16(f, 16); /* bits per sample */
+  fwrite("data", 1, 4, f);
+  write_u32(f, data_bytes);
+}
+
+static void write_samples(FILE* f, const int16_t* samples, int n) {
+  int ii;
+  for(ii = 0; ii < n; ++ii) {
+    write_u16(f, (uint16_t)samples[ii]);
+  }
+}
+
+FILE* audio_wav_open(const char* path) {
+  FILE* f = fopen(path, "wb");
+  if(f) write_wav_header(f, 0);
+  return f;
+}
+
+int audio_wav_close(FILE* wav) {
+  long data_bytes = ftell(wav) - 44;
+  int ok = data_bytes >= 0 && fseek(wav, 0, SEEK_SET) == 0;
+  if(ok) write_wav_header(wav, data_bytes);
+  ok = ok && !ferror(wav);
+  return fclose(wav) == 0 && ok;
+}
+
+int audio_null_render(FILE* wav, long nsamples, int realtime,
+                      AudioRenderStats stats) {
+  int16_t buffer[MIX_BLOCK_FRAMES * NUM_CHANNELS];
+  struct AudioRenderStats_ local;
+  long done = 0;
+  double start;
+
+  if(!stats) stats = &local;
+  stats->nsamples = 0;
+  stats->nblocks = 0;
+  stats->seconds = 0;
+  stats->max_block_ms = 0;
+  stats->max_voices = 0;
+  stats->voice_blocks = 0;
+
+  /* whole frames only */
+  nsamples -= nsamples % NUM_CHANNELS;
+
+  start = now_seconds();
+  while(done < nsamples) {
+    int n = MIN(nsamples - done, (long)array_size(buffer));
+    double block_start = now_seconds();
+    double block_ms;
+
+    audio_fill_buffer(buffer, n);
+
+    block_ms = (now_seconds() - block_start) * 1000.0;
+    stats->seconds += block_ms / 1000.0;
+    if(block_ms > stats->max_block_ms) stats->max_block_ms = block_ms;
+    if(audio_voices_mixed() > stats->max_voices) {
+      stats->max_voices = audio_voices_mixed();
+    }
+    stats->voice_blocks += audio_voices_mixed();
+    stats->nblocks += 1;
+    done += n;
+
+    if(wav) write_samples(wav, buffer, n);
+
+    /* hold the sample clock to the wall clock, as a device would */
+    if(realtime) {
+      sleep_until(start + (double)done / (NUM_CHANNELS * audio_device_rate()));
+    }
+  }
+  stats->nsamples = done;
+
+  return wav == NULL || !ferror(wav);
+}
+
+void audio_render_stats_print(AudioRenderStats stats, FILE* out) {
+  double audio_seconds = (double)stats->nsamples
+    / (NUM_CHANNELS * audio_device_rate());
+  double blocks = stats->nblocks > 0 ? stats->nblocks : 1;
+  double seconds = stats->seconds > 0 ? stats->seconds : 1e-9;
+
+  fprintf(out, "%ld samples in %.3f ms: %.0f samples/sec, %.1fx realtime, "
+          "block mean %.4f ms max %.4f ms, voices mean %.1f max %d\n",
+          stats->nsamples, stats->seconds * 1000.0,
+          stats->nsamples / seconds, audio_seconds / seconds,
+          stats->seconds * 1000.0 / blocks, stats->max_block_ms,
+          stats->voice_blocks / blocks, stats->max_voices);
+}
+
+/* there's no device to open. whoever wants audio calls
+   audio_null_render */
+void native_audio_init() {
+}
@@ -0,0 +1,37 @@
+#ifndef AUDIO_NULL_H
+#define AUDIO_NULL_H
+
+#include <stdio.h>
+
+/** audio_null.c is a backend without a device. Nothing plays on its
+ * own; audio_null_render pulls audio through audio_fill_buffer either
+ * as fast as it can (a throughput benchmark) or paced to the sample
+ * clock (simulated realtime) and can write what it mixed to a WAV
+ * file, which makes bit exact regression tests of the mixer possible.
+ */
+
+typedef struct AudioRenderStats_ {
+  long nsamples; /* int16 samples mixed */
+  long nblocks;
+  double seconds; /* wall clock spent mixing, not sleeping */
+  double max_block_ms;
+  int max_voices;
+  long voice_blocks; /* voices summed over every block */
+} *AudioRenderStats;
+
+/* mix nsamples from the current sample clock in MIX_BLOCK_FRAMES
+   blocks, appending them to wav unless it's NULL. stats may be NULL.
+   returns 0 if the samples couldn't be written */
+int audio_null_render(FILE* wav, long nsamples, int realtime,
+                      AudioRenderStats stats);
+
+/* a 16 bit stereo WAV file at the device rate. close fills in the
+   sizes in the header and returns 0 if anything failed to write */
+FILE* audio_wav_open(const char* path);
+int audio_wav_close(FILE* wav);
+
+/* one line summary: samples/sec, realtime factor, per block times and
+   voices */
+void audio_render_stats_print(AudioRenderStats stats, FILE* out);
+
+#endif
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "audio.h"
+#include "audio_null.h"
+
+/**
+ * Mixer throughput through the null backend. Plays bars of voices
+ * notes each, cycling through the waveforms, and prints the render
+ * stats. usage: audio_render_bin [seconds] [voices] [realtime]
+ * [out.wav]
+ */
+
+int main(int argc, char ** argv) {
+  static const float notes[] = {C_(1), D_(1), E_(1), F_(1), G_(1), A_(1),
+                                B_(1), C_(2)};
+  int seconds = argc > 1 ? atoi(argv[1]) : 10;
+  int voices = argc > 2 ? atoi(argv[2]) : 16;
+  int realtime = argc > 3 ? atoi(argv[3]) : 0;
+  FILE* wav = NULL;
+  long bar = SAMPLE_FREQ * NUM_CHANNELS;
+  int ss, vv;
+
+  struct AudioRenderStats_ total, stats;
+  total.nsamples = 0;
+  total.nblocks = 0;
+  total.seconds = 0;
+  total.max_block_ms = 0;
+  total.max_voices = 0;
+  total.voice_blocks = 0;
+
+  /* a bar's voices are still finishing while the next bar's play */
+  if(voices > NUM_SAMPLERS / 2 - 1) voices = NUM_SAMPLERS / 2 - 1;
+  if(voices < 0) voices = 0;
+  if(argc > 4 && !(wav = audio_wav_open(argv[4]))) {
+    fprintf(stderr, "couldn't open %s\n", argv[4]);
+    return 1;
+  }
+
+  audio_init();
+  for(ss = 0; ss < seconds; ++ss) {
+    int64_t start = audio_schedule_sample();
+    for(vv = 0; vv < voices; ++vv) {
+      float freq = notes[vv % array_size(notes)] * (1 + vv / 8);
+      long offset = (vv * 997) % (bar / 2) & ~(long)(NUM_CHANNELS - 1);
+      Sampler (*make)(long, long, float, float, float);
+      switch(vv % 4) {
+      case 0: make = sinsampler_make; break;
+      case 1: make = sawsampler_make; break;
+      case 2: make = squaresampler_make; break;
+      default: make = trianglesampler_make; break;
+      }
+      audio_enqueue(make(start + offset, bar, freq, 16000 / (voices + 1), 0));
+    }
+
+    audio_null_render(wav, bar, realtime, &stats);
+    total.nsamples += stats.nsamples;
+    total.nblocks += stats.nblocks;
+    total.seconds += stats.seconds;
+    total.voice_blocks += stats.voice_blocks;
+    if(stats.max_block_ms > total.max_block_ms) {
+      total.max_block_ms = stats.max_block_ms;
+    }
+    if(stats.max_voices > total.max_voices) {
+      total.max_voices = stats.max_voices;
+    }
+  }
+
+  audio_render_stats_print(&total, stdout);
+  if(wav && !audio_wav_close(wav)) {
+    fprintf(stderr, "couldn't write %s\n", argv[4]);
+    return 1;
+  }
+  return 0;
+}
@@ -5,11 +5,14 @@
 #include "ilclient.h"
 #include "threadlib.h"
 
-#define NUM_SAMPLES 1024
+/* frames per omx buffer */
+#define NUM_SAMPLES 512
+#define NUM_BUFFERS 4
 
 ILCLIENT_T *client;
 COMPONENT_T *audio_render;
 pthread_t audio_thread;
+Semaphore audio_wakeup;
 
 int scaled_buffer_size(int samples) {
   return (samples * 16 * 2) >> 3;
@@ -30,13 +33,17 @@ uint32_t audio_get_latency() {
    return param.nU32;
 }
 
+/* called by ilclient when the renderer has taken one of our buffers */
+void audio_buffer_done(void* data, COMPONENT_T* comp) {
+  semaphore_post(audio_wakeup);
+}
+
 void* audio_exec(void* udata) {
-  float buffer_time_us = (float)(1e6 * NUM_SAMPLES) / SAMPLE_FREQ;
   while(1) {
-    /* get a buffer */
+    /* get a buffer, waiting for the renderer to hand one back */
     OMX_BUFFERHEADERTYPE *hdr;
     while((hdr = ilclient_get_input_buffer(audio_render, 100, 0)) == NULL) {
-      usleep(buffer_time_us / 4); // wait 1/4 of the time to drain a buffer
+      semaphore_wait(audio_wakeup);
     }
 
     // fill the buffer
@@ -49,10 +56,16 @@ void* audio_exec(void* udata) {
     error = OMX_EmptyThisBuffer(ILC_GET_HANDLE(audio_render), hdr);
     assert(error == OMX_ErrorNone);
 
-    // drive down the latency to a buffer's length or less
-    uint32_t latency;
-    while(audio_get_latency() > NUM_SAMPLES) {
-      usleep(buffer_time_us / 2);
+    // hold the latency to the target fill. the renderer plays out at a
+    // known rate so sleep just long enough for the excess to drain
+    // rather than polling it
+    uint32_t latency = audio_get_latency();
+    // an underrun is the renderer having nothing left at all
+    audio_stats_device(latency * NUM_CHANNELS,
+                       NUM_BUFFERS * NUM_SAMPLES * NUM_CHANNELS, NUM_CHANNELS);
+    uint32_t target = audio_target_fill() / NUM_CHANNELS; /* in frames */
+    if(latency > target) {
+      usleep((uint64_t)(latency - target) * 1000000 / audio_device_rate());
     }
   }
 }
@@ -86,7 +99,7 @@ void native_audio_init() {
   int size = scaled_buffer_size(NUM_SAMPLES);
   size = (size + 15) & ~15;
   param.nBufferSize = size;
-  param.nBufferCountActual = 2;
+  param.nBufferCountActual = NUM_BUFFERS;
   
   error = OMX_SetParameter(ILC_GET_HANDLE(audio_render),
 			   OMX_IndexParamPortDefinition, &param);
@@ -100,7 +113,7 @@ void native_audio_init() {
   pcm.nChannels = 2;
   pcm.eNumData = OMX_NumericalDataSigned;
   pcm.eEndian = OMX_EndianLittle;
-  pcm.nSamplingRate = SAMPLE_FREQ;
+  pcm.nSamplingRate = AUDIO_DEVICE_FREQ;
   pcm.bInterleaved = OMX_TRUE;
   pcm.nBitPerSample = 16;
   pcm.ePCMMode = OMX_AUDIO_PCMModeLinear;
@@ -142,5 +155,8 @@ void native_audio_init() {
   assert(error == OMX_ErrorNone);
 
   // get the buffer flow going
+  audio_wakeup = semaphore_make(0);
+  ilclient_set_empty_buffer_done_callback(client, audio_buffer_done, NULL);
+  audio_set_device_rate(AUDIO_DEVICE_FREQ);
   pthread_create(&audio_thread, NULL, audio_exec, NULL);
 }
@@ -4,102 +4,103 @@
 
 #include "audio.h"
 #include "memory.h"
+#include "threadlib.h"
 
-#define NUM_SAMPLES 2048
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
 
-char * audio_pre_buffer;
-CircularBuffer audio_buffer;
+/* build with -DAUDIO_DIRECT to mix inside the callback, straight into
+   sdl's buffer. there's no producer thread or ring then, and the
+   device buffer is the only latency */
+#ifdef AUDIO_DIRECT
+
+#define NUM_SAMPLES 512
+
+void fill_audio(void *udata, Uint8 *stream, int len) {
+  // mixed on demand, so exactly what's wanted is always there
+  audio_stats_device(len / 2, len / 2, len / 2);
+  audio_fill_buffer((int16_t*)stream, len / 2);
+}
+
+#else
+
+/* frames per callback. the producer is woken as soon as a callback
+   has drained some audio, so this no longer has to cover a polling
+   interval */
+#define NUM_SAMPLES 1024
+
+/* the ring holds this many callbacks worth of audio */
+#define NUM_BUFFERS 4
+
+SPSCBuffer audio_buffer;
 pthread_t audio_thread;
-pthread_mutex_t audio_mutex;
-
-int buffer_samples_can_write() {
-  int result;
-  pthread_mutex_lock(&audio_mutex);
-  result = circularbuffer_bytes_writable(audio_buffer);
-  pthread_mutex_unlock(&audio_mutex);
-  return result / 2;
+Semaphore audio_wakeup;
+
+/* int16 samples to mix to bring the ring up to the target fill */
+int buffer_samples_wanted() {
+  int target = audio_target_fill();
+
+  /* any less than a callback's worth and the device will underrun */
+  target = MAX(target, NUM_SAMPLES * NUM_CHANNELS);
+
+  int buffered = spscbuffer_bytes_readable(audio_buffer) / 2;
+  return MIN(target, audio_buffer->size / 2) - buffered;
 }
 
+/* the producer. only this thread writes to audio_buffer */
 void* audio_exec(void* udata) {
-  float buffer_time_us = (float)(1e6 * NUM_SAMPLES) / SAMPLE_FREQ;
-  int sample_thresh = NUM_SAMPLES / 2;
   while(1) {
-    // wait till we can write a good chunk
+    // sleep until the callback has made room for a good chunk
     int nsamples;
-    while((nsamples = buffer_samples_can_write()) < sample_thresh) {
-      usleep(buffer_time_us / 4);
+    while((nsamples = buffer_samples_wanted()) < MIX_BLOCK_FRAMES * NUM_CHANNELS) {
+      semaphore_wait(audio_wakeup);
     }
 
-    // compute the audio that we know we need
-    audio_fill_buffer((int16_t*)audio_pre_buffer, nsamples);
-
-    // now lock the circular buffer and copy
-    pthread_mutex_lock(&audio_mutex);
-
+    // mix straight into the ring and publish it. the callback can't
+    // have taken away space, only freed more. a mirrored ring always
+    // hands back one span; the spans are whole frames either way
     int s1, s2;
     char *b1, *b2;
-    int nbytes = nsamples * 2;
-    circularbuffer_write_buffers(audio_buffer, &b1, &s1, &b2, &s2,
-                                 nbytes);
-
-    int to_write = MIN(nbytes, s1);
-    memcpy(b1, audio_pre_buffer, to_write);
-    nbytes -= to_write;
-
-    if(nbytes > 0) {
-      to_write = MIN(nbytes, s2);
-      memcpy(b2, &audio_pre_buffer[s1], to_write);
+    spscbuffer_write_buffers(audio_buffer, &b1, &s1, &b2, &s2, nsamples * 2);
+    audio_fill_buffer((int16_t*)b1, s1 / 2);
+    if(s2 > 0) {
+      audio_fill_buffer((int16_t*)b2, s2 / 2);
     }
-
-    pthread_mutex_unlock(&audio_mutex);
-
-    // don't immediately bang on the lock
-    usleep(buffer_time_us / 4);
+    spscbuffer_write_commit(audio_buffer, s1 + s2);
   }
 }
 
+/* the consumer, on sdl's audio thread. takes no locks */
 void fill_audio(void *udata, Uint8 *stream, int len) {
-  int nwords = len / 2;
   int s1, s2;
   char *b1, *b2;
 
-  pthread_mutex_lock(&audio_mutex);
-  circularbuffer_read_buffers(audio_buffer, &b1, &s1, &b2, &s2,
-                              len);
+  audio_stats_device(spscbuffer_bytes_readable(audio_buffer) / 2,
+                     audio_buffer->size / 2, len / 2);
 
-  int tocopy = MIN(len, s1);
-  memcpy(stream, b1, tocopy);
-  len -= tocopy;
+  spscbuffer_read_buffers(audio_buffer, &b1, &s1, &b2, &s2, len);
+  memcpy(stream, b1, s1);
+  if(s2 > 0) {
+    memcpy(stream + s1, b2, s2);
+  }
+  spscbuffer_read_commit(audio_buffer, s1 + s2);
 
-  if(len > 0) {
-    tocopy = MIN(len, s2);
-    memcpy(stream, b2, tocopy);
-    len -= tocopy;
+  // underrun, play silence rather than whatever sdl left there
+  if(s1 + s2 < len) {
+    memset(stream + s1 + s2, 0, len - (s1 + s2));
   }
 
-  pthread_mutex_unlock(&audio_mutex);
+  // there's room now, let the producer top the ring back up
+  semaphore_post(audio_wakeup);
 }
 
-/*
-void fill_audio(void *udata, Uint8 *stream, int len) {
-  audio_fill_buffer((int16_t*)stream, len / 2);
-}
-*/
+#endif
 
 void native_audio_init() {
-  // twice the number of samples in the sdl buffer (2 bytes per
-  // channel per sample)
-  int buffer_size = NUM_SAMPLES * 2 * 2 * 2;
-  audio_buffer = circularbuffer_make(buffer_size);
-  audio_pre_buffer = malloc(buffer_size);
-
-  pthread_mutex_init(&audio_mutex, NULL);
-  pthread_create(&audio_thread, NULL, audio_exec, NULL);
-
-  SDL_AudioSpec wanted;
+  SDL_AudioSpec wanted, obtained;
   
-  // Set the audio format 
-  wanted.freq = SAMPLE_FREQ;
+  // Set the audio format. ask for the device's own rate so nothing
+  // further down resamples again
+  wanted.freq = AUDIO_DEVICE_FREQ;
   wanted.format = AUDIO_S16SYS;
   wanted.channels = 2;    // 1 = mono, 2 = stereo 
   wanted.samples = NUM_SAMPLES;  // Good low-latency value for callback 
@@ -107,11 +108,31 @@ void native_audio_init() {
   wanted.callback = fill_audio;
   wanted.userdata = NULL;
 
-  // Open the audio device, forcing the desired format 
-  if ( SDL_OpenAudio(&wanted, NULL) < 0 ) {
+  // Open the audio device, taking whatever rate it runs at but
+  // forcing the sample format. it stays paused until we're ready
+  if ( SDL_OpenAudio(&wanted, &obtained) < 0 ) {
     fprintf(stderr, "Couldn't open audio: %s\n", SDL_GetError());
     exit(-1);
   }
+  if(obtained.format != AUDIO_S16SYS || obtained.channels != 2) {
+    SDL_CloseAudio();
+    obtained = wanted;
+    if ( SDL_OpenAudio(&wanted, NULL) < 0 ) {
+      fprintf(stderr, "Couldn't open audio: %s\n", SDL_GetError());
+      exit(-1);
+    }
+  }
+  audio_set_device_rate(obtained.freq);
+
+#ifndef AUDIO_DIRECT
+  // NUM_BUFFERS times the number of samples in the sdl buffer (2
+  // bytes per channel per sample)
+  int buffer_size = NUM_SAMPLES * NUM_BUFFERS * 2 * 2;
+  audio_buffer = spscbuffer_make_mirrored(buffer_size);
+
+  audio_wakeup = semaphore_make(0);
+  pthread_create(&audio_thread, NULL, audio_exec, NULL);
+#endif
 
   SDL_PauseAudio(0);
 }
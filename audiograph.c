@@ -0,0 +1,145 @@
+#include "audiograph.h"
+#include "mixer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+AudioGraph audiograph_make() {
+  AudioGraph graph = malloc(sizeof(struct AudioGraph_));
+  graph->nbuses = 1;
+  graph->buses[0].parent = -1;
+  graph->buses[0].gain = 1.0f;
+  graph->buses[0].neffects = 0;
+  audiograph_clear(graph);
+  return graph;
+}
+
+void audiograph_free(AudioGraph graph) {
+  int bb, ee;
+  for(bb = 0; bb < graph->nbuses; ++bb) {
+    AudioBus bus = &graph->buses[bb];
+    for(ee = 0; ee < bus->neffects; ++ee) {
+      free(bus->effects[ee].line);
+    }
+  }
+  free(graph);
+}
+
+int audiograph_add_bus(AudioGraph graph, int parent) {
+  AudioBus bus;
+  if(graph->nbuses == AUDIO_MAX_BUSES) return -1;
+  if(parent < 0 || parent >= graph->nbuses) return -1;
+
+  bus = &graph->buses[graph->nbuses];
+  bus->parent = parent;
+  bus->gain = 1.0f;
+  bus->neffects = 0;
+  memset(bus->buffer, 0, sizeof(bus->buffer));
+  osc_bank_clear(&bus->bank);
+  return graph->nbuses++;
+}
+
+/* the next free effect on bus, or NULL */
+static AudioEffect audiograph_new_effect(AudioGraph graph, int bus,
+                                         AudioEffectType type) {
+  AudioEffect effect;
+  if(bus < 0 || bus >= graph->nbuses) return NULL;
+  if(graph->buses[bus].neffects == AUDIO_MAX_EFFECTS) return NULL;
+
+  effect = &graph->buses[bus].effects[graph->buses[bus].neffects++];
+  effect->type = type;
+  effect->line = NULL;
+  effect->line_frames = 0;
+  effect->line_pos = 0;
+  effect->feedback = 0.0f;
+  effect->wet = 0.0f;
+  return effect;
+}
+
+int audiograph_add_biquad(AudioGraph graph, int bus, BiquadType type,
+                          float cutoff, float q, int nsections) {
+  AudioEffect effect = audiograph_new_effect(graph, bus, AUDIO_EFFECT_BIQUAD);
+  if(!effect) return -1;
+  biquad_init(&effect->biquad, type, cutoff, q, nsections, SAMPLE_FREQ);
+  return graph->buses[bus].neffects - 1;
+}
+
+int audiograph_add_delay(AudioGraph graph, int bus, int64_t delay,
+                         float feedback, float wet) {
+  AudioEffect effect = audiograph_new_effect(graph, bus, AUDIO_EFFECT_DELAY);
+  if(!effect) return -1;
+  effect->line_frames = delay / NUM_CHANNELS > 0 ? delay / NUM_CHANNELS : 1;
+  effect->line = calloc(effect->line_frames, sizeof(float));
+  effect->feedback = feedback;
+  effect->wet = wet;
+  return graph->buses[bus].neffects - 1;
+}
+
+void audiograph_set_gain(AudioGraph graph, int bus, float gain) {
+  if(bus < 0 || bus >= graph->nbuses) return;
+  __atomic_store(&graph->buses[bus].gain, &gain, __ATOMIC_RELAXED);
+}
+
+void audiograph_clear(AudioGraph graph) {
+  int bb;
+  for(bb = 0; bb < graph->nbuses; ++bb) {
+    memset(graph->buses[bb].buffer, 0, sizeof(graph->buses[bb].buffer));
+    osc_bank_clear(&graph->buses[bb].bank);
+  }
+}
+
+static void delay_process(AudioEffect effect, float* buffer, int n) {
+  float* line = effect->line;
+  int pos = effect->line_pos;
+  int ii;
+
+  for(ii = 0; ii < n; ++ii) {
+    float delayed = line[pos];
+    line[pos] = buffer[ii] + effect->feedback * delayed;
+    buffer[ii] += effect->wet * delayed;
+    if(++pos == effect->line_frames) pos = 0;
+  }
+  effect->line_pos = pos;
+}
+
+static void effect_process(AudioEffect effect, float* buffer, int n) {
+  switch(effect->type) {
+  case AUDIO_EFFECT_BIQUAD:
+    if(effect->biquad.nsections > 0) biquad_process(&effect->biquad, buffer, n);
+    break;
+  case AUDIO_EFFECT_DELAY:
+    delay_process(effect, buffer, n);
+    break;
+  }
+}
+
+void audiograph_process(AudioGraph graph, float* mix, int nframes) {
+  int bb, ee, ii;
+
+  for(bb = graph->nbuses - 1; bb >= 0; --bb) {
+    AudioBus bus = &graph->buses[bb];
+    float gain;
+
+    /* the oscillators go in after the voices that were rendered, as
+       they always have */
+    if(bus->bank.nvoices > 0) osc_bank_mix(&bus->bank, bus->buffer, nframes);
+    for(ee = 0; ee < bus->neffects; ++ee) {
+      effect_process(&bus->effects[ee], bus->buffer, nframes);
+    }
+
+    __atomic_load(&bus->gain, &gain, __ATOMIC_RELAXED);
+    if(bb == 0) {
+      for(ii = 0; ii < nframes; ++ii) {
+        mix[ii] = bus->buffer[ii] * gain;
+      }
+    } else {
+      if(gain != 1.0f) {
+        for(ii = 0; ii < nframes; ++ii) {
+          bus->buffer[ii] *= gain;
+        }
+      }
+      /* a bus is one more voice to its parent */
+      mixer_accumulate(graph->buses[bus->parent].buffer, bus->buffer, nframes);
+    }
+  }
+}
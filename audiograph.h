@@ -0,0 +1,80 @@
+#ifndef AUDIOGRAPH_H
+#define AUDIOGRAPH_H
+
+#include <stdint.h>
+
+#include "biquad.h"
+#include "osc.h"
+
+/* frames mixed per pass over the playlist */
+#define MIX_BLOCK_FRAMES 256
+
+#define AUDIO_MAX_BUSES 8
+#define AUDIO_MAX_EFFECTS 4
+
+/** Voices are mixed into buses and each bus runs its chain of effects
+ * and then its gain before it is mixed into its parent. Bus 0 is the
+ * master, whose output is the mix. A bus can only be added under one
+ * that already exists, so every child has a higher index than its
+ * parent and processing the buses from the last to the first is a
+ * topological order. Everything the mixer touches, the delay lines
+ * included, is allocated while the graph is built.
+ */
+
+typedef enum {
+  AUDIO_EFFECT_BIQUAD,
+  AUDIO_EFFECT_DELAY
+} AudioEffectType;
+
+typedef struct AudioEffect_ {
+  AudioEffectType type;
+  struct Biquad_ biquad;
+
+  /* a feedback echo: each frame adds wet times the line, and the line
+     takes the frame plus feedback times what it held */
+  float* line;
+  int line_frames;
+  int line_pos;
+  float feedback;
+  float wet;
+} *AudioEffect;
+
+typedef struct AudioBus_ {
+  int parent; /* -1 for the master */
+  float gain; /* may be changed while the graph plays */
+  int neffects;
+  struct AudioEffect_ effects[AUDIO_MAX_EFFECTS];
+  float buffer[MIX_BLOCK_FRAMES];
+  struct OscBank_ bank; /* its oscillator voices this block */
+} *AudioBus;
+
+typedef struct AudioGraph_ {
+  int nbuses;
+  struct AudioBus_ buses[AUDIO_MAX_BUSES];
+} *AudioGraph;
+
+/* just the master, at unity gain with no effects */
+AudioGraph audiograph_make();
+void audiograph_free(AudioGraph graph);
+
+/* these return the new bus or effect, or -1 if there's no room or
+   the bus doesn't exist. only while the graph isn't playing */
+int audiograph_add_bus(AudioGraph graph, int parent);
+int audiograph_add_biquad(AudioGraph graph, int bus, BiquadType type,
+                          float cutoff, float q, int nsections);
+/* delay in ticks of the sample clock */
+int audiograph_add_delay(AudioGraph graph, int bus, int64_t delay,
+                         float feedback, float wet);
+
+/* safe from any thread while the graph plays. it takes effect from
+   the next block */
+void audiograph_set_gain(AudioGraph graph, int bus, float gain);
+
+/* empty every bus for a block. the mixer then adds voices to their
+   buses' buffers and banks */
+void audiograph_clear(AudioGraph graph);
+
+/* run nframes through the graph, leaving the master's output in mix */
+void audiograph_process(AudioGraph graph, float* mix, int nframes);
+
+#endif
@@ -0,0 +1,245 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stb_image.h"
+
+/**
+ * Decode benchmark over the shipped assets. Every image under spacer/
+ * and monster/ plus test.png is read into memory once and then decoded
+ * from there, so disk time is not measured. Output is tab separated on
+ * stdout, one row per image and one summary row per format, for each
+ * combination of decoder path (scalar or simd) and thread count:
+ *
+ *   name format path threads iterations ms_per_image mb_per_s
+ *
+ * MB/s counts decoded pixel bytes. usage: bench_images_bin [iterations]
+ * [threads]
+ */
+
+#define MAX_IMAGES 256
+
+typedef struct Image_ {
+  char path[256];
+  const char* format;
+  unsigned char* bytes;
+  int length;
+  long decoded_size;
+} *Image;
+
+static struct Image_ images[MAX_IMAGES];
+static int num_images = 0;
+
+double now_millis() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+const char* image_format_name(const char* path) {
+  const char* ext = strrchr(path, '.');
+  if(!ext) return NULL;
+  if(strcmp(ext, ".png") == 0) return "png";
+  if(strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) return "jpg";
+  return NULL;
+}
+
+void image_add(const char* path) {
+  const char* format = image_format_name(path);
+  FILE* f;
+  Image image;
+  int w, h, n;
+  unsigned char* pixels;
+
+  if(!format || num_images == MAX_IMAGES) return;
+  if(!(f = fopen(path, "rb"))) return;
+
+  image = &images[num_images];
+  snprintf(image->path, sizeof(image->path), "%s", path);
+  image->format = format;
+
+  fseek(f, 0, SEEK_END);
+  image->length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  image->bytes = malloc(image->length);
+  if(fread(image->bytes, 1, image->length, f) != (size_t)image->length) {
+    fclose(f);
+    free(image->bytes);
+    return;
+  }
+  fclose(f);
+
+  // decode once to check it loads and to learn the output size
+  pixels = stbi_load_from_memory(image->bytes, image->length, &w, &h, &n, 0);
+  if(!pixels) {
+    fprintf(stderr, "skipping %s: %s\n", path, stbi_failure_reason());
+    free(image->bytes);
+    return;
+  }
+  image->decoded_size = (long)w * h * n;
+  stbi_image_free(pixels);
+  ++num_images;
+}
+
+void image_add_dir(const char* dir) {
+  DIR* d = opendir(dir);
+  struct dirent* ent;
+  char path[256];
+
+  if(!d) return;
+  while((ent = readdir(d))) {
+    if(ent->d_name[0] == '.') continue;
+    /* a path that doesn't fit would name the wrong file */
+    if(snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name)
+       >= (int)sizeof(path)) {
+      continue;
+    }
+    if(image_format_name(path)) {
+      image_add(path);
+    } else {
+      image_add_dir(path);
+    }
+  }
+  closedir(d);
+}
+
+/* a set of images decoded iterations times, spread over threads */
+typedef struct Job_ {
+  Image* set;
+  int count;
+  int iterations;
+  int next; /* next decode to hand out, guarded by mutex */
+  pthread_mutex_t mutex;
+} *Job;
+
+void* job_worker(void* data) {
+  Job job = (Job)data;
+  for(;;) {
+    int w, h, n, ticket;
+    Image image;
+    unsigned char* pixels;
+
+    pthread_mutex_lock(&job->mutex);
+    ticket = job->next++;
+    pthread_mutex_unlock(&job->mutex);
+    if(ticket >= job->count * job->iterations) break;
+
+    image = job->set[ticket % job->count];
+    pixels = stbi_load_from_memory(image->bytes, image->length, &w, &h, &n, 0);
+    stbi_image_free(pixels);
+  }
+  return NULL;
+}
+
+/* wall clock milliseconds to decode every image in set iterations times */
+double job_run(Image* set, int count, int iterations, int nthreads) {
+  pthread_t threads[64];
+  struct Job_ job;
+  double start;
+  int ii;
+
+  job.set = set;
+  job.count = count;
+  job.iterations = iterations;
+  job.next = 0;
+  pthread_mutex_init(&job.mutex, NULL);
+
+  start = now_millis();
+  if(nthreads == 1) {
+    job_worker(&job);
+  } else {
+    for(ii = 0; ii < nthreads; ++ii) {
+      pthread_create(&threads[ii], NULL, job_worker, &job);
+    }
+    for(ii = 0; ii < nthreads; ++ii) {
+      pthread_join(threads[ii], NULL);
+    }
+  }
+  start = now_millis() - start;
+
+  pthread_mutex_destroy(&job.mutex);
+  return start;
+}
+
+void report(const char* name, const char* format, const char* path,
+            int nthreads, int iterations, int count, long bytes,
+            double millis) {
+  double decodes = (double)count * iterations;
+  printf("%s\t%s\t%s\t%d\t%d\t%.3f\t%.2f\n", name, format, path, nthreads,
+         iterations, millis / decodes,
+         (bytes * (double)iterations / (1024.0 * 1024.0)) / (millis / 1000.0));
+}
+
+void bench(const char* path, int simd, int nthreads, int iterations) {
+  static const char* formats[] = {"png", "jpg"};
+  Image set[MAX_IMAGES];
+  int ii, ff;
+
+  stbi_set_simd(simd);
+
+  // per image rows only make sense single threaded
+  if(nthreads == 1) {
+    for(ii = 0; ii < num_images; ++ii) {
+      Image image = &images[ii];
+      double millis = job_run(&image, 1, iterations, 1);
+      report(image->path, image->format, path, 1, iterations, 1,
+             image->decoded_size, millis);
+    }
+  }
+
+  for(ff = 0; ff < sizeof(formats) / sizeof(formats[0]); ++ff) {
+    int count = 0;
+    long bytes = 0;
+    for(ii = 0; ii < num_images; ++ii) {
+      if(strcmp(images[ii].format, formats[ff]) == 0) {
+        set[count++] = &images[ii];
+        bytes += images[ii].decoded_size;
+      }
+    }
+    if(count == 0) continue;
+
+    report("all", formats[ff], path, nthreads, iterations, count, bytes,
+           job_run(set, count, iterations, nthreads));
+  }
+}
+
+int main(int argc, char ** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 10;
+  int nthreads = argc > 2 ? atoi(argv[2]) : 0;
+  int simd;
+
+  if(nthreads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if(nthreads <= 0) nthreads = 4;
+  }
+  if(nthreads > 64) nthreads = 64;
+  if(iterations <= 0) iterations = 1;
+
+  image_add_dir("spacer");
+  image_add_dir("monster");
+  image_add("test.png");
+
+  if(num_images == 0) {
+    fprintf(stderr, "no images found, run from the source directory\n");
+    return 1;
+  }
+
+  printf("name\tformat\tpath\tthreads\titerations\tms_per_image\tmb_per_s\n");
+  for(simd = 0; simd < 2; ++simd) {
+    const char* path = simd ? "simd" : "scalar";
+    bench(path, simd, 1, iterations);
+    if(nthreads > 1) {
+      bench(path, simd, nthreads, iterations);
+    }
+  }
+
+  return 0;
+}
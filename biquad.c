@@ -0,0 +1,319 @@
+#include "biquad.h"
+#include "cpu.h"
+#include "memory.h"
+
+#include <math.h>
+
+#ifdef CPU_X86
+#include <emmintrin.h>
+#endif
+
+#ifdef CPU_BUILD_NEON
+#include <arm_neon.h>
+#endif
+
+#ifndef M_PI /* strict c99 headers leave it out */
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+
+/* the pipeline runs one section per lane, so the last lane trails the
+   first by this many samples */
+#define SKEW (BIQUAD_MAX_SECTIONS - 1)
+
+/* state smaller than this is flushed at the end of a block. a filter
+   left ringing into silence would otherwise decay into denormals,
+   which are very slow on x86 */
+#define STATE_FLOOR 1e-15f
+
+extern FixedAllocator sampler_allocator;
+void sampler_free(void* obj);
+
+void biquad_design(Biquad filter, BiquadType type, float cutoff, float q,
+                   int nsections, float sample_freq) {
+  double w0, cw, alpha, a0, b0, b1, b2;
+  int kk;
+
+  cutoff = MIN(MAX(cutoff, 1.0f), 0.49f * sample_freq);
+  q = MAX(q, 0.05f);
+  w0 = 2 * M_PI * cutoff / sample_freq;
+  cw = cos(w0);
+  alpha = sin(w0) / (2 * q);
+  a0 = 1 + alpha;
+
+  switch(type) {
+  case BIQUAD_HIGHPASS:
+    b0 = (1 + cw) / 2;
+    b1 = -(1 + cw);
+    b2 = b0;
+    break;
+  case BIQUAD_BANDPASS:
+    b0 = alpha;
+    b1 = 0;
+    b2 = -alpha;
+    break;
+  default:
+    b0 = (1 - cw) / 2;
+    b1 = 1 - cw;
+    b2 = b0;
+    break;
+  }
+
+  filter->nsections = MIN(MAX(nsections, 0), BIQUAD_MAX_SECTIONS);
+  for(kk = 0; kk < BIQUAD_MAX_SECTIONS; ++kk) {
+    if(kk < filter->nsections) {
+      filter->b0[kk] = b0 / a0;
+      filter->b1[kk] = b1 / a0;
+      filter->b2[kk] = b2 / a0;
+      filter->a1[kk] = -2 * cw / a0;
+      filter->a2[kk] = (1 - alpha) / a0;
+    } else {
+      /* pass through, and stays silent so nothing leaks out of a
+         section that was just switched off */
+      filter->b0[kk] = 1.0f;
+      filter->b1[kk] = 0.0f;
+      filter->b2[kk] = 0.0f;
+      filter->a1[kk] = 0.0f;
+      filter->a2[kk] = 0.0f;
+      filter->z1[kk] = 0.0f;
+      filter->z2[kk] = 0.0f;
+    }
+  }
+}
+
+void biquad_reset(Biquad filter) {
+  int kk;
+  for(kk = 0; kk < BIQUAD_MAX_SECTIONS; ++kk) {
+    filter->z1[kk] = 0.0f;
+    filter->z2[kk] = 0.0f;
+  }
+}
+
+void biquad_init(Biquad filter, BiquadType type, float cutoff, float q,
+                 int nsections, float sample_freq) {
+  biquad_design(filter, type, cutoff, q, nsections, sample_freq);
+  biquad_reset(filter);
+}
+
+static void biquad_flush(Biquad filter) {
+  int kk;
+  for(kk = 0; kk < BIQUAD_MAX_SECTIONS; ++kk) {
+    if(fabsf(filter->z1[kk]) < STATE_FLOOR) filter->z1[kk] = 0.0f;
+    if(fabsf(filter->z2[kk]) < STATE_FLOOR) filter->z2[kk] = 0.0f;
+  }
+}
+
+/* one sample through section kk. the vector paths do the same
+   operations in the same order so they agree with this exactly */
+static inline float section_tick(Biquad filter, int kk, float x) {
+  float y = filter->b0[kk] * x + filter->z1[kk];
+  filter->z1[kk] = (filter->b1[kk] * x - filter->a1[kk] * y) + filter->z2[kk];
+  filter->z2[kk] = filter->b2[kk] * x - filter->a2[kk] * y;
+  return y;
+}
+
+void biquad_process_scalar(Biquad filter, float* values, int n) {
+  int ii, kk;
+
+  /* sections are in series, so a whole block can go through each in
+     turn with its state in registers */
+  for(kk = 0; kk < filter->nsections; ++kk) {
+    float b0 = filter->b0[kk], b1 = filter->b1[kk], b2 = filter->b2[kk];
+    float a1 = filter->a1[kk], a2 = filter->a2[kk];
+    float z1 = filter->z1[kk], z2 = filter->z2[kk];
+    for(ii = 0; ii < n; ++ii) {
+      float x = values[ii];
+      float y = b0 * x + z1;
+      z1 = (b1 * x - a1 * y) + z2;
+      z2 = b2 * x - a2 * y;
+      values[ii] = y;
+    }
+    filter->z1[kk] = z1;
+    filter->z2[kk] = z2;
+  }
+  biquad_flush(filter);
+}
+
+/** The vector paths skew the cascade so each lane is a section: at
+ * step t lane k filters sample t - k, taking lane k - 1's output from
+ * step t - 1. Before the first step the leading samples are run
+ * through the sections that are ahead of the last lane, and after the
+ * last step the trailing samples are run through the ones behind.
+ */
+
+/* fill lanes 1..SKEW with their inputs for the first step, t = SKEW */
+static void pipeline_start(Biquad filter, const float* values, float* lanes) {
+  int ss, kk;
+  for(ss = 0; ss < SKEW; ++ss) {
+    float v = values[ss];
+    for(kk = 0; kk < SKEW - ss; ++kk) {
+      v = section_tick(filter, kk, v);
+    }
+    lanes[SKEW - ss] = v;
+  }
+}
+
+/* last holds every lane's output from the final step, t = n - 1. lane
+   k has taken sample n - 1 - k through section k */
+static void pipeline_finish(Biquad filter, float* values, int n,
+                            const float* last) {
+  int ss, kk;
+  for(ss = 0; ss < SKEW; ++ss) {
+    int lane = SKEW - 1 - ss;
+    float v = last[lane];
+    for(kk = lane + 1; kk < BIQUAD_MAX_SECTIONS; ++kk) {
+      v = section_tick(filter, kk, v);
+    }
+    values[n - SKEW + ss] = v;
+  }
+}
+
+/* a single section has nothing to run alongside it */
+#define PIPELINE_WORTHWHILE(filter, n) \
+  ((filter)->nsections > 1 && (n) > SKEW)
+
+#ifdef CPU_X86
+
+CPU_TARGET_SSE2
+static void process_sse2(Biquad filter, float* values, int n) {
+  float lanes[BIQUAD_MAX_SECTIONS];
+  int tt;
+
+  if(!PIPELINE_WORTHWHILE(filter, n)) {
+    biquad_process_scalar(filter, values, n);
+    return;
+  }
+
+  pipeline_start(filter, values, lanes);
+  lanes[0] = values[SKEW];
+
+  __m128 b0 = _mm_loadu_ps(filter->b0), b1 = _mm_loadu_ps(filter->b1);
+  __m128 b2 = _mm_loadu_ps(filter->b2);
+  __m128 a1 = _mm_loadu_ps(filter->a1), a2 = _mm_loadu_ps(filter->a2);
+  __m128 z1 = _mm_loadu_ps(filter->z1), z2 = _mm_loadu_ps(filter->z2);
+  __m128 x = _mm_loadu_ps(lanes);
+  __m128 y = x;
+
+  for(tt = SKEW; tt < n; ++tt) {
+    y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+    z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+    z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+
+    /* the last lane is done with sample tt - SKEW */
+    values[tt - SKEW] = _mm_cvtss_f32(_mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3)));
+
+    /* every lane hands its output up one, and the next sample enters */
+    if(tt + 1 < n) {
+      x = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(y), 4));
+      x = _mm_move_ss(x, _mm_set_ss(values[tt + 1]));
+    }
+  }
+
+  _mm_storeu_ps(filter->z1, z1);
+  _mm_storeu_ps(filter->z2, z2);
+  _mm_storeu_ps(lanes, y);
+  pipeline_finish(filter, values, n, lanes);
+  biquad_flush(filter);
+}
+
+#endif
+
+#ifdef CPU_BUILD_NEON
+
+static void process_neon(Biquad filter, float* values, int n) {
+  float lanes[BIQUAD_MAX_SECTIONS];
+  int tt;
+
+  if(!PIPELINE_WORTHWHILE(filter, n)) {
+    biquad_process_scalar(filter, values, n);
+    return;
+  }
+
+  pipeline_start(filter, values, lanes);
+  lanes[0] = values[SKEW];
+
+  float32x4_t b0 = vld1q_f32(filter->b0), b1 = vld1q_f32(filter->b1);
+  float32x4_t b2 = vld1q_f32(filter->b2);
+  float32x4_t a1 = vld1q_f32(filter->a1), a2 = vld1q_f32(filter->a2);
+  float32x4_t z1 = vld1q_f32(filter->z1), z2 = vld1q_f32(filter->z2);
+  float32x4_t x = vld1q_f32(lanes);
+  float32x4_t y = x;
+
+  for(tt = SKEW; tt < n; ++tt) {
+    y = vaddq_f32(vmulq_f32(b0, x), z1);
+    z1 = vaddq_f32(vsubq_f32(vmulq_f32(b1, x), vmulq_f32(a1, y)), z2);
+    z2 = vsubq_f32(vmulq_f32(b2, x), vmulq_f32(a2, y));
+
+    values[tt - SKEW] = vgetq_lane_f32(y, 3);
+
+    /* [next, y0, y1, y2] */
+    if(tt + 1 < n) {
+      x = vextq_f32(vdupq_n_f32(values[tt + 1]), y, 3);
+    }
+  }
+
+  vst1q_f32(filter->z1, z1);
+  vst1q_f32(filter->z2, z2);
+  vst1q_f32(lanes, y);
+  pipeline_finish(filter, values, n, lanes);
+  biquad_flush(filter);
+}
+
+#endif
+
+static void (* const process_kernels[CPU_NUM_LEVELS])(Biquad, float*, int) = {
+  [CPU_SCALAR] = biquad_process_scalar,
+#ifdef CPU_X86
+  [CPU_SSE2] = process_sse2,
+  [CPU_SSE41] = process_sse2,
+  [CPU_AVX2] = process_sse2,
+#endif
+#ifdef CPU_BUILD_NEON
+  [CPU_NEON] = process_neon,
+#endif
+};
+
+void biquad_process(Biquad filter, float* values, int n) {
+  process_kernels[cpu_level()](filter, values, n);
+}
+
+static int16_t filter_sample(FilterSampler filter, int64_t sample) {
+  float value = (float)SAMPLE(filter->source, sample) / INT16_MAX;
+  biquad_process_scalar(&filter->biquad, &value, 1);
+
+  value *= INT16_MAX;
+  if(value >= INT16_MAX) return INT16_MAX;
+  if(value <= INT16_MIN) return INT16_MIN;
+  return (int16_t)value;
+}
+
+static void filter_render(FilterSampler filter, int64_t start, int n,
+                          float* out) {
+  RENDER(filter->source, start, n, out);
+  biquad_process(&filter->biquad, out, n);
+}
+
+static void filter_release(FilterSampler filter) {
+  RELEASE_SAMPLER(filter->source);
+  sampler_free(filter);
+}
+
+Sampler filtersampler_make(Sampler source, BiquadType type, float cutoff,
+                           float q, int nsections) {
+  FilterSampler filter
+    = (FilterSampler)fixed_allocator_try_alloc(sampler_allocator);
+  if(!filter) {
+    RELEASE_SAMPLER(source);
+    return sampler_silence();
+  }
+  filter->sampler.function = (SamplerFunction)filter_sample;
+  filter->sampler.render = (SamplerRender)filter_render;
+  filter->sampler.release = (ReleaseSampler)filter_release;
+  filter->sampler.start_sample = START(source);
+  filter->sampler.duration_samples = DURATION(source);
+  filter->source = source;
+  biquad_init(&filter->biquad, type, cutoff, q, nsections, SAMPLE_FREQ);
+
+  return (Sampler)filter;
+}
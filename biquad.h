@@ -0,0 +1,60 @@
+#ifndef BIQUAD_H
+#define BIQUAD_H
+
+#include "sampler.h"
+
+/** Second order IIR sections from the RBJ audio EQ cookbook, in
+ * transposed direct form II with float state. A filter is a cascade
+ * of up to BIQUAD_MAX_SECTIONS identical sections: each one adds 12
+ * dB/octave of slope. Sections past nsections pass their input through
+ * unchanged, so the SIMD path can always run all of them, one per
+ * lane, with lane k working on the sample k behind lane 0.
+ */
+
+typedef enum {
+  BIQUAD_LOWPASS = 0,
+  BIQUAD_HIGHPASS,
+  BIQUAD_BANDPASS, /* 0 dB at the center frequency */
+  BIQUAD_NUM_TYPES
+} BiquadType;
+
+#define BIQUAD_MAX_SECTIONS 4
+
+typedef struct Biquad_ {
+  int nsections;
+  /* normalized so a0 is 1 */
+  float b0[BIQUAD_MAX_SECTIONS];
+  float b1[BIQUAD_MAX_SECTIONS];
+  float b2[BIQUAD_MAX_SECTIONS];
+  float a1[BIQUAD_MAX_SECTIONS];
+  float a2[BIQUAD_MAX_SECTIONS];
+  float z1[BIQUAD_MAX_SECTIONS];
+  float z2[BIQUAD_MAX_SECTIONS];
+} *Biquad;
+
+/* cutoff (or center) in hz and q per section. nsections is clamped to
+   [0, BIQUAD_MAX_SECTIONS]; 0 passes everything through. design only
+   touches the coefficients so a filter can be swept while it runs.
+   neither allocates */
+void biquad_init(Biquad filter, BiquadType type, float cutoff, float q,
+                 int nsections, float sample_freq);
+void biquad_design(Biquad filter, BiquadType type, float cutoff, float q,
+                   int nsections, float sample_freq);
+void biquad_reset(Biquad filter);
+
+/* filter n normalized samples in place, carrying state across calls */
+void biquad_process(Biquad filter, float* values, int n);
+void biquad_process_scalar(Biquad filter, float* values, int n);
+
+/* a sampler that runs source through a filter as it renders. it
+   starts and ends with source and releases it when it's released */
+typedef struct FilterSampler_ {
+  struct Sampler_ sampler;
+  Sampler source;
+  struct Biquad_ biquad;
+} *FilterSampler;
+
+Sampler filtersampler_make(Sampler source, BiquadType type, float cutoff,
+                           float q, int nsections);
+
+#endif
@@ -0,0 +1,83 @@
+#include "cpu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* level_names[CPU_NUM_LEVELS] = {
+  "scalar", "sse2", "sse4.1", "avx2", "neon"
+};
+
+/* -1 until the first call to cpu_level or cpu_detected */
+static int detected = -1;
+static int current = -1;
+
+static CpuLevel cpu_detect() {
+#if defined(CPU_X86)
+  /* the builtins check the os saves the wide registers too */
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) return CPU_AVX2;
+  if(__builtin_cpu_supports("sse4.1")) return CPU_SSE41;
+  if(__builtin_cpu_supports("sse2")) return CPU_SSE2;
+  return CPU_SCALAR;
+#elif defined(CPU_BUILD_NEON)
+  return CPU_NEON;
+#else
+  return CPU_SCALAR;
+#endif
+}
+
+static int cpu_has(CpuLevel level) {
+  int best = __atomic_load_n(&detected, __ATOMIC_RELAXED);
+  if(level == CPU_SCALAR) return 1;
+  if(level == CPU_NEON || best == CPU_NEON) return level == best;
+  return level <= best;
+}
+
+/* racing threads find the same answer, so whichever stores last is
+   fine */
+static void cpu_init() {
+  const char* name = getenv("CPU_LEVEL");
+  CpuLevel level = cpu_detect();
+
+  __atomic_store_n(&detected, level, __ATOMIC_RELAXED);
+  if(name && cpu_level_named(name) < CPU_NUM_LEVELS) {
+    level = cpu_level_named(name);
+    while(!cpu_has(level)) --level;
+  }
+  __atomic_store_n(&current, level, __ATOMIC_RELAXED);
+}
+
+CpuLevel cpu_level() {
+  int level = __atomic_load_n(&current, __ATOMIC_RELAXED);
+  if(level < 0) {
+    cpu_init();
+    level = __atomic_load_n(&current, __ATOMIC_RELAXED);
+  }
+  return level;
+}
+
+CpuLevel cpu_detected() {
+  cpu_level();
+  return __atomic_load_n(&detected, __ATOMIC_RELAXED);
+}
+
+CpuLevel cpu_set_level(CpuLevel level) {
+  cpu_level();
+  if(level >= CPU_NUM_LEVELS) level = CPU_NUM_LEVELS - 1;
+  while(!cpu_has(level)) --level;
+  __atomic_store_n(&current, level, __ATOMIC_RELAXED);
+  return level;
+}
+
+const char* cpu_level_name(CpuLevel level) {
+  if(level < 0 || level >= CPU_NUM_LEVELS) return "unknown";
+  return level_names[level];
+}
+
+CpuLevel cpu_level_named(const char* name) {
+  int ii;
+  for(ii = 0; ii < CPU_NUM_LEVELS; ++ii) {
+    if(strcmp(name, level_names[ii]) == 0) return ii;
+  }
+  return CPU_NUM_LEVELS;
+}
@@ -0,0 +1,55 @@
+#ifndef CPU_H
+#define CPU_H
+
+/** Which vector instructions the kernels use, found once per run. A
+ * module with vectorized kernels compiles every version the compiler
+ * can target into a table indexed by CpuLevel and calls through the
+ * entry for cpu_level(), so one binary runs the best the machine has.
+ * The x86 levels each include the ones below them and NEON stands on
+ * its own. A level with nothing better written for it uses the next
+ * one down, so a table always has an entry for every level cpu_level()
+ * can return.
+ *
+ * CPU_LEVEL in the environment (scalar, sse2, sse4.1, avx2 or neon)
+ * sets the level for the run, which is how one machine tests every
+ * path. It never goes past what the cpu has.
+ */
+
+typedef enum {
+  CPU_SCALAR,
+  CPU_SSE2,
+  CPU_SSE41,
+  CPU_AVX2,
+  CPU_NEON,
+  CPU_NUM_LEVELS
+} CpuLevel;
+
+/* x86 kernels are built whatever the compiler targets by default and
+   carry the level they need */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define CPU_X86
+#define CPU_TARGET_SSE2 __attribute__((target("sse2")))
+#define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* NEON can't be picked per function, it's there if the build has it */
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define CPU_BUILD_NEON
+#endif
+
+/* the level kernels use. safe from any thread */
+CpuLevel cpu_level();
+/* the best level the cpu has, whatever CPU_LEVEL says */
+CpuLevel cpu_detected();
+
+/* use level, or the closest one below it the cpu has, and return which
+   that was. for tests and benchmarks, kernels already running finish
+   on the old level */
+CpuLevel cpu_set_level(CpuLevel level);
+
+const char* cpu_level_name(CpuLevel level);
+/* CPU_NUM_LEVELS if name isn't one of them */
+CpuLevel cpu_level_named(const char* name);
+
+#endif
@@ -0,0 +1,120 @@
+#include "envelope.h"
+#include "memory.h"
+
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+
+extern FixedAllocator sampler_allocator;
+void sampler_free(void* obj);
+
+/* while the gate is open */
+static float gate_level(Envelope env, int64_t t) {
+  if(t < env->attack) return (float)t / env->attack;
+  if(t < env->attack + env->decay) {
+    return 1.0f - (1.0f - env->sustain) * (t - env->attack) / env->decay;
+  }
+  return env->sustain;
+}
+
+/* the linear piece of the envelope that t falls in: its level at t,
+   its slope per tick and the tick it ends at */
+static int64_t envelope_segment(Envelope env, int64_t gate, int64_t t,
+                                float* level, float* slope) {
+  int64_t decay_end = env->attack + env->decay;
+
+  if(t < 0) {
+    *level = *slope = 0.0f;
+    return 0;
+  }
+  if(t >= gate + env->release) {
+    *level = *slope = 0.0f;
+    return INT64_MAX;
+  }
+  if(t >= gate) {
+    float from = gate_level(env, gate);
+    *slope = -from / env->release;
+    *level = from + *slope * (t - gate);
+    return gate + env->release;
+  }
+  if(t < env->attack) {
+    *slope = 1.0f / env->attack;
+    *level = t * *slope;
+    return MIN(env->attack, gate);
+  }
+  if(t < decay_end) {
+    *slope = -(1.0f - env->sustain) / env->decay;
+    *level = 1.0f + *slope * (t - env->attack);
+    return MIN(decay_end, gate);
+  }
+  *level = env->sustain;
+  *slope = 0.0f;
+  return gate;
+}
+
+float envelope_level(Envelope env, int64_t gate, int64_t t) {
+  float level, slope;
+  envelope_segment(env, gate, t, &level, &slope);
+  return level;
+}
+
+void envelope_apply(Envelope env, int64_t gate, int64_t t, int n,
+                    float* out) {
+  int ii = 0;
+
+  while(ii < n) {
+    float level, slope, step;
+    int64_t end = envelope_segment(env, gate, t, &level, &slope);
+    int64_t frames = (end - t + NUM_CHANNELS - 1) / NUM_CHANNELS;
+    int run = end == INT64_MAX || frames > n - ii ? n - ii : (int)frames;
+    int jj;
+
+    step = slope * NUM_CHANNELS;
+    for(jj = ii; jj < ii + run; ++jj, level += step) {
+      out[jj] *= level;
+    }
+    ii += run;
+    t += (int64_t)run * NUM_CHANNELS;
+  }
+}
+
+static int16_t envelope_sample(EnvelopeSampler env, int64_t sample) {
+  float value = SAMPLE(env->source, sample)
+    * envelope_level(&env->envelope, DURATION(env->source),
+                     sample - START(env->source));
+  if(value >= INT16_MAX) return INT16_MAX;
+  if(value <= INT16_MIN) return INT16_MIN;
+  return (int16_t)value;
+}
+
+static void envelope_render(EnvelopeSampler env, int64_t start, int n,
+                            float* out) {
+  RENDER(env->source, start, n, out);
+  envelope_apply(&env->envelope, DURATION(env->source),
+                 start - START(env->source), n, out);
+}
+
+static void envelope_release(EnvelopeSampler env) {
+  RELEASE_SAMPLER(env->source);
+  sampler_free(env);
+}
+
+Sampler envelopesampler_make(Sampler source, int64_t attack, int64_t decay,
+                             float sustain, int64_t release) {
+  EnvelopeSampler env = fixed_allocator_try_alloc(sampler_allocator);
+  if(!env) {
+    RELEASE_SAMPLER(source);
+    return sampler_silence();
+  }
+
+  env->sampler.function = (SamplerFunction)envelope_sample;
+  env->sampler.render = (SamplerRender)envelope_render;
+  env->sampler.release = (ReleaseSampler)envelope_release;
+  env->sampler.start_sample = START(source);
+  env->sampler.duration_samples = DURATION(source) + MAX(release, 0);
+  env->source = source;
+  env->envelope.attack = MAX(attack, 0);
+  env->envelope.decay = MAX(decay, 0);
+  env->envelope.sustain = sustain;
+  env->envelope.release = MAX(release, 0);
+
+  return (Sampler)env;
+}
@@ -0,0 +1,40 @@
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include "sampler.h"
+
+/** An ADSR envelope over a voice whose gate lasts a fixed time. The
+ * level rises linearly from 0 to 1 over attack, falls to sustain over
+ * decay and holds there until the gate closes, then falls to 0 over
+ * release. A gate shorter than attack plus decay releases from
+ * wherever it had got to. Times are in ticks of the sample clock.
+ */
+typedef struct Envelope_ {
+  int64_t attack;
+  int64_t decay;
+  float sustain;
+  int64_t release;
+} *Envelope;
+
+/* the level t ticks into a voice whose gate lasts gate */
+float envelope_level(Envelope env, int64_t gate, int64_t t);
+
+/* scale n frames, the first t ticks into the voice, by the envelope.
+   each linear piece is ramped across the frames it covers, so the
+   segment is only worked out when one ends */
+void envelope_apply(Envelope env, int64_t gate, int64_t t, int n,
+                    float* out);
+
+/* source shaped by an envelope whose gate is the source's duration.
+   the voice lasts release longer than the source, which is rendered
+   past its END for the tail */
+typedef struct EnvelopeSampler_ {
+  struct Sampler_ sampler;
+  Sampler source;
+  struct Envelope_ envelope;
+} *EnvelopeSampler;
+
+Sampler envelopesampler_make(Sampler source, int64_t attack, int64_t decay,
+                             float sustain, int64_t release);
+
+#endif
@@ -0,0 +1,306 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "imageconv.h"
+#include "stb_image.h"
+#include "testcase.h"
+
+#define NPIXELS 1027
+
+static uint8_t pixels[NPIXELS * 4];
+
+void fill_random(uint8_t* data, int n) {
+  int ii;
+  for(ii = 0; ii < n; ++ii) {
+    data[ii] = rand() & 0xFF;
+  }
+  // make sure the extremes are covered
+  memset(data, 0, 4);
+  memset(data + 4, 0xFF, 4);
+}
+
+int kernels_match(uint8_t* src, int npixels) {
+  uint16_t simd[NPIXELS], scalar[NPIXELS];
+  uint8_t simd8[NPIXELS * 4], scalar8[NPIXELS * 4];
+  int ok = 1;
+
+  imageconv_rgba_to_565(simd, src, npixels);
+  imageconv_rgba_to_565_scalar(scalar, src, npixels);
+  ok &= memcmp(simd, scalar, npixels * 2) == 0;
+
+  imageconv_rgba_to_4444(simd, src, npixels);
+  imageconv_rgba_to_4444_scalar(scalar, src, npixels);
+  ok &= memcmp(simd, scalar, npixels * 2) == 0;
+
+  imageconv_rgba_to_5551(simd, src, npixels);
+  imageconv_rgba_to_5551_scalar(scalar, src, npixels);
+  ok &= memcmp(simd, scalar, npixels * 2) == 0;
+
+  imageconv_premultiply(simd8, src, npixels);
+  imageconv_premultiply_scalar(scalar8, src, npixels);
+  ok &= memcmp(simd8, scalar8, npixels * 4) == 0;
+
+  return ok;
+}
+
+// exact division by 255 for every (value, alpha) pair, run through the
+// kernels as one buffer so the vector paths do the dividing
+int premultiply_exact(void) {
+  static uint8_t in[256 * 256 * 4], res[256 * 256 * 4];
+  int ii, ok = 1;
+
+  for(ii = 0; ii < 256 * 256; ++ii) {
+    in[ii * 4] = ii & 0xFF;
+    in[ii * 4 + 1] = 255 - (ii & 0xFF);
+    in[ii * 4 + 2] = (ii * 7) & 0xFF;
+    in[ii * 4 + 3] = ii >> 8;
+  }
+  imageconv_premultiply(res, in, 256 * 256);
+
+  for(ii = 0; ii < 256 * 256 * 4; ++ii) {
+    int a = in[(ii & ~3) + 3];
+    int expected = (ii & 3) == 3 ? a : (in[ii] * a + 127) / 255;
+    ok &= res[ii] == expected;
+  }
+  return ok;
+}
+
+// largest per channel difference between the portable and vectorized
+// jpeg decodes of path, or -1 if either fails to load
+int jpeg_simd_delta(char* path, int req_comp) {
+  int w, h, n, w2, h2, ii, delta = 0;
+  uint8_t *scalar, *simd;
+
+  stbi_set_simd(0);
+  scalar = stbi_load(path, &w, &h, &n, req_comp);
+  stbi_set_simd(1);
+  simd = stbi_load(path, &w2, &h2, &n, req_comp);
+
+  if(!scalar || !simd || w != w2 || h != h2) {
+    delta = -1;
+  } else {
+    for(ii = 0; ii < w * h * req_comp; ++ii) {
+      int d = abs(scalar[ii] - simd[ii]);
+      if(d > delta) delta = d;
+    }
+  }
+
+  if(scalar) stbi_image_free(scalar);
+  if(simd) stbi_image_free(simd);
+  return delta;
+}
+
+int png_simd_matches(char* path, int req_comp) {
+  int w, h, n, w2, h2, ok;
+  uint8_t *scalar, *simd;
+
+  stbi_set_simd(0);
+  scalar = stbi_load(path, &w, &h, &n, req_comp);
+  stbi_set_simd(1);
+  simd = stbi_load(path, &w2, &h2, &n, req_comp);
+
+  ok = scalar && simd && w == w2 && h == h2
+    && memcmp(scalar, simd, w * h * (req_comp ? req_comp : n)) == 0;
+
+  if(scalar) stbi_image_free(scalar);
+  if(simd) stbi_image_free(simd);
+  return ok;
+}
+
+// number of pngs under dir that decode differently on the two paths
+int png_mismatches(char* dir) {
+  DIR* d = opendir(dir);
+  struct dirent* ent;
+  char path[512];
+  int bad = 0;
+
+  if(!d) return 0;
+  while((ent = readdir(d))) {
+    if(ent->d_name[0] == '.') continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    if(strstr(ent->d_name, ".png")) {
+      if(!png_simd_matches(path, 0)) {
+        printf("mismatch: %s\n", path);
+        ++bad;
+      }
+    } else {
+      bad += png_mismatches(path);
+    }
+  }
+  closedir(d);
+  return bad;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+  return p + 4;
+}
+
+static uint8_t* put_chunk(uint8_t* p, char* type, uint8_t* data, int len) {
+  p = put32(p, len);
+  memcpy(p, type, 4);
+  memcpy(p + 4, data, len);
+  return put32(p + 4 + len, 0); // crc is not checked
+}
+
+// the shipped assets are all RGBA, so build an RGB png that uses every
+// filter type, stored uncompressed
+int rgb_png_matches(void) {
+  enum { W = 37, H = 10, ROW = W * 3 + 1, RAW = ROW * H };
+  uint8_t hdr[13] = {0, 0, 0, W, 0, 0, 0, H, 8, 2, 0, 0, 0};
+  uint8_t idat[RAW + 7];
+  uint8_t png[RAW + 128];
+  uint8_t *p = png, *scalar, *simd;
+  int ii, w, h, n, ok;
+
+  idat[0] = 0x78; idat[1] = 0x01;
+  idat[2] = 1; // final stored block
+  idat[3] = RAW & 0xFF; idat[4] = RAW >> 8;
+  idat[5] = ~RAW & 0xFF; idat[6] = (~RAW >> 8) & 0xFF;
+  fill_random(idat + 7, RAW);
+  for(ii = 0; ii < H; ++ii) {
+    idat[7 + ii * ROW] = ii % 5;
+  }
+
+  memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+  p = put_chunk(p + 8, "IHDR", hdr, sizeof(hdr));
+  p = put_chunk(p, "IDAT", idat, sizeof(idat));
+  p = put_chunk(p, "IEND", (uint8_t*)"", 0);
+
+  stbi_set_simd(0);
+  scalar = stbi_load_from_memory(png, p - png, &w, &h, &n, 0);
+  stbi_set_simd(1);
+  simd = stbi_load_from_memory(png, p - png, &w, &h, &n, 0);
+  ok = scalar && simd && n == 3 && memcmp(scalar, simd, W * H * 3) == 0;
+
+  if(scalar) stbi_image_free(scalar);
+  if(simd) stbi_image_free(simd);
+  return ok;
+}
+
+// a 3 channel image loaded NATIVE|PREMULTIPLIED is decoded and
+// uploaded as premultiplied RGBA8888, the way image_load_format does it
+int native_premultiplied_is_rgba(char* path) {
+  int format = imageconv_resolve_format(IMAGE_NATIVE | IMAGE_PREMULTIPLIED);
+  int ii, w, h, n, ok;
+  uint8_t *rgb, *rgba;
+
+  rgb = stbi_load(path, &w, &h, &n, 0);
+  rgba = stbi_load(path, &w, &h, &n, 4);
+  ok = rgb && rgba && n == 3
+    && format == (IMAGE_RGBA8888 | IMAGE_PREMULTIPLIED)
+    && imageconv_bytes_per_pixel(format, n) == 4;
+
+  // opaque, so premultiplying keeps the file's colors
+  if(ok) {
+    imageconv_convert(rgba, w * h, format);
+    for(ii = 0; ii < w * h; ++ii) {
+      ok &= memcmp(&rgba[ii * 4], &rgb[ii * 3], 3) == 0 && rgba[ii * 4 + 3] == 0xFF;
+    }
+  }
+
+  if(rgb) stbi_image_free(rgb);
+  if(rgba) stbi_image_free(rgba);
+  return ok;
+}
+
+// decoding into an exactly sized buffer gives the same pixels as
+// stbi_load and writes nothing past the end
+int load_into_matches(char* path, int req_comp) {
+  int w, h, n, w2, h2, n2, size, ok;
+  uint8_t *expected, *buffer;
+
+  if(!stbi_info(path, &w, &h, &n)) return 0;
+  size = w * h * (req_comp ? req_comp : n);
+  buffer = malloc(size + 1);
+  buffer[size] = 0xA5;
+
+  expected = stbi_load(path, &w, &h, &n, req_comp);
+  ok = expected
+    && stbi_load_into(path, buffer, size, &w2, &h2, &n2, req_comp) == buffer
+    && w == w2 && h == h2 && n == n2
+    && memcmp(expected, buffer, size) == 0
+    && buffer[size] == 0xA5
+    && stbi_load_into(path, buffer, size - 1, &w2, &h2, &n2, req_comp) == NULL;
+
+  if(expected) stbi_image_free(expected);
+  free(buffer);
+  return ok;
+}
+
+int main(int argc, char ** argv) {
+  int ii;
+
+  fill_random(pixels, sizeof(pixels));
+  // the kernels of every level this cpu has
+  CpuLevel level = cpu_level();
+  for(ii = 0; ii < CPU_NUM_LEVELS; ++ii) {
+    if(cpu_set_level(ii) != ii) continue;
+    ASSERT(kernels_match(pixels, NPIXELS));
+    ASSERT(kernels_match(pixels, 7));
+    ASSERT(premultiply_exact());
+  }
+  cpu_set_level(level);
+
+  // known values
+  uint8_t px[] = {0xFF, 0x80, 0x08, 0x80};
+  uint16_t out;
+  imageconv_rgba_to_565(&out, px, 1);
+  ASSERT(out == ((0x1F << 11) | (0x20 << 5) | 0x01));
+  imageconv_rgba_to_4444(&out, px, 1);
+  ASSERT(out == 0xF808);
+  imageconv_rgba_to_5551(&out, px, 1);
+  ASSERT(out == ((0x1F << 11) | (0x10 << 6) | (0x01 << 1) | 1));
+
+  imageconv_premultiply(px, px, 1);
+  ASSERT(px[0] == 0x80 && px[1] == 0x40 && px[2] == 0x04 && px[3] == 0x80);
+
+  // in place conversion of a real image agrees with converting a copy
+  int w, h, n;
+  uint8_t* img = stbi_load("test.png", &w, &h, &n, 4);
+  ASSERT(img != NULL);
+  if(img) {
+    uint16_t* copy = malloc(w * h * 2);
+    imageconv_rgba_to_565_scalar(copy, img, w * h);
+    imageconv_convert(img, w * h, IMAGE_RGB565);
+    ASSERT(memcmp(copy, img, w * h * 2) == 0);
+    ASSERT(imageconv_bytes_per_pixel(IMAGE_RGB565 | IMAGE_PREMULTIPLIED, 4) == 2);
+    free(copy);
+    stbi_image_free(img);
+  }
+
+  // the idct and upsampling are exact, color conversion may round
+  // differently by one step
+  ASSERT(jpeg_simd_delta("spacer/night-sky-stars.jpg", 1) == 0);
+  ASSERT(jpeg_simd_delta("spacer/night-sky-stars.jpg", 3) >= 0);
+  ASSERT(jpeg_simd_delta("spacer/night-sky-stars.jpg", 3) <= 1);
+  ASSERT(jpeg_simd_delta("spacer/night-sky-stars.jpg", 4) <= 1);
+
+  // the decoder follows the level everything else uses
+  cpu_set_level(CPU_SCALAR);
+  ASSERT(jpeg_simd_delta("spacer/night-sky-stars.jpg", 3) == 0);
+  cpu_set_level(level);
+
+  // png unfiltering and inflate must match the portable decoder exactly
+  ASSERT(png_simd_matches("test.png", 0));
+  ASSERT(png_simd_matches("test.png", 3));
+  ASSERT(png_mismatches("spacer") == 0);
+  ASSERT(png_mismatches("monster") == 0);
+  ASSERT(rgb_png_matches());
+
+  ASSERT(imageconv_resolve_format(IMAGE_NATIVE) == IMAGE_NATIVE);
+  ASSERT(imageconv_resolve_format(IMAGE_RGB565 | IMAGE_PREMULTIPLIED)
+         == (IMAGE_RGB565 | IMAGE_PREMULTIPLIED));
+  ASSERT(native_premultiplied_is_rgba("spacer/night-sky-stars.jpg"));
+
+  ASSERT(load_into_matches("test.png", 0));
+  ASSERT(load_into_matches("test.png", 4));
+  ASSERT(load_into_matches("test.png", 3));
+  ASSERT(load_into_matches("spacer/night-sky-stars.jpg", 0));
+  ASSERT(load_into_matches("spacer/night-sky-stars.jpg", 4));
+
+  END_MAIN();
+}
@@ -0,0 +1,294 @@
+#include "imageconv.h"
+#include "cpu.h"
+
+#ifdef CPU_X86
+#include <emmintrin.h>
+#endif
+
+#ifdef CPU_BUILD_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * Load time texel conversion. The renderer uploads whatever
+ * ImageResource->data holds, so narrowing to a 16 bit layout here
+ * halves both the upload and the texture memory. All of the kernels
+ * expect RGBA8 input and are written so that dst may alias src: the
+ * output is never wider than the input so each block is fully read
+ * before anything at or past it is written.
+ */
+
+/* exact (x / 255) for x in [0, 255*255], rounded to nearest */
+#define DIV255(x) ((((x) + 128) + (((x) + 128) >> 8)) >> 8)
+
+int imageconv_bytes_per_pixel(int format, int channels) {
+  switch(image_format_layout(format)) {
+  case IMAGE_NATIVE:
+    return channels;
+  case IMAGE_RGBA8888:
+    return 4;
+  case IMAGE_RGB888:
+    return 3;
+  case IMAGE_RGB565:
+  case IMAGE_RGBA4444:
+  case IMAGE_RGBA5551:
+    return 2;
+  }
+  return channels;
+}
+
+int imageconv_resolve_format(int format) {
+  if(image_format_layout(format) == IMAGE_NATIVE
+     && image_format_premultiplied(format)) {
+    return IMAGE_RGBA8888 | IMAGE_PREMULTIPLIED;
+  }
+  return format;
+}
+
+void imageconv_premultiply_scalar(uint8_t* dst, const uint8_t* src, int npixels) {
+  int ii;
+  for(ii = 0; ii < npixels; ++ii) {
+    int a = src[3];
+    dst[0] = DIV255(src[0] * a);
+    dst[1] = DIV255(src[1] * a);
+    dst[2] = DIV255(src[2] * a);
+    dst[3] = a;
+    src += 4;
+    dst += 4;
+  }
+}
+
+void imageconv_rgba_to_565_scalar(uint16_t* dst, const uint8_t* src, int npixels) {
+  int ii;
+  for(ii = 0; ii < npixels; ++ii) {
+    dst[ii] = ((src[0] >> 3) << 11) | ((src[1] >> 2) << 5) | (src[2] >> 3);
+    src += 4;
+  }
+}
+
+void imageconv_rgba_to_4444_scalar(uint16_t* dst, const uint8_t* src, int npixels) {
+  int ii;
+  for(ii = 0; ii < npixels; ++ii) {
+    dst[ii] = ((src[0] >> 4) << 12) | ((src[1] >> 4) << 8)
+      | ((src[2] >> 4) << 4) | (src[3] >> 4);
+    src += 4;
+  }
+}
+
+void imageconv_rgba_to_5551_scalar(uint16_t* dst, const uint8_t* src, int npixels) {
+  int ii;
+  for(ii = 0; ii < npixels; ++ii) {
+    dst[ii] = ((src[0] >> 3) << 11) | ((src[1] >> 3) << 6)
+      | ((src[2] >> 3) << 1) | (src[3] >> 7);
+    src += 4;
+  }
+}
+
+void imageconv_rgba_to_rgb(uint8_t* dst, const uint8_t* src, int npixels) {
+  int ii;
+  for(ii = 0; ii < npixels; ++ii) {
+    uint8_t r = src[0], g = src[1], b = src[2];
+    dst[0] = r;
+    dst[1] = g;
+    dst[2] = b;
+    src += 4;
+    dst += 3;
+  }
+}
+
+typedef struct ImageconvKernels_ {
+  void (*premultiply)(uint8_t* dst, const uint8_t* src, int npixels);
+  void (*to_565)(uint16_t* dst, const uint8_t* src, int npixels);
+  void (*to_4444)(uint16_t* dst, const uint8_t* src, int npixels);
+  void (*to_5551)(uint16_t* dst, const uint8_t* src, int npixels);
+} *ImageconvKernels;
+
+#ifdef CPU_X86
+
+/* each 32 bit lane holds one little endian RGBA pixel. narrow the low
+   16 bits of the lanes of a and b into 8 packed words */
+CPU_TARGET_SSE2
+static inline __m128i pack_low_words(__m128i a, __m128i b) {
+  a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+  b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+  return _mm_packs_epi32(a, b);
+}
+
+CPU_TARGET_SSE2
+static inline __m128i lanes_to_565(__m128i p) {
+  __m128i r = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF8)), 8);
+  __m128i g = _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xFC00)), 5);
+  __m128i b = _mm_and_si128(_mm_srli_epi32(p, 19), _mm_set1_epi32(0x1F));
+  return _mm_or_si128(r, _mm_or_si128(g, b));
+}
+
+CPU_TARGET_SSE2
+static inline __m128i lanes_to_4444(__m128i p) {
+  __m128i r = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF0)), 8);
+  __m128i g = _mm_and_si128(_mm_srli_epi32(p, 4), _mm_set1_epi32(0x0F00));
+  __m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xF0));
+  __m128i a = _mm_srli_epi32(p, 28);
+  return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a));
+}
+
+CPU_TARGET_SSE2
+static inline __m128i lanes_to_5551(__m128i p) {
+  __m128i r = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF8)), 8);
+  __m128i g = _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF800)), 5);
+  __m128i b = _mm_and_si128(_mm_srli_epi32(p, 18), _mm_set1_epi32(0x3E));
+  __m128i a = _mm_srli_epi32(p, 31);
+  return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a));
+}
+
+#define SSE2_PACK_KERNEL(name, lanes)                                   \
+  CPU_TARGET_SSE2                                                       \
+  static void name##_sse2(uint16_t* dst, const uint8_t* src,            \
+                          int npixels) {                                \
+    int ii = 0;                                                         \
+    for(; ii + 8 <= npixels; ii += 8) {                                 \
+      __m128i p0 = _mm_loadu_si128((const __m128i*)&src[ii * 4]);       \
+      __m128i p1 = _mm_loadu_si128((const __m128i*)&src[ii * 4 + 16]);  \
+      _mm_storeu_si128((__m128i*)&dst[ii],                              \
+                       pack_low_words(lanes(p0), lanes(p1)));           \
+    }                                                                   \
+    name##_scalar(&dst[ii], &src[ii * 4], npixels - ii);                \
+  }
+
+SSE2_PACK_KERNEL(imageconv_rgba_to_565, lanes_to_565)
+SSE2_PACK_KERNEL(imageconv_rgba_to_4444, lanes_to_4444)
+SSE2_PACK_KERNEL(imageconv_rgba_to_5551, lanes_to_5551)
+
+CPU_TARGET_SSE2
+static inline __m128i premultiply_words(__m128i c, __m128i alpha_mask) {
+  /* broadcast each pixel's alpha over its four words, then put 255
+     back in the alpha slot so alpha is multiplied by one */
+  __m128i a = _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3));
+  a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+  a = _mm_or_si128(_mm_andnot_si128(alpha_mask, a),
+                   _mm_and_si128(alpha_mask, _mm_set1_epi16(255)));
+
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+CPU_TARGET_SSE2
+static void imageconv_premultiply_sse2(uint8_t* dst, const uint8_t* src,
+                                       int npixels) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  int ii = 0;
+
+  for(; ii + 4 <= npixels; ii += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i*)&src[ii * 4]);
+    __m128i lo = premultiply_words(_mm_unpacklo_epi8(p, zero), alpha_mask);
+    __m128i hi = premultiply_words(_mm_unpackhi_epi8(p, zero), alpha_mask);
+    _mm_storeu_si128((__m128i*)&dst[ii * 4], _mm_packus_epi16(lo, hi));
+  }
+
+  imageconv_premultiply_scalar(&dst[ii * 4], &src[ii * 4], npixels - ii);
+}
+
+#endif
+
+#ifdef CPU_BUILD_NEON
+
+static inline uint16x8_t neon_field(uint8x8_t c, int drop, int shift) {
+  return vshlq_u16(vmovl_u8(vshl_u8(c, vdup_n_s8(-drop))),
+                   vdupq_n_s16(shift));
+}
+
+#define NEON_PACK_KERNEL(name, rb, rs, gb, gs, bb, bs, ab, as)          \
+  static void name##_neon(uint16_t* dst, const uint8_t* src,            \
+                          int npixels) {                                \
+    int ii = 0;                                                         \
+    for(; ii + 8 <= npixels; ii += 8) {                                 \
+      uint8x8x4_t p = vld4_u8(&src[ii * 4]);                            \
+      uint16x8_t out = vorrq_u16(neon_field(p.val[0], rb, rs),          \
+                                 neon_field(p.val[1], gb, gs));         \
+      out = vorrq_u16(out, neon_field(p.val[2], bb, bs));               \
+      if(ab < 8) out = vorrq_u16(out, neon_field(p.val[3], ab, as));    \
+      vst1q_u16(&dst[ii], out);                                         \
+    }                                                                   \
+    name##_scalar(&dst[ii], &src[ii * 4], npixels - ii);                \
+  }
+
+NEON_PACK_KERNEL(imageconv_rgba_to_565,  3, 11, 2, 5, 3, 0, 8, 0)
+NEON_PACK_KERNEL(imageconv_rgba_to_4444, 4, 12, 4, 8, 4, 4, 4, 0)
+NEON_PACK_KERNEL(imageconv_rgba_to_5551, 3, 11, 3, 6, 3, 1, 7, 0)
+
+static inline uint8x8_t neon_div255(uint16x8_t x) {
+  uint16x8_t t = vaddq_u16(x, vdupq_n_u16(128));
+  return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+}
+
+static void imageconv_premultiply_neon(uint8_t* dst, const uint8_t* src,
+                                       int npixels) {
+  int ii = 0;
+  for(; ii + 8 <= npixels; ii += 8) {
+    uint8x8x4_t p = vld4_u8(&src[ii * 4]);
+    p.val[0] = neon_div255(vmull_u8(p.val[0], p.val[3]));
+    p.val[1] = neon_div255(vmull_u8(p.val[1], p.val[3]));
+    p.val[2] = neon_div255(vmull_u8(p.val[2], p.val[3]));
+    vst4_u8(&dst[ii * 4], p);
+  }
+
+  imageconv_premultiply_scalar(&dst[ii * 4], &src[ii * 4], npixels - ii);
+}
+
+#endif
+
+#define IMAGECONV_KERNELS(suffix)                                       \
+  {imageconv_premultiply_##suffix, imageconv_rgba_to_565_##suffix,      \
+   imageconv_rgba_to_4444_##suffix, imageconv_rgba_to_5551_##suffix}
+
+static const struct ImageconvKernels_ kernels[CPU_NUM_LEVELS] = {
+  [CPU_SCALAR] = IMAGECONV_KERNELS(scalar),
+#ifdef CPU_X86
+  [CPU_SSE2] = IMAGECONV_KERNELS(sse2),
+  [CPU_SSE41] = IMAGECONV_KERNELS(sse2),
+  [CPU_AVX2] = IMAGECONV_KERNELS(sse2),
+#endif
+#ifdef CPU_BUILD_NEON
+  [CPU_NEON] = IMAGECONV_KERNELS(neon),
+#endif
+};
+
+void imageconv_premultiply(uint8_t* dst, const uint8_t* src, int npixels) {
+  kernels[cpu_level()].premultiply(dst, src, npixels);
+}
+
+void imageconv_rgba_to_565(uint16_t* dst, const uint8_t* src, int npixels) {
+  kernels[cpu_level()].to_565(dst, src, npixels);
+}
+
+void imageconv_rgba_to_4444(uint16_t* dst, const uint8_t* src, int npixels) {
+  kernels[cpu_level()].to_4444(dst, src, npixels);
+}
+
+void imageconv_rgba_to_5551(uint16_t* dst, const uint8_t* src, int npixels) {
+  kernels[cpu_level()].to_5551(dst, src, npixels);
+}
+
+void imageconv_convert(uint8_t* pixels, int npixels, int format) {
+  if(image_format_premultiplied(format)) {
+    imageconv_premultiply(pixels, pixels, npixels);
+  }
+
+  switch(image_format_layout(format)) {
+  case IMAGE_NATIVE:
+  case IMAGE_RGBA8888:
+    break;
+  case IMAGE_RGB888:
+    imageconv_rgba_to_rgb(pixels, pixels, npixels);
+    break;
+  case IMAGE_RGB565:
+    imageconv_rgba_to_565((uint16_t*)pixels, pixels, npixels);
+    break;
+  case IMAGE_RGBA4444:
+    imageconv_rgba_to_4444((uint16_t*)pixels, pixels, npixels);
+    break;
+  case IMAGE_RGBA5551:
+    imageconv_rgba_to_5551((uint16_t*)pixels, pixels, npixels);
+    break;
+  }
+}
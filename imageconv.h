@@ -0,0 +1,55 @@
+#ifndef IMAGECONV_H
+#define IMAGECONV_H
+
+#include <stdint.h>
+
+/** texel layouts that image_load can hand to the renderer.
+ * IMAGE_NATIVE keeps whatever the decoder produced (8 bits per
+ * channel, 3 or 4 channels). Everything else is converted from RGBA8
+ * on the loading thread before the upload is queued.
+ */
+typedef enum {
+  IMAGE_NATIVE = 0,
+  IMAGE_RGBA8888,
+  IMAGE_RGB888,
+  IMAGE_RGB565,
+  IMAGE_RGBA4444,
+  IMAGE_RGBA5551
+} ImageFormat;
+
+/* or'd into an ImageFormat to multiply color by alpha during the
+   conversion. Textures loaded this way must be drawn with
+   glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA) */
+#define IMAGE_PREMULTIPLIED 0x100
+#define IMAGE_FORMAT_MASK 0xff
+
+#define image_format_layout(f) ((ImageFormat)((f) & IMAGE_FORMAT_MASK))
+#define image_format_premultiplied(f) (((f) & IMAGE_PREMULTIPLIED) != 0)
+
+/* the format an image asked for as format is actually loaded in.
+   premultiplying needs the alpha channel, so IMAGE_NATIVE premultiplied
+   becomes IMAGE_RGBA8888 premultiplied. anything else is unchanged */
+int imageconv_resolve_format(int format);
+
+/* bytes per texel of the converted image. channels is only consulted
+   for IMAGE_NATIVE */
+int imageconv_bytes_per_pixel(int format, int channels);
+
+/* convert npixels of RGBA8 data to format. The conversion happens in
+   place; the result is packed at the front of pixels. */
+void imageconv_convert(uint8_t* pixels, int npixels, int format);
+
+/* kernels. dst may alias src. */
+void imageconv_premultiply(uint8_t* dst, const uint8_t* src, int npixels);
+void imageconv_rgba_to_rgb(uint8_t* dst, const uint8_t* src, int npixels);
+void imageconv_rgba_to_565(uint16_t* dst, const uint8_t* src, int npixels);
+void imageconv_rgba_to_4444(uint16_t* dst, const uint8_t* src, int npixels);
+void imageconv_rgba_to_5551(uint16_t* dst, const uint8_t* src, int npixels);
+
+/* portable reference versions of the vectorized kernels */
+void imageconv_premultiply_scalar(uint8_t* dst, const uint8_t* src, int npixels);
+void imageconv_rgba_to_565_scalar(uint16_t* dst, const uint8_t* src, int npixels);
+void imageconv_rgba_to_4444_scalar(uint16_t* dst, const uint8_t* src, int npixels);
+void imageconv_rgba_to_5551_scalar(uint16_t* dst, const uint8_t* src, int npixels);
+
+#endif
@@ -25,6 +25,11 @@ c-declare-end
 
 (define ->flonum exact->inexact)
 
+;; sample clock values are 64 bit, past what a fixnum holds on 32 bit
+;; platforms
+(define (->sample x)
+  (inexact->exact (truncate x)))
+
 (define image-load-internal
   (c-lambda (nonnull-char-string)
             ImageResource
@@ -45,6 +50,27 @@ c-declare-end
             void
             "images_free"))
 
+;; texel formats for image-default-format-set!. or in
+;; +image-premultiplied+ to premultiply alpha at load
+(define +image-native+ ((c-lambda () int "___result = IMAGE_NATIVE;")))
+(define +image-rgba8888+ ((c-lambda () int "___result = IMAGE_RGBA8888;")))
+(define +image-rgb888+ ((c-lambda () int "___result = IMAGE_RGB888;")))
+(define +image-rgb565+ ((c-lambda () int "___result = IMAGE_RGB565;")))
+(define +image-rgba4444+ ((c-lambda () int "___result = IMAGE_RGBA4444;")))
+(define +image-rgba5551+ ((c-lambda () int "___result = IMAGE_RGBA5551;")))
+(define +image-premultiplied+
+  ((c-lambda () int "___result = IMAGE_PREMULTIPLIED;")))
+
+(define image-default-format-set!
+  (c-lambda (int)
+            void
+            "image_default_format_set"))
+
+(define image-load-format-internal
+  (c-lambda (nonnull-char-string int)
+            ImageResource
+            "image_load_format"))
+
 (define clock-free
   (c-lambda (Clock)
             void
@@ -224,45 +250,371 @@ ___arg1->v1 = ___arg5;"))
 (c-define-type Sampler (pointer (struct "Sampler_")))
 
 (define %sinsampler-make
-  (c-lambda (long long float float float)
+  (c-lambda (int64 int64 float float float)
             Sampler
             "sinsampler_make"))
 
 (define (sinsampler-make start duration freq amp phase)
-  (%sinsampler-make (->fixnum start)
-                    (->fixnum duration)
+  (%sinsampler-make (->sample start)
+                    (->sample duration)
                     (->flonum freq)
                     (->flonum amp)
                     (->flonum phase)))
 
 (define %sawsampler-make
-  (c-lambda (long long float float float)
+  (c-lambda (int64 int64 float float float)
             Sampler
             "sawsampler_make"))
 
 (define (sawsampler-make start duration freq amp phase)
-  (%sawsampler-make (->fixnum start)
-                    (->fixnum duration)
+  (%sawsampler-make (->sample start)
+                    (->sample duration)
                     (->flonum freq)
                     (->flonum amp)
                     (->flonum phase)))
 
+(define %squaresampler-make
+  (c-lambda (int64 int64 float float float)
+            Sampler
+            "squaresampler_make"))
+
+(define (squaresampler-make start duration freq amp phase)
+  (%squaresampler-make (->sample start)
+                       (->sample duration)
+                       (->flonum freq)
+                       (->flonum amp)
+                       (->flonum phase)))
+
+(define %trianglesampler-make
+  (c-lambda (int64 int64 float float float)
+            Sampler
+            "trianglesampler_make"))
+
+(define (trianglesampler-make start duration freq amp phase)
+  (%trianglesampler-make (->sample start)
+                         (->sample duration)
+                         (->flonum freq)
+                         (->flonum amp)
+                         (->flonum phase)))
+
+;;; recorded sound, see pcm.h
+(c-define-type PcmBuffer (pointer (struct "PcmBuffer_")))
+
+;; #f if the file isn't 16 bit or float PCM
+(define pcmbuffer-open-wav
+  (c-lambda (nonnull-char-string)
+            PcmBuffer
+            "pcmbuffer_open_wav"))
+
+;; voices hold their own reference, so this is safe while they play
+(define pcmbuffer-release!
+  (c-lambda (PcmBuffer)
+            void
+            "pcmbuffer_release"))
+
+(define pcmbuffer-frames
+  (c-lambda (PcmBuffer) long "___result = ___arg1->nframes;"))
+
+(define %pcmsampler-make
+  (c-lambda (PcmBuffer int64 int64 float long bool)
+            Sampler
+            "pcmsampler_make"))
+
+;; a duration of 0 plays to the end of the buffer
+(define (pcmsampler-make buffer start duration gain #!key (offset 0) (loop #f))
+  (%pcmsampler-make buffer
+                    (->sample start)
+                    (->sample duration)
+                    (->flonum gain)
+                    offset
+                    loop))
+
+;;; synthesized effects rendered once, see sfxcache.h
+(c-define-type SfxCache (pointer (struct "SfxCache_")))
+
+(define sfxcache-make
+  (c-lambda (int unsigned-long)
+            SfxCache
+            "sfxcache_make"))
+
+(define %sfxcache-find
+  (c-lambda (SfxCache nonnull-char-string)
+            PcmBuffer
+            "sfxcache_find"))
+
+(define %sfxcache-stage!
+  (c-lambda (SfxCache Sampler)
+            void
+            "sfxcache_stage"))
+
+(define %sfxcache-commit!
+  (c-lambda (SfxCache nonnull-char-string)
+            PcmBuffer
+            "sfxcache_commit"))
+
+(define sfxcache-hits
+  (c-lambda (SfxCache) long "___result = ___arg1->hits;"))
+
+(define sfxcache-misses
+  (c-lambda (SfxCache) long "___result = ___arg1->misses;"))
+
+;; 64 effects or 4MB of audio, whichever comes first
+(define *sfx-cache* (sfxcache-make 64 (* 4 1024 1024)))
+
+;; the buffer for key, which can be anything that prints the same way
+;; each time. on a miss (make-samplers start) is called with start 0
+;; and the samplers it returns are rendered into the cache
+(define (sfx-cached key make-samplers)
+  (let ((name (object->string key)))
+    (or (%sfxcache-find *sfx-cache* name)
+        (begin
+          (for-each (lambda (sampler) (%sfxcache-stage! *sfx-cache* sampler))
+                    (make-samplers 0))
+          (%sfxcache-commit! *sfx-cache* name)))))
+
+;; type is one of the *biquad-...* constants. cutoff in hz, q per
+;; section, each section steepens the slope by 12 dB/octave
+(define *biquad-lowpass* ((c-lambda () int "___result = BIQUAD_LOWPASS;")))
+(define *biquad-highpass* ((c-lambda () int "___result = BIQUAD_HIGHPASS;")))
+(define *biquad-bandpass* ((c-lambda () int "___result = BIQUAD_BANDPASS;")))
+
+(define %filtersampler-make
+  (c-lambda (Sampler int float float int)
+            Sampler
+            "filtersampler_make"))
+
+(define (filtersampler-make source type cutoff q sections)
+  (%filtersampler-make source type (->flonum cutoff) (->flonum q) sections))
+
+(define %envelopesampler-make
+  (c-lambda (Sampler int64 int64 float int64)
+            Sampler
+            "envelopesampler_make"))
+
+;; times in samples like durations, sustain as a fraction of the peak.
+;; the voice lasts release past the end of source
+(define (envelopesampler-make source attack decay sustain release)
+  (%envelopesampler-make source
+                         (->sample attack)
+                         (->sample decay)
+                         (->flonum sustain)
+                         (->sample release)))
+
+(define %audio-set-bus-filter!
+  (c-lambda (int float float int)
+            void
+            "audio_set_bus_filter"))
+
+;; filter the whole mix. 0 sections turns it off
+(define (audio-set-bus-filter! type cutoff q sections)
+  (%audio-set-bus-filter! type (->flonum cutoff) (->flonum q) sections))
+
 (define *sample-freq* ((c-lambda () long "___result = SAMPLE_FREQ;")))
 (define *num-channels* 2)
 
+;; what the device plays at. the mix is converted to it if it's not
+;; *sample-freq*
+(define audio-device-rate
+  (c-lambda () int "audio_device_rate"))
+
 (define (seconds->samples seconds)
   (* *num-channels* *sample-freq* seconds))
 
 (define audio-current-sample
   (c-lambda ()
-            long
+            int64
             "audio_current_sample"))
 
+;; start here for a sound that should play as soon as possible
+(define audio-schedule-sample
+  (c-lambda ()
+            int64
+            "audio_schedule_sample"))
+
 (define audio-enqueue
   (c-lambda (Sampler)
             void
             "audio_enqueue"))
 
+;; to a bus of the audio graph instead of the master
+(define audio-enqueue-bus
+  (c-lambda (Sampler int)
+            void
+            "audio_enqueue_bus"))
+
+;;; audio graph, see audiograph.h. build one, hand it over with
+;;; audio-set-graph! and after that only change gains
+(c-define-type AudioGraph (pointer (struct "AudioGraph_")))
+
+(define audio-graph-make
+  (c-lambda () AudioGraph "audiograph_make"))
+
+;; the new bus, or -1. bus 0 is the master
+(define audio-graph-add-bus!
+  (c-lambda (AudioGraph int) int "audiograph_add_bus"))
+
+(define %audio-graph-add-biquad!
+  (c-lambda (AudioGraph int int float float int) int "audiograph_add_biquad"))
+
+(define (audio-graph-add-biquad! graph bus type cutoff q sections)
+  (%audio-graph-add-biquad! graph bus type (->flonum cutoff) (->flonum q)
+                            sections))
+
+(define %audio-graph-add-delay!
+  (c-lambda (AudioGraph int int64 float float) int "audiograph_add_delay"))
+
+;; delay in seconds
+(define (audio-graph-add-delay! graph bus delay feedback wet)
+  (%audio-graph-add-delay! graph bus (->sample (seconds->samples delay))
+                           (->flonum feedback) (->flonum wet)))
+
+(define %audio-graph-set-gain!
+  (c-lambda (AudioGraph int float) void "audiograph_set_gain"))
+
+(define (audio-graph-set-gain! graph bus gain)
+  (%audio-graph-set-gain! graph bus (->flonum gain)))
+
+(define audio-set-graph!
+  (c-lambda (AudioGraph) void "audio_set_graph"))
+
+;; music and effects each get a bus so their volumes can be set apart
+(define *audio-graph* (audio-graph-make))
+(define *music-bus* (audio-graph-add-bus! *audio-graph* 0))
+(define *sfx-bus* (audio-graph-add-bus! *audio-graph* 0))
+(audio-set-graph! *audio-graph*)
+
+;; which voice makes room once too many are playing
+(define *audio-steal-quietest*
+  ((c-lambda () int "___result = AUDIO_STEAL_QUIETEST;")))
+(define *audio-steal-oldest*
+  ((c-lambda () int "___result = AUDIO_STEAL_OLDEST;")))
+
+(define audio-set-steal-policy!
+  (c-lambda (int) void "audio_set_steal_policy"))
+
+;;; sequencer, see sequencer.h
+(c-define-type Sequencer (pointer (struct "Sequencer_")))
+
+(define *osc-sine* ((c-lambda () int "___result = OSC_SINE;")))
+(define *osc-saw* ((c-lambda () int "___result = OSC_SAW;")))
+(define *osc-square* ((c-lambda () int "___result = OSC_SQUARE;")))
+(define *osc-triangle* ((c-lambda () int "___result = OSC_TRIANGLE;")))
+
+(define %sequencer-make
+  (c-lambda (int64) Sequencer "sequencer_make"))
+
+;; lookahead in seconds
+(define (sequencer-make lookahead)
+  (%sequencer-make (->sample (seconds->samples lookahead))))
+
+(define %sequencer-play!
+  (c-lambda (Sequencer scheme-object int int64 int64)
+            void
+            "sequencer_play(___arg1, (double*)___BODY(___arg2), ___arg3, ___arg4, ___arg5);"))
+
+;; notes are (start duration freq amp waveform), start and duration in
+;; seconds from the start of the song. the whole song crosses over in
+;; one call. it loops every loop seconds, or plays once if that's #f
+(define (sequencer-play! seq notes #!key (start (audio-schedule-sample)) (loop #f))
+  (let ((v (make-f64vector (* 5 (length notes)))))
+    (let fill ((notes notes) (ii 0))
+      (if (pair? notes)
+          (let ((note (car notes)))
+            (f64vector-set! v ii (exact->inexact (seconds->samples (car note))))
+            (f64vector-set! v (+ ii 1) (exact->inexact (seconds->samples (cadr note))))
+            (f64vector-set! v (+ ii 2) (exact->inexact (caddr note)))
+            (f64vector-set! v (+ ii 3) (exact->inexact (cadddr note)))
+            (f64vector-set! v (+ ii 4) (exact->inexact (car (cddddr note))))
+            (fill (cdr notes) (+ ii 5)))))
+    (%sequencer-play! seq v (length notes) (->sample start)
+                      (if loop (->sample (seconds->samples loop)) 0))))
+
+(define sequencer-stop!
+  (c-lambda (Sequencer) void "sequencer_stop"))
+
+;; plays the game's music
+(define *music-sequencer* (sequencer-make 0.5))
+
+(define sequencer-set-bus!
+  (c-lambda (Sequencer int) void "sequencer_set_bus"))
+
+(sequencer-set-bus! *music-sequencer* *music-bus*)
+
+(define sequencer-playing?
+  (c-lambda (Sequencer) bool "sequencer_playing"))
+
+;;; audio stats, see AudioStats in audio.h
+(define audio-stats-reset!
+  (c-lambda ()
+            void
+            "audio_stats_reset"))
+
+(define audio-underruns
+  (c-lambda () long "___result = audio_stats()->underruns;"))
+
+(define audio-callbacks
+  (c-lambda () long "___result = audio_stats()->callbacks;"))
+
+(define audio-voices
+  (c-lambda () int "___result = audio_stats()->voices;"))
+
+(define audio-max-voices
+  (c-lambda () int "___result = audio_stats()->max_voices;"))
+
+(define audio-voices-stolen
+  (c-lambda () long "___result = audio_stats()->voices_stolen;"))
+
+(define audio-voices-dropped
+  (c-lambda () long "___result = audio_stats()->voices_dropped;"))
+
+(define audio-fill-us-max
+  (c-lambda () double "___result = audio_stats()->fill_us_max;"))
+
+(define audio-latency-us-max
+  (c-lambda () double "___result = audio_stats()->latency_us_max;"))
+
+(define audio-fill-us-mean
+  (c-lambda () double
+            "___result = audio_stats()->fill_us_total / (audio_stats()->fills ? audio_stats()->fills : 1);"))
+
+(define audio-latency-us-mean
+  (c-lambda () double
+            "___result = audio_stats()->latency_us_total / (audio_stats()->latencies ? audio_stats()->latencies : 1);"))
+
+(define %audio-fill-level
+  (c-lambda (int) long "___result = audio_stats()->fill_level[___arg1];"))
+
+(define %audio-fill-us
+  (c-lambda (int) long "___result = audio_stats()->fill_us[___arg1];"))
+
+(define %audio-latency-us
+  (c-lambda (int) long "___result = audio_stats()->latency_us[___arg1];"))
+
+(define (audio-histogram getter buckets)
+  (let ((v (make-vector buckets)))
+    (let loop ((ii 0))
+      (if (< ii buckets)
+          (begin
+            (vector-set! v ii (getter ii))
+            (loop (+ ii 1)))
+          v))))
+
+(define *audio-fill-buckets*
+  ((c-lambda () int "___result = AUDIO_FILL_BUCKETS;")))
+(define *audio-time-buckets*
+  ((c-lambda () int "___result = AUDIO_TIME_BUCKETS;")))
+
+;; ring fill at each callback in eighths of capacity
+(define (audio-fill-levels)
+  (audio-histogram %audio-fill-level *audio-fill-buckets*))
+
+;; bucket b counts [2^b, 2^(b+1)) microseconds
+(define (audio-fill-times)
+  (audio-histogram %audio-fill-us *audio-time-buckets*))
+
+(define (audio-latencies)
+  (audio-histogram %audio-latency-us *audio-time-buckets*))
+
 ;;; game lifecycle
 (define *game-clock* #f)
 
@@ -303,11 +655,13 @@ ___arg1->v1 = ___arg5;"))
 ;;; resource lifecycle
 (define *resources* (make-table))
 
-(define (image-load path)
+(define (image-load path #!optional (format #f))
   (let ((resource (table-ref *resources* path #f)))
     (if resource resource
         (begin
-          (let ((new-resource (image-load-internal path)))
+          (let ((new-resource (if format
+                                  (image-load-format-internal path format)
+                                  (image-load-internal path))))
             (table-set! *resources* path new-resource)
             new-resource)))))
 
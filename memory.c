@@ -1,9 +1,16 @@
+#define _GNU_SOURCE /* mmap flags and syscall under -std=c99 */
 #include "memory.h"
 
 #include <stdarg.h>
 #include <stdio.h>
 #include <memory.h>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #define SAFETY(x) x
 #define OFFSET(idx, obj_size, ptr) ((void*)(((char*)ptr) + (idx * obj_size)))
 #define NEXT_ALIGNED_SIZE(x) ((x + 8 - 1) & ~(8 - 1))
@@ -60,18 +67,26 @@ FixedAllocator fixed_allocator_make(size_t obj_size, unsigned int n,
 }
 
 void* fixed_allocator_alloc(FixedAllocator allocator) {
-  SAFETY(if(!allocator->first_free) return fail_exit("fixed_allocator %s failed", allocator->name));
+  void* mem = fixed_allocator_try_alloc(allocator);
+  SAFETY(if(!mem) return fail_exit("fixed_allocator %s failed", allocator->name));
+  return mem;
+}
 
+/* like fixed_allocator_alloc but returns NULL instead of failing when
+   every object is taken */
+void* fixed_allocator_try_alloc(FixedAllocator allocator) {
   pthread_mutex_lock(&allocator->mutex);
   void * mem = allocator->first_free;
-  allocator->first_free = *(void**)allocator->first_free;
+  if(mem) {
+    allocator->first_free = *(void**)mem;
 
 #ifdef DEBUG_MEMORY
-  allocator->inflight += 1;
-  if(allocator->inflight > allocator->max_inflight) {
-    allocator->max_inflight = allocator->inflight;
-  }
+    allocator->inflight += 1;
+    if(allocator->inflight > allocator->max_inflight) {
+      allocator->max_inflight = allocator->inflight;
+    }
 #endif
+  }
   pthread_mutex_unlock(&allocator->mutex);
 
   return mem;
@@ -104,11 +119,21 @@ StackAllocator stack_allocator_make(size_t stack_size, const char* name) {
 }
 
 void* stack_allocator_alloc(StackAllocator allocator, size_t size) {
+  void* mem = stack_allocator_try_alloc(allocator, size);
+  SAFETY(if(!mem) return fail_exit("stack_allocator %s failed", allocator->name));
+  return mem;
+}
+
+/* like stack_allocator_alloc but returns NULL instead of failing when
+   the stack is full, for callers that have somewhere else to go */
+void* stack_allocator_try_alloc(StackAllocator allocator, size_t size) {
+  void* mem = NULL;
   pthread_mutex_lock(&allocator->mutex);
   size = NEXT_ALIGNED_SIZE(size);
-  SAFETY(if((char*)allocator->stack_top + size > (char*)allocator->stack_max) return fail_exit("stack_allocator %s failed", allocator->name));
-  void* mem = allocator->stack_top;
-  allocator->stack_top = (char*)allocator->stack_top + size;
+  if((char*)allocator->stack_top + size <= (char*)allocator->stack_max) {
+    mem = allocator->stack_top;
+    allocator->stack_top = (char*)allocator->stack_top + size;
+  }
   pthread_mutex_unlock(&allocator->mutex);
 
   return mem;
@@ -272,3 +297,172 @@ int circularbuffer_read(CircularBuffer buffer, char * target, int length) {
 
   return length == 0;
 }
+
+SPSCBuffer spscbuffer_make(size_t bytes) {
+  SPSCBuffer buffer = malloc(sizeof(struct SPSCBuffer_));
+  buffer->read_index = 0;
+  buffer->write_index = 0;
+  buffer->size = bytes;
+  buffer->mirrored = 0;
+  buffer->data = malloc(bytes);
+  return buffer;
+}
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+
+/* map an anonymous memory file twice into one reserved range. returns
+   NULL if any step fails */
+static char* mirrored_map(size_t size) {
+  char* base;
+  int fd = syscall(SYS_memfd_create, "spscbuffer", 0);
+  if(fd < 0) return NULL;
+
+  if(ftruncate(fd, size) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(base == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  if(mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+          fd, 0) == MAP_FAILED ||
+     mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+          fd, 0) == MAP_FAILED) {
+    munmap(base, 2 * size);
+    close(fd);
+    return NULL;
+  }
+
+  /* the mappings keep the file alive */
+  close(fd);
+  return base;
+}
+
+SPSCBuffer spscbuffer_make_mirrored(size_t bytes) {
+  long page = sysconf(_SC_PAGESIZE);
+  size_t size = (bytes + page - 1) / page * page;
+  char* data = mirrored_map(size);
+  if(!data) return spscbuffer_make(bytes);
+
+  SPSCBuffer buffer = malloc(sizeof(struct SPSCBuffer_));
+  buffer->read_index = 0;
+  buffer->write_index = 0;
+  buffer->size = size;
+  buffer->mirrored = 1;
+  buffer->data = data;
+  return buffer;
+}
+
+#else
+
+SPSCBuffer spscbuffer_make_mirrored(size_t bytes) {
+  return spscbuffer_make(bytes);
+}
+
+#endif
+
+void spscbuffer_free(SPSCBuffer buffer) {
+#ifdef __linux__
+  if(buffer->mirrored) {
+    munmap(buffer->data, 2 * buffer->size);
+    free(buffer);
+    return;
+  }
+#endif
+  free(buffer->data);
+  free(buffer);
+}
+
+/* an index's own side can read it plainly, the other side must load
+   it with acquire so the bytes behind it are visible too */
+#define LOAD_ACQUIRE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+static int spscbuffer_used(SPSCBuffer buffer, int read, int write) {
+  int used = write - read;
+  return used < 0 ? used + 2 * buffer->size : used;
+}
+
+static int spscbuffer_advance(SPSCBuffer buffer, int index, int bytes) {
+  index += bytes;
+  return index >= 2 * buffer->size ? index - 2 * buffer->size : index;
+}
+
+/* spans of length bytes starting at index */
+static void spscbuffer_spans(SPSCBuffer buffer, int index, int bytes,
+                             char ** buffer1, int * size1,
+                             char ** buffer2, int * size2) {
+  int offset = index >= buffer->size ? index - buffer->size : index;
+  *buffer1 = &buffer->data[offset];
+  /* past the end of a mirrored buffer is its start again */
+  *size1 = buffer->mirrored ? bytes : MIN(bytes, buffer->size - offset);
+  *buffer2 = buffer->data;
+  *size2 = bytes - *size1;
+}
+
+int spscbuffer_bytes_readable(SPSCBuffer buffer) {
+  return spscbuffer_used(buffer, LOAD_ACQUIRE(buffer->read_index),
+                         LOAD_ACQUIRE(buffer->write_index));
+}
+
+int spscbuffer_bytes_writable(SPSCBuffer buffer) {
+  return buffer->size - spscbuffer_bytes_readable(buffer);
+}
+
+void spscbuffer_read_buffers(SPSCBuffer buffer,
+                             char ** buffer1, int * size1,
+                             char ** buffer2, int * size2,
+                             int bytes_to_read) {
+  int read = buffer->read_index;
+  int available = spscbuffer_used(buffer, read,
+                                  LOAD_ACQUIRE(buffer->write_index));
+  spscbuffer_spans(buffer, read, MIN(bytes_to_read, available),
+                   buffer1, size1, buffer2, size2);
+}
+
+void spscbuffer_read_commit(SPSCBuffer buffer, int bytes) {
+  STORE_RELEASE(buffer->read_index,
+                spscbuffer_advance(buffer, buffer->read_index, bytes));
+}
+
+void spscbuffer_write_buffers(SPSCBuffer buffer,
+                              char ** buffer1, int * size1,
+                              char ** buffer2, int * size2,
+                              int bytes_to_write) {
+  int write = buffer->write_index;
+  int available = buffer->size -
+    spscbuffer_used(buffer, LOAD_ACQUIRE(buffer->read_index), write);
+  spscbuffer_spans(buffer, write, MIN(bytes_to_write, available),
+                   buffer1, size1, buffer2, size2);
+}
+
+void spscbuffer_write_commit(SPSCBuffer buffer, int bytes) {
+  STORE_RELEASE(buffer->write_index,
+                spscbuffer_advance(buffer, buffer->write_index, bytes));
+}
+
+int spscbuffer_insert(SPSCBuffer buffer, const char * bytes, int length) {
+  int s1, s2;
+  char *b1, *b2;
+  spscbuffer_write_buffers(buffer, &b1, &s1, &b2, &s2, length);
+
+  memcpy(b1, bytes, s1);
+  memcpy(b2, &bytes[s1], s2);
+  spscbuffer_write_commit(buffer, s1 + s2);
+  return s1 + s2;
+}
+
+int spscbuffer_read(SPSCBuffer buffer, char * target, int length) {
+  int s1, s2;
+  char *b1, *b2;
+  spscbuffer_read_buffers(buffer, &b1, &s1, &b2, &s2, length);
+
+  memcpy(target, b1, s1);
+  memcpy(&target[s1], b2, s2);
+  spscbuffer_read_commit(buffer, s1 + s2);
+  return s1 + s2;
+}
@@ -32,11 +32,13 @@ typedef struct StackAllocator_ {
 FixedAllocator fixed_allocator_make(size_t obj_size, unsigned int n,
                                     const char* name);
 void* fixed_allocator_alloc(FixedAllocator allocator);
+void* fixed_allocator_try_alloc(FixedAllocator allocator);
 void fixed_allocator_free(FixedAllocator allocator, void *obj);
 
 StackAllocator stack_allocator_make(size_t stack_size,
                                     const char* name);
 void* stack_allocator_alloc(StackAllocator allocator, size_t size);
+void* stack_allocator_try_alloc(StackAllocator allocator, size_t size);
 void stack_allocator_freeall(StackAllocator allocator);
 
 typedef struct CircularBuffer_ {
@@ -66,4 +68,50 @@ int circularbuffer_insert(CircularBuffer buffer, char * bytes, int length);
 
 int circularbuffer_read(CircularBuffer buffer, char * target, int length);
 
+/** A CircularBuffer for exactly one producer thread and one consumer
+ * thread that takes no locks. Each side owns one index and only reads
+ * the other's, with acquire/release ordering. Unlike CircularBuffer,
+ * read_buffers and write_buffers don't move the index: the caller
+ * copies through the spans and then commits what it used, so the other
+ * side never sees bytes that aren't there yet. Indices run over [0,
+ * 2 * size) so that full and empty are told apart without a flag.
+ *
+ * A mirrored buffer maps the same pages twice, back to back, so every
+ * span is contiguous and the second one always comes back empty. That
+ * needs the size rounded up to whole pages and is only available on
+ * linux, elsewhere (or if the mapping fails) it falls back to a plain
+ * buffer of the requested size.
+ */
+typedef struct SPSCBuffer_ {
+  int read_index; /* written only by the consumer */
+  int write_index; /* written only by the producer */
+  int size;
+  int mirrored;
+  char* data;
+} *SPSCBuffer;
+
+SPSCBuffer spscbuffer_make(size_t bytes);
+SPSCBuffer spscbuffer_make_mirrored(size_t bytes);
+void spscbuffer_free(SPSCBuffer buffer);
+int spscbuffer_bytes_writable(SPSCBuffer buffer);
+int spscbuffer_bytes_readable(SPSCBuffer buffer);
+
+/* consumer side. the spans cover at most bytes_to_read bytes */
+void spscbuffer_read_buffers(SPSCBuffer buffer,
+                             char ** buffer1, int * size1,
+                             char ** buffer2, int * size2,
+                             int bytes_to_read);
+void spscbuffer_read_commit(SPSCBuffer buffer, int bytes);
+
+/* producer side. the spans cover at most bytes_to_write bytes */
+void spscbuffer_write_buffers(SPSCBuffer buffer,
+                              char ** buffer1, int * size1,
+                              char ** buffer2, int * size2,
+                              int bytes_to_write);
+void spscbuffer_write_commit(SPSCBuffer buffer, int bytes);
+
+/* copy in or out and commit. both return the number of bytes moved */
+int spscbuffer_insert(SPSCBuffer buffer, const char * bytes, int length);
+int spscbuffer_read(SPSCBuffer buffer, char * target, int length);
+
 #endif
@@ -0,0 +1,141 @@
+#include "mixer.h"
+#include "cpu.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#ifdef CPU_BUILD_NEON
+#include <arm_neon.h>
+#endif
+
+typedef struct MixerKernels_ {
+  void (*accumulate)(float* bus, const float* voice, int n);
+  void (*output_stereo)(int16_t* out, const float* bus, int nframes);
+} *MixerKernels;
+
+void mixer_accumulate_scalar(float* bus, const float* voice, int n) {
+  int ii;
+  for(ii = 0; ii < n; ++ii) {
+    float value = bus[ii];
+    bus[ii] = value + voice[ii] - (value * voice[ii]);
+  }
+}
+
+void mixer_output_stereo_scalar(int16_t* out, const float* bus, int nframes) {
+  int ii;
+  for(ii = 0; ii < nframes; ++ii) {
+    float scaled = bus[ii] * INT16_MAX;
+    int16_t value;
+    if(scaled >= INT16_MAX) {
+      value = INT16_MAX;
+    } else if(scaled <= INT16_MIN) {
+      value = INT16_MIN;
+    } else {
+      value = (int16_t)scaled;
+    }
+    out[ii * 2] = value;
+    out[ii * 2 + 1] = value;
+  }
+}
+
+#ifdef CPU_X86
+
+CPU_TARGET_SSE2
+static void accumulate_sse2(float* bus, const float* voice, int n) {
+  int ii = 0;
+  for(; ii + 8 <= n; ii += 8) {
+    __m128 b0 = _mm_loadu_ps(&bus[ii]), b1 = _mm_loadu_ps(&bus[ii + 4]);
+    __m128 v0 = _mm_loadu_ps(&voice[ii]), v1 = _mm_loadu_ps(&voice[ii + 4]);
+    _mm_storeu_ps(&bus[ii], _mm_sub_ps(_mm_add_ps(b0, v0), _mm_mul_ps(b0, v0)));
+    _mm_storeu_ps(&bus[ii + 4], _mm_sub_ps(_mm_add_ps(b1, v1), _mm_mul_ps(b1, v1)));
+  }
+  mixer_accumulate_scalar(&bus[ii], &voice[ii], n - ii);
+}
+
+CPU_TARGET_SSE2
+static void output_stereo_sse2(int16_t* out, const float* bus, int nframes) {
+  const __m128 hi = _mm_set1_ps(INT16_MAX);
+  const __m128 lo = _mm_set1_ps(INT16_MIN);
+  int ii = 0;
+  for(; ii + 8 <= nframes; ii += 8) {
+    /* cvtt truncates like the scalar cast. out of range floats would
+       convert to 0x80000000, so clamp before converting */
+    __m128 f0 = _mm_mul_ps(_mm_loadu_ps(&bus[ii]), hi);
+    __m128 f1 = _mm_mul_ps(_mm_loadu_ps(&bus[ii + 4]), hi);
+    f0 = _mm_max_ps(_mm_min_ps(f0, hi), lo);
+    f1 = _mm_max_ps(_mm_min_ps(f1, hi), lo);
+
+    __m128i mono = _mm_packs_epi32(_mm_cvttps_epi32(f0), _mm_cvttps_epi32(f1));
+    _mm_storeu_si128((__m128i*)&out[ii * 2], _mm_unpacklo_epi16(mono, mono));
+    _mm_storeu_si128((__m128i*)&out[ii * 2 + 8], _mm_unpackhi_epi16(mono, mono));
+  }
+  mixer_output_stereo_scalar(&out[ii * 2], &bus[ii], nframes - ii);
+}
+
+/* the same lanes as sse2 twice as wide, so the results are identical */
+CPU_TARGET_AVX2
+static void accumulate_avx2(float* bus, const float* voice, int n) {
+  int ii = 0;
+  for(; ii + 16 <= n; ii += 16) {
+    __m256 b0 = _mm256_loadu_ps(&bus[ii]), b1 = _mm256_loadu_ps(&bus[ii + 8]);
+    __m256 v0 = _mm256_loadu_ps(&voice[ii]), v1 = _mm256_loadu_ps(&voice[ii + 8]);
+    _mm256_storeu_ps(&bus[ii], _mm256_sub_ps(_mm256_add_ps(b0, v0),
+                                             _mm256_mul_ps(b0, v0)));
+    _mm256_storeu_ps(&bus[ii + 8], _mm256_sub_ps(_mm256_add_ps(b1, v1),
+                                                 _mm256_mul_ps(b1, v1)));
+  }
+  mixer_accumulate_scalar(&bus[ii], &voice[ii], n - ii);
+}
+
+#endif
+
+#ifdef CPU_BUILD_NEON
+
+static void accumulate_neon(float* bus, const float* voice, int n) {
+  int ii = 0;
+  for(; ii + 4 <= n; ii += 4) {
+    float32x4_t b = vld1q_f32(&bus[ii]);
+    float32x4_t v = vld1q_f32(&voice[ii]);
+    /* b + v - b*v == (b + v) - b*v, vmls does the last step */
+    vst1q_f32(&bus[ii], vmlsq_f32(vaddq_f32(b, v), b, v));
+  }
+  mixer_accumulate_scalar(&bus[ii], &voice[ii], n - ii);
+}
+
+static void output_stereo_neon(int16_t* out, const float* bus, int nframes) {
+  int ii = 0;
+  for(; ii + 8 <= nframes; ii += 8) {
+    /* vcvtq truncates toward zero and saturates, vqmovn saturates again
+       to int16 */
+    int32x4_t i0 = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&bus[ii]), INT16_MAX));
+    int32x4_t i1 = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&bus[ii + 4]), INT16_MAX));
+    int16x8x2_t stereo;
+    stereo.val[0] = vcombine_s16(vqmovn_s32(i0), vqmovn_s32(i1));
+    stereo.val[1] = stereo.val[0];
+    vst2q_s16(&out[ii * 2], stereo);
+  }
+  mixer_output_stereo_scalar(&out[ii * 2], &bus[ii], nframes - ii);
+}
+
+#endif
+
+static const struct MixerKernels_ kernels[CPU_NUM_LEVELS] = {
+  [CPU_SCALAR] = {mixer_accumulate_scalar, mixer_output_stereo_scalar},
+#ifdef CPU_X86
+  [CPU_SSE2] = {accumulate_sse2, output_stereo_sse2},
+  [CPU_SSE41] = {accumulate_sse2, output_stereo_sse2},
+  [CPU_AVX2] = {accumulate_avx2, output_stereo_sse2},
+#endif
+#ifdef CPU_BUILD_NEON
+  [CPU_NEON] = {accumulate_neon, output_stereo_neon},
+#endif
+};
+
+void mixer_accumulate(float* bus, const float* voice, int n) {
+  kernels[cpu_level()].accumulate(bus, voice, n);
+}
+
+void mixer_output_stereo(int16_t* out, const float* bus, int nframes) {
+  kernels[cpu_level()].output_stereo(out, bus, nframes);
+}
@@ -0,0 +1,22 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <stdint.h>
+
+/** float bus kernels for the playlist mixer. Voices are combined with
+ * bus + v - bus * v (see audio.c) and the finished bus is written out
+ * as saturated, duplicated int16 stereo.
+ */
+
+/* bus[ii] = bus[ii] + voice[ii] - bus[ii] * voice[ii] */
+void mixer_accumulate(float* bus, const float* voice, int n);
+
+/* out[2*ii] = out[2*ii+1] = bus[ii] * INT16_MAX, clamped to the int16
+   range */
+void mixer_output_stereo(int16_t* out, const float* bus, int nframes);
+
+/* portable reference versions of the vectorized kernels */
+void mixer_accumulate_scalar(float* bus, const float* voice, int n);
+void mixer_output_stereo_scalar(int16_t* out, const float* bus, int nframes);
+
+#endif
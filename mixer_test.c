@@ -0,0 +1,1044 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+#include "audio_null.h"
+#include "biquad.h"
+#include "cpu.h"
+#include "envelope.h"
+#include "mixer.h"
+#include "osc.h"
+#include "pcm.h"
+#include "sfxcache.h"
+#include "resample.h"
+#include "sequencer.h"
+#include "testcase.h"
+
+#ifndef M_PI /* strict c99 headers leave it out */
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+
+#define NFRAMES 1031
+
+float frand(float lo, float hi) {
+  return lo + (hi - lo) * ((float)rand() / RAND_MAX);
+}
+
+/* test passes on the kernels of every level this cpu has. the level
+   in use is put back afterwards */
+int at_every_level(int (*test)()) {
+  CpuLevel level = cpu_level();
+  int ll, ok = 1;
+
+  for(ll = 0; ll < CPU_NUM_LEVELS; ++ll) {
+    if(cpu_set_level(ll) == ll) ok &= test();
+  }
+  cpu_set_level(level);
+  return ok;
+}
+
+/* a level the cpu doesn't have falls back to one it does */
+int levels_dispatch() {
+  CpuLevel level = cpu_level();
+  int ll, ok = 1;
+
+  ok &= cpu_set_level(CPU_SCALAR) == CPU_SCALAR && cpu_level() == CPU_SCALAR;
+  ok &= cpu_set_level(CPU_NUM_LEVELS - 1) == cpu_detected();
+  ok &= cpu_level() == cpu_detected();
+  for(ll = 0; ll < CPU_NUM_LEVELS; ++ll) {
+    ok &= cpu_level_named(cpu_level_name(ll)) == ll;
+  }
+  ok &= cpu_level_named("mmx") == CPU_NUM_LEVELS;
+
+  cpu_set_level(level);
+  return ok;
+}
+
+int kernels_match() {
+  float bus[NFRAMES], bus_scalar[NFRAMES], voice[NFRAMES];
+  int16_t out[NFRAMES * 2], out_scalar[NFRAMES * 2];
+  int ii, ok = 1;
+
+  for(ii = 0; ii < NFRAMES; ++ii) {
+    bus[ii] = bus_scalar[ii] = frand(-1, 1);
+    voice[ii] = frand(-1, 1);
+  }
+
+  mixer_accumulate(bus, voice, NFRAMES);
+  mixer_accumulate_scalar(bus_scalar, voice, NFRAMES);
+  for(ii = 0; ii < NFRAMES; ++ii) {
+    ok &= fabsf(bus[ii] - bus_scalar[ii]) < 1e-6f;
+  }
+
+  // include values that need saturating
+  for(ii = 0; ii < NFRAMES; ++ii) {
+    bus[ii] = frand(-1.5, 1.5);
+  }
+  mixer_output_stereo(out, bus, NFRAMES);
+  mixer_output_stereo_scalar(out_scalar, bus, NFRAMES);
+  for(ii = 0; ii < NFRAMES * 2; ++ii) {
+    ok &= abs(out[ii] - out_scalar[ii]) <= 1;
+  }
+  return ok;
+}
+
+int osc_bank_matches() {
+  struct OscBank_ bank;
+  float bus[NFRAMES], bus_scalar[NFRAMES];
+  OscSampler oscs[11];
+  int ii, ok = 1;
+
+  osc_bank_clear(&bank);
+  for(ii = 0; ii < array_size(oscs); ++ii) {
+    int first = rand() % NFRAMES;
+    oscs[ii] = (OscSampler)oscsampler_make(ii % OSC_NUM_WAVEFORMS, 0, 1000000,
+                                           frand(20, 5000), frand(0, 16000),
+                                           frand(0, 1));
+    osc_bank_add(&bank, oscs[ii], rand() % 100000, first,
+                 first + rand() % (NFRAMES - first + 1));
+  }
+
+  for(ii = 0; ii < NFRAMES; ++ii) {
+    bus[ii] = bus_scalar[ii] = frand(-1, 1);
+  }
+  osc_bank_mix(&bank, bus, NFRAMES);
+  osc_bank_mix_scalar(&bank, bus_scalar, NFRAMES);
+  for(ii = 0; ii < NFRAMES; ++ii) {
+    ok &= fabsf(bus[ii] - bus_scalar[ii]) < 1e-4f;
+  }
+
+  for(ii = 0; ii < array_size(oscs); ++ii) {
+    RELEASE_SAMPLER(oscs[ii]);
+  }
+  return ok;
+}
+
+/* a frequency that is an exact fraction of the sample rate keeps an
+   exact phase however far along the clock it's sampled */
+int osc_phase_exact() {
+  Sampler sin = sinsampler_make(0, (int64_t)1 << 40, SAMPLE_FREQ / 64.0, 8000, 0);
+  Sampler square = squaresampler_make(0, (int64_t)1 << 40, SAMPLE_FREQ / 64.0,
+                                      8000, 0);
+  int64_t far = (int64_t)64 << 30;
+  float out[2];
+  int ok = 1;
+
+  // a quarter cycle in is the sine's peak
+  ok &= abs(SAMPLE(sin, 16) - 8000) <= 1;
+  ok &= abs(SAMPLE(sin, far + 16) - SAMPLE(sin, 16)) == 0;
+  ok &= abs(SAMPLE(sin, far + 48) + 8000) <= 1;
+
+  // the render path agrees with the per sample one
+  RENDER(sin, far + 16, 2, out);
+  ok &= fabsf(out[0] * INT16_MAX - 8000) <= 1;
+
+  ok &= SAMPLE(square, far + 8) == SAMPLE(square, 8);
+  ok &= SAMPLE(square, far + 40) == SAMPLE(square, 40);
+  ok &= SAMPLE(square, 8) > 0 && SAMPLE(square, 40) < 0;
+
+  RELEASE_SAMPLER(sin);
+  RELEASE_SAMPLER(square);
+  return ok;
+}
+
+/* the pipelined cascade fed in uneven blocks agrees with the scalar
+   one run over everything at once */
+int biquad_kernels_match() {
+  float values[NFRAMES], expected[NFRAMES];
+  struct Biquad_ simd, scalar;
+  int type, nsections, ii, ok = 1;
+
+  for(type = 0; type < BIQUAD_NUM_TYPES; ++type) {
+    for(nsections = 0; nsections <= BIQUAD_MAX_SECTIONS; ++nsections) {
+      float cutoff = frand(50, SAMPLE_FREQ / 2);
+      float q = frand(0.3, 4);
+      int done = 0, block = 1;
+
+      biquad_init(&simd, type, cutoff, q, nsections, SAMPLE_FREQ);
+      biquad_init(&scalar, type, cutoff, q, nsections, SAMPLE_FREQ);
+      for(ii = 0; ii < NFRAMES; ++ii) {
+        values[ii] = expected[ii] = frand(-1, 1);
+      }
+
+      biquad_process_scalar(&scalar, expected, NFRAMES);
+      while(done < NFRAMES) {
+        int n = MIN(block, NFRAMES - done);
+        biquad_process(&simd, &values[done], n);
+        done += n;
+        block = block * 3 + 1;
+      }
+
+      for(ii = 0; ii < NFRAMES; ++ii) {
+        ok &= fabsf(values[ii] - expected[ii]) <= 1e-5f * (1 + fabsf(expected[ii]));
+      }
+    }
+  }
+  return ok;
+}
+
+/* peak of a unit sine at freq once the filter has settled */
+float biquad_gain(BiquadType type, float cutoff, float q, int nsections,
+                  float freq) {
+  float values[4096], peak = 0;
+  struct Biquad_ filter;
+  int ii;
+
+  biquad_init(&filter, type, cutoff, q, nsections, SAMPLE_FREQ);
+  for(ii = 0; ii < array_size(values); ++ii) {
+    values[ii] = sin(2 * M_PI * freq * ii / SAMPLE_FREQ);
+  }
+  biquad_process(&filter, values, array_size(values));
+  for(ii = array_size(values) / 2; ii < array_size(values); ++ii) {
+    peak = MAX(peak, fabsf(values[ii]));
+  }
+  return peak;
+}
+
+int biquad_response() {
+  int ok = 1;
+
+  ok &= biquad_gain(BIQUAD_LOWPASS, 1000, 0.707, 2, 100) > 0.95f;
+  ok &= biquad_gain(BIQUAD_LOWPASS, 1000, 0.707, 2, 8000) < 0.01f;
+  // each section is -3 dB at the cutoff with a butterworth q
+  ok &= fabsf(biquad_gain(BIQUAD_LOWPASS, 1000, 0.707, 1, 1000) - 0.707f) < 0.02f;
+  ok &= fabsf(biquad_gain(BIQUAD_LOWPASS, 1000, 0.707, 2, 1000) - 0.5f) < 0.02f;
+
+  ok &= biquad_gain(BIQUAD_HIGHPASS, 2000, 0.707, 2, 200) < 0.01f;
+  ok &= biquad_gain(BIQUAD_HIGHPASS, 2000, 0.707, 2, 9000) > 0.95f;
+
+  ok &= biquad_gain(BIQUAD_BANDPASS, 2000, 2, 1, 2000) > 0.98f;
+  ok &= biquad_gain(BIQUAD_BANDPASS, 2000, 2, 1, 200) < 0.1f;
+  ok &= biquad_gain(BIQUAD_BANDPASS, 2000, 2, 1, 10000) < 0.1f;
+
+  // no sections is a straight wire
+  ok &= fabsf(biquad_gain(BIQUAD_LOWPASS, 100, 0.707, 0, 8000) - 1) < 1e-3f;
+  return ok;
+}
+
+/* a filtered voice renders the same in blocks as a sample at a time,
+   and the bus filter takes effect from the next fill */
+int filter_voices() {
+  Sampler rendered = filtersampler_make(
+      sawsampler_make(0, 4000, 440, 8000, 0), BIQUAD_LOWPASS, 800, 0.707, 2);
+  Sampler sampled = filtersampler_make(
+      sawsampler_make(0, 4000, 440, 8000, 0), BIQUAD_LOWPASS, 800, 0.707, 2);
+  int16_t buffer[2 * 1024];
+  float out[2000];
+  int ii, peak = 0, ok = 1;
+
+  RENDER(rendered, 0, 700, out);
+  RENDER(rendered, 1400, 1300, &out[700]);
+  for(ii = 0; ii < 2000; ++ii) {
+    ok &= abs(SAMPLE(sampled, ii * NUM_CHANNELS) - (int)(out[ii] * INT16_MAX)) <= 1;
+  }
+  RELEASE_SAMPLER(rendered);
+  RELEASE_SAMPLER(sampled);
+
+  audio_set_bus_filter(BIQUAD_LOWPASS, 500, 0.707, 4);
+  audio_enqueue(sinsampler_make(audio_schedule_sample(), array_size(buffer),
+                                8000, 16000, 0));
+  audio_fill_buffer(buffer, array_size(buffer));
+  for(ii = array_size(buffer) / 2; ii < array_size(buffer); ++ii) {
+    peak = MAX(peak, abs(buffer[ii]));
+  }
+  ok &= peak < 10;
+
+  audio_set_bus_filter(BIQUAD_LOWPASS, 0, 0, 0);
+  audio_enqueue(sinsampler_make(audio_schedule_sample(), array_size(buffer),
+                                8000, 16000, 0));
+  audio_fill_buffer(buffer, array_size(buffer));
+  peak = 0;
+  for(ii = 0; ii < array_size(buffer); ++ii) {
+    peak = MAX(peak, abs(buffer[ii]));
+  }
+  ok &= peak > 15000;
+  return ok;
+}
+
+/* a ramp plays from its offset, stops at the end or wraps when it
+   loops, and the render path agrees with the per sample one */
+int pcm_plays_buffer() {
+  PcmBuffer ramp = pcmbuffer_make(100);
+  float* data = ramp->data;
+  float out[120];
+  int ii, ok = 1;
+
+  for(ii = 0; ii < 100; ++ii) {
+    data[ii] = ii / 100.0f;
+  }
+
+  Sampler once = pcmsampler_make(ramp, 10, 0, 0.5f, 10, 0);
+  Sampler looped = pcmsampler_make(ramp, 0, 1000, 1.0f, 95, 1);
+  // the voices hold it now
+  pcmbuffer_release(ramp);
+
+  ok &= DURATION(once) == 90 * NUM_CHANNELS;
+  RENDER(once, 10, 120, out);
+  for(ii = 0; ii < 120; ++ii) {
+    float expected = ii < 90 ? 0.5f * (10 + ii) / 100.0f : 0.0f;
+    ok &= fabsf(out[ii] - expected) < 1e-6f;
+  }
+  ok &= SAMPLE(once, 10 + 40 * NUM_CHANNELS) == (int16_t)(out[40] * INT16_MAX);
+
+  RENDER(looped, 0, 10, out);
+  for(ii = 0; ii < 10; ++ii) {
+    ok &= fabsf(out[ii] - ((95 + ii) % 100) / 100.0f) < 1e-6f;
+  }
+
+  RELEASE_SAMPLER(once);
+  RELEASE_SAMPLER(looped);
+  return ok;
+}
+
+/* a stereo 16 bit file written by the null backend maps back in and
+   plays its frames folded to mono */
+int pcm_reads_wav() {
+  const char* path = "mixer_test_pcm.wav";
+  int16_t frames[2 * 64];
+  float out[64];
+  FILE* wav = audio_wav_open(path);
+  int ii, ok = 1;
+
+  for(ii = 0; ii < 64; ++ii) {
+    frames[2 * ii] = ii * 100;
+    frames[2 * ii + 1] = ii * 300;
+  }
+  fwrite(frames, sizeof(int16_t), array_size(frames), wav);
+  ok &= audio_wav_close(wav);
+
+  PcmBuffer buffer = pcmbuffer_open_wav(path);
+  remove(path);
+  if(!buffer) return 0;
+
+  ok &= buffer->format == PCM_INT16 && buffer->channels == 2;
+  ok &= buffer->nframes == 64 && buffer->sample_freq == SAMPLE_FREQ;
+
+  Sampler pcm = pcmsampler_make(buffer, 0, 0, 1.0f, 0, 0);
+  RENDER(pcm, 0, 64, out);
+  for(ii = 0; ii < 64; ++ii) {
+    ok &= fabsf(out[ii] * INT16_MAX - ii * 200) < 0.01f;
+  }
+  RELEASE_SAMPLER(pcm);
+  pcmbuffer_release(buffer);
+
+  ok &= pcmbuffer_open_wav("mixer_test.c") == NULL;
+  return ok;
+}
+
+/* a cached effect sounds like its samplers mixed, and the cache keeps
+   the most recently used within its bounds */
+int sfxcache_keeps_recent() {
+  SfxCache cache = sfxcache_make(2, 1 << 20);
+  Sampler parts[2];
+  float out[1000];
+  int ii, ok = 1;
+
+  parts[0] = sawsampler_make(0, 2000, 100, 8000, 0);
+  parts[1] = sawsampler_make(0, 1000, 40, 8000, 0);
+  PcmBuffer boom = sfxcache_insert(cache, "boom", parts, 2);
+  ok &= boom->nframes == 1000 && cache->nentries == 1;
+
+  Sampler a = sawsampler_make(0, 2000, 100, 8000, 0);
+  Sampler b = sawsampler_make(0, 1000, 40, 8000, 0);
+  Sampler played = pcmsampler_make(boom, 0, 0, 1.0f, 0, 0);
+  RENDER(played, 0, 1000, out);
+  for(ii = 0; ii < 1000; ++ii) {
+    float va = (float)SAMPLE(a, ii * 2) / INT16_MAX;
+    float vb = ii < 500 ? (float)SAMPLE(b, ii * 2) / INT16_MAX : 0;
+    ok &= fabsf(out[ii] - (va + vb - va * vb)) < 1e-3f;
+  }
+  RELEASE_SAMPLER(a);
+  RELEASE_SAMPLER(b);
+
+  parts[0] = sinsampler_make(0, 200, 600, 4000, 0);
+  sfxcache_insert(cache, "tone", parts, 1);
+  ok &= sfxcache_find(cache, "boom") == boom;
+
+  // tone is the least recently used now
+  sfxcache_stage(cache, sinsampler_make(0, 200, 900, 4000, 0));
+  sfxcache_commit(cache, "high tone");
+  ok &= sfxcache_find(cache, "tone") == NULL;
+  ok &= sfxcache_find(cache, "boom") == boom;
+  ok &= cache->nentries == 2 && cache->evictions == 1;
+  ok &= cache->hits == 2 && cache->misses == 1;
+
+  // a playing voice outlives its entry
+  sfxcache_free(cache);
+  RENDER(played, 0, 10, out);
+  ok &= fabsf(out[5]) > 0;
+  RELEASE_SAMPLER(played);
+
+  // the byte bound evicts too
+  cache = sfxcache_make(8, 300 * sizeof(float));
+  parts[0] = sinsampler_make(0, 400, 600, 4000, 0);
+  sfxcache_insert(cache, "one", parts, 1);
+  parts[0] = sinsampler_make(0, 400, 600, 4000, 0);
+  sfxcache_insert(cache, "two", parts, 1);
+  ok &= cache->nentries == 1 && cache->bytes == 200 * sizeof(float);
+  ok &= sfxcache_find(cache, "two") != NULL;
+  sfxcache_free(cache);
+  return ok;
+}
+
+int resample_kernels_match() {
+  float coeffs[RESAMPLE_TAPS], x[RESAMPLE_TAPS];
+  int ii, jj, ok = 1;
+
+  for(jj = 0; jj < 100; ++jj) {
+    for(ii = 0; ii < RESAMPLE_TAPS; ++ii) {
+      coeffs[ii] = frand(-1, 1);
+      x[ii] = frand(-1, 1);
+    }
+    ok &= fabsf(resample_dot(coeffs, x) - resample_dot_scalar(coeffs, x)) < 1e-5f;
+  }
+  return ok;
+}
+
+/* largest error converting a unit sine at freq from in_rate to
+   out_rate, pulled through in uneven chunks. the first outputs see the
+   silence before the input and are skipped */
+float resampled_sine_error(int in_rate, int out_rate, float freq) {
+  Resampler resampler = resampler_make(in_rate, out_rate);
+  float out[RESAMPLE_CHUNK];
+  float error = 0;
+  long in_frame = 0, out_frame = 0;
+  int ii, chunk = 1;
+
+  while(out_frame < 4000) {
+    int needed = resampler_input_frames(resampler, chunk);
+    float* in = resampler_input(resampler, needed);
+    for(ii = 0; ii < needed; ++ii, ++in_frame) {
+      in[ii] = sin(2 * M_PI * freq * in_frame / in_rate);
+    }
+    resampler_output(resampler, out, chunk);
+    for(ii = 0; ii < chunk; ++ii, ++out_frame) {
+      float expected = sin(2 * M_PI * freq * out_frame / out_rate);
+      if(out_frame > 100) error = MAX(error, fabsf(out[ii] - expected));
+    }
+    chunk = chunk % RESAMPLE_CHUNK + 37;
+    chunk = MIN(chunk, RESAMPLE_CHUNK);
+  }
+
+  // the clocks haven't drifted: the input is exactly the outputs' worth
+  // plus the lookahead
+  if(in_frame != (long)((out_frame - 1) * (int64_t)in_rate / out_rate)
+     + RESAMPLE_TAPS / 2 + 1) {
+    error = 1;
+  }
+  resampler_free(resampler);
+  return error;
+}
+
+int resampler_converts() {
+  int ok = 1;
+  ok &= resampled_sine_error(22050, 48000, 1000) < 5e-4f;
+  ok &= resampled_sine_error(22050, 44100, 3000) < 5e-4f;
+  ok &= resampled_sine_error(48000, 22050, 1000) < 5e-4f;
+  // above the new nyquist comes out as (almost) nothing
+  ok &= resampled_sine_error(48000, 22050, 15000) > 0.98f;
+  ok &= resampled_sine_error(44100, 48000, 5000) < 5e-4f;
+  return ok;
+}
+
+/* a voice over a buffer at half the mix rate plays at the right pitch,
+   and the device can run at a rate of its own */
+int rates_converted() {
+  PcmBuffer slow = pcmbuffer_make(2000);
+  float* data = slow->data;
+  float out[1500];
+  int16_t buffer[2 * 1000];
+  int ii, peak = 0, ok = 1;
+
+  slow->sample_freq = SAMPLE_FREQ / 2;
+  for(ii = 0; ii < 2000; ++ii) {
+    data[ii] = 0.5f * sin(2 * M_PI * 500 * ii / (SAMPLE_FREQ / 2));
+  }
+  Sampler pcm = pcmsampler_make(slow, 0, 0, 1.0f, 0, 0);
+  pcmbuffer_release(slow);
+
+  ok &= DURATION(pcm) == 4000 * NUM_CHANNELS;
+  RENDER(pcm, 0, 700, out);
+  RENDER(pcm, 1400, 800, &out[700]);
+  for(ii = 100; ii < 1500; ++ii) {
+    ok &= fabsf(out[ii] - 0.5f * sin(2 * M_PI * 500 * ii / SAMPLE_FREQ)) < 5e-3f;
+  }
+  RELEASE_SAMPLER(pcm);
+
+  audio_set_device_rate(48000);
+  int64_t before = audio_current_sample();
+  audio_enqueue(sinsampler_make(audio_schedule_sample(), SAMPLE_FREQ, 1000,
+                                16000, 0));
+  audio_fill_buffer(buffer, array_size(buffer));
+  ok &= audio_current_sample() - before
+    == ((int64_t)999 * SAMPLE_FREQ / 48000 + RESAMPLE_TAPS / 2 + 1)
+       * NUM_CHANNELS;
+  for(ii = 0; ii < array_size(buffer); ++ii) {
+    peak = MAX(peak, abs(buffer[ii]));
+  }
+  ok &= peak > 15000 && peak < 16500;
+
+  audio_set_device_rate(SAMPLE_FREQ);
+  audio_null_render(NULL, SAMPLE_FREQ * NUM_CHANNELS, 0, NULL);
+  return ok;
+}
+
+/* the mixer as it was before it worked in blocks: one indirect call per
+   voice per frame, combined and converted a sample at a time */
+float reference_mix(PlayListSample* voices, int n, int64_t sample,
+                    float value) {
+  int ii;
+  for(ii = 0; ii < n; ++ii) {
+    Sampler sampler = voices[ii]->sampler;
+    if(START(sampler) > sample || END(sampler) <= sample) continue;
+    float normalized = (float)SAMPLE(sampler, sample) / INT16_MAX;
+    value = value + normalized - (value * normalized);
+  }
+  return value;
+}
+
+void reference_fill(PlayList list, int16_t* buffer, int nsamples) {
+  int ii;
+  for(ii = 0; ii < nsamples; ii += 2) {
+    int64_t sample = list->next_sample + ii;
+    float value = reference_mix(list->active, list->nactive, sample, 0);
+    value = reference_mix(list->pending, list->npending, sample, value);
+    buffer[ii] = INT16_MAX * value;
+    buffer[ii + 1] = buffer[ii];
+  }
+}
+
+/* largest difference between the reference and playlist_fill_buffer
+   over a few buffers of overlapping voices */
+int playlist_max_delta() {
+  int16_t expected[4096], actual[4096];
+  PlayList list = playlist_make();
+  int pass, ii, delta = 0;
+
+  playlist_insert_sampler(list, playlistsample_make(
+      sinsampler_make(0, 20000, 440, 8000, 0.1)));
+  playlist_insert_sampler(list, playlistsample_make(
+      sawsampler_make(301, 9001, 220, 6000, 0.3)));
+  playlist_insert_sampler(list, playlistsample_make(
+      sinsampler_make(1001, 3000, 660, 5000, 0)));
+  playlist_insert_sampler(list, playlistsample_make(
+      sawsampler_make(4096, 4096, 110, 7000, 0)));
+  playlist_insert_sampler(list, playlistsample_make(
+      squaresampler_make(2500, 7000, 330, 3000, 0.5)));
+  playlist_insert_sampler(list, playlistsample_make(
+      trianglesampler_make(5003, 12000, 550, 6000, 0.25)));
+
+  for(pass = 0; pass < 6; ++pass) {
+    reference_fill(list, expected, 4096);
+    playlist_fill_buffer(list, actual, 4096);
+    for(ii = 0; ii < 4096; ++ii) {
+      int d = abs(expected[ii] - actual[ii]);
+      if(d > delta) delta = d;
+    }
+  }
+
+  // everything has ended
+  if(list->npending != 0 || list->nactive != 0) delta = -1;
+  playlist_collect(list);
+  free(list);
+  return delta;
+}
+
+/* the clock is 64 bits everywhere, so nothing changes once it's past
+   what a 32 bit long holds */
+int clock_past_32_bits() {
+  int16_t buffer[2 * 300];
+  PlayList list = playlist_make();
+  int64_t start = ((int64_t)3 << 32) + 1000;
+  int ii, ok = 1, heard = 0;
+
+  list->next_sample = start - 200;
+  playlist_insert_sampler(list, playlistsample_make(
+      sinsampler_make(start, 400, 440, 8000, 0.25)));
+  playlist_fill_buffer(list, buffer, array_size(buffer));
+  ok &= list->next_sample == start - 200 + array_size(buffer);
+
+  // silent until the voice starts, then playing
+  for(ii = 0; ii < 200; ++ii) {
+    ok &= buffer[ii] == 0;
+  }
+  for(ii = 200; ii < array_size(buffer); ++ii) {
+    heard |= buffer[ii] != 0;
+  }
+  ok &= heard;
+
+  playlist_fill_buffer(list, buffer, array_size(buffer));
+  ok &= list->nactive == 0 && list->npending == 0;
+  playlist_collect(list);
+  free(list);
+  return ok;
+}
+
+/* schedule a pile of short voices in random order and check they're
+   promoted no earlier than their start and retired once they end */
+int playlist_promotes_in_order() {
+  int16_t buffer[2 * 100];
+  PlayList list = playlist_make();
+  int ii, pass, ok = 1;
+
+  for(ii = 0; ii < NUM_SAMPLERS / 2; ++ii) {
+    long start = rand() % 20000;
+    playlist_insert_sampler(list, playlistsample_make(
+        sinsampler_make(start, 1 + rand() % 500, 440, 1000, 0)));
+  }
+
+  for(pass = 0; pass < 110; ++pass) {
+    playlist_fill_buffer(list, buffer, array_size(buffer));
+    for(ii = 0; ii < list->nactive; ++ii) {
+      ok &= START(list->active[ii]->sampler) < list->next_sample;
+      ok &= END(list->active[ii]->sampler) > list->next_sample;
+    }
+    for(ii = 0; ii < list->npending; ++ii) {
+      ok &= START(list->pending[ii]->sampler) >= list->next_sample;
+    }
+  }
+
+  ok &= list->npending == 0 && list->nactive == 0;
+  playlist_collect(list);
+  free(list);
+  return ok;
+}
+
+/* the mixer never frees. many more voices than the allocators hold
+   have to go through audio_enqueue, which collects the finished ones */
+int enqueue_recycles() {
+  int16_t buffer[2 * 64];
+  int ii, ok = 1;
+  for(ii = 0; ii < 4 * NUM_SAMPLERS; ++ii) {
+    audio_enqueue(sinsampler_make(audio_current_sample(), 64, 440, 8000, 0.25));
+    audio_fill_buffer(buffer, array_size(buffer));
+    ok &= buffer[0] != 0;
+  }
+  return ok;
+}
+
+/* the block evaluation agrees with the level frame by frame, from any
+   tick, and a gate that closes early releases from where it got to */
+int envelope_shapes() {
+  struct Envelope_ env = {100 * NUM_CHANNELS, 200 * NUM_CHANNELS, 0.5f,
+                          300 * NUM_CHANNELS};
+  int64_t gate = 600 * NUM_CHANNELS;
+  static const int64_t starts[] = {0, 1, 77, 555, 1199, 1500};
+  float out[1000];
+  int ii, ss, ok = 1;
+
+  ok &= envelope_level(&env, gate, 0) == 0.0f;
+  ok &= fabsf(envelope_level(&env, gate, 50 * NUM_CHANNELS) - 0.5f) < 1e-6f;
+  ok &= fabsf(envelope_level(&env, gate, 200 * NUM_CHANNELS) - 0.75f) < 1e-6f;
+  ok &= envelope_level(&env, gate, 400 * NUM_CHANNELS) == 0.5f;
+  ok &= fabsf(envelope_level(&env, gate, 750 * NUM_CHANNELS) - 0.25f) < 1e-6f;
+  ok &= envelope_level(&env, gate, 900 * NUM_CHANNELS) == 0.0f;
+  ok &= fabsf(envelope_level(&env, 50 * NUM_CHANNELS, 200 * NUM_CHANNELS)
+              - 0.25f) < 1e-6f;
+
+  for(ss = 0; ss < array_size(starts); ++ss) {
+    for(ii = 0; ii < array_size(out); ++ii) {
+      out[ii] = 1.0f;
+    }
+    envelope_apply(&env, gate, starts[ss], array_size(out), out);
+    for(ii = 0; ii < array_size(out); ++ii) {
+      float level = envelope_level(&env, gate,
+                                   starts[ss] + ii * NUM_CHANNELS);
+      ok &= fabsf(out[ii] - level) < 1e-4f;
+    }
+  }
+
+  // as a sampler, over a looped buffer that keeps going for the tail
+  PcmBuffer buffer = pcmbuffer_make(64);
+  float* data = buffer->data;
+  for(ii = 0; ii < 64; ++ii) {
+    data[ii] = 1.0f;
+  }
+  Sampler shaped = envelopesampler_make(pcmsampler_make(buffer, 1000, gate,
+                                                        1.0f, 0, 1),
+                                        env.attack, env.decay, env.sustain,
+                                        env.release);
+  ok &= START(shaped) == 1000 && DURATION(shaped) == gate + env.release;
+  RENDER(shaped, START(shaped), 900, out);
+  for(ii = 0; ii < 900; ++ii) {
+    ok &= fabsf(out[ii] - envelope_level(&env, gate, ii * NUM_CHANNELS))
+      < 1e-4f;
+  }
+  ok &= abs(SAMPLE(shaped, 1000 + 400 * NUM_CHANNELS) - INT16_MAX / 2) <= 1;
+  RELEASE_SAMPLER(shaped);
+  pcmbuffer_release(buffer);
+  return ok;
+}
+
+extern PlayList playlist;
+
+/* past AUDIO_MAX_VOICES the quietest voice fades out for each new one.
+   past the whole pool new voices are dropped, and past the sampler
+   pool makers hand out silence. none of it crashes */
+int voices_stolen() {
+  int16_t buffer[2 * 256];
+  AudioStats stats = audio_stats();
+  Sampler samplers[4 * NUM_SAMPLERS];
+  Sampler quiet = NULL;
+  int64_t now = audio_current_sample();
+  int ii, n, headroom = NUM_SAMPLERS - AUDIO_MAX_VOICES, ok = 1;
+
+  // the counts below need the pool to start out empty
+  playlist_collect(playlist);
+  audio_stats_reset();
+  for(ii = 0; ii < AUDIO_MAX_VOICES; ++ii) {
+    Sampler sampler = sinsampler_make(now, 100000, 440, ii == 7 ? 50 : 200, 0);
+    if(ii == 7) quiet = sampler;
+    audio_enqueue(sampler);
+  }
+  audio_fill_buffer(buffer, array_size(buffer));
+  ok &= stats->voices == AUDIO_MAX_VOICES && stats->voices_stolen == 0;
+
+  audio_enqueue(sinsampler_make(audio_schedule_sample(), 100000, 440, 200, 0));
+  ok &= stats->voices_stolen == 1;
+  for(ii = 0; ii < playlist->nactive; ++ii) {
+    PlayListSample pls = playlist->active[ii];
+    ok &= pls->stolen == (pls->sampler == quiet);
+  }
+
+  for(ii = 0; ii < NUM_SAMPLERS; ++ii) {
+    audio_enqueue(sinsampler_make(audio_schedule_sample(), 100000, 440,
+                                  200, 0));
+  }
+  ok &= stats->voices_stolen == headroom;
+  ok &= stats->voices_dropped == NUM_SAMPLERS - (headroom - 1);
+
+  // the stolen voices are gone within a block
+  audio_fill_buffer(buffer, array_size(buffer));
+  ok &= stats->voices == NUM_SAMPLERS;
+  audio_fill_buffer(buffer, array_size(buffer));
+  ok &= stats->voices == AUDIO_MAX_VOICES;
+  audio_null_render(NULL, 100000, 0, NULL);
+
+  for(n = 0; n < array_size(samplers); ++n) {
+    samplers[n] = sinsampler_make(0, 100, 440, 200, 0);
+    if(samplers[n] == sampler_silence()) break;
+  }
+  ok &= n < array_size(samplers);
+  audio_enqueue(samplers[n]);
+  for(ii = 0; ii < n; ++ii) {
+    RELEASE_SAMPLER(samplers[ii]);
+  }
+  ok &= stats->voices_dropped == NUM_SAMPLERS - (headroom - 1);
+
+  audio_stats_reset();
+  return ok;
+}
+
+/* a bus is mixed into its parent like a voice after its effects and
+   gain, children first, and a delay line echoes what went in */
+int graph_processes_buses() {
+  AudioGraph graph = audiograph_make();
+  int music = audiograph_add_bus(graph, 0);
+  int drums = audiograph_add_bus(graph, music);
+  int echo = audiograph_add_bus(graph, 0);
+  float mix[MIX_BLOCK_FRAMES];
+  int ii, ok = 1;
+
+  ok &= music == 1 && drums == 2 && echo == 3;
+  ok &= audiograph_add_bus(graph, 7) == -1;
+  ok &= audiograph_add_delay(graph, echo, 10 * NUM_CHANNELS, 0.5f, 1.0f) == 0;
+  audiograph_set_gain(graph, music, 0.5f);
+
+  audiograph_clear(graph);
+  for(ii = 0; ii < MIX_BLOCK_FRAMES; ++ii) {
+    graph->buses[0].buffer[ii] = 0.25f;
+    graph->buses[music].buffer[ii] = 0.5f;
+    graph->buses[drums].buffer[ii] = 0.1f;
+  }
+  graph->buses[echo].buffer[0] = 0.5f;
+  audiograph_process(graph, mix, MIX_BLOCK_FRAMES);
+
+  for(ii = 0; ii < MIX_BLOCK_FRAMES; ++ii) {
+    float m = (0.5f + 0.1f - 0.5f * 0.1f) * 0.5f;
+    // the impulse, then its echo halving every 10 frames
+    float e = ii % 10 ? 0.0f : ii == 0 ? 0.5f : ldexpf(0.5f, 1 - ii / 10);
+    float master = 0.25f + e - 0.25f * e;
+    master = master + m - master * m;
+    ok &= fabsf(mix[ii] - master) < 1e-6f;
+  }
+  audiograph_free(graph);
+  return ok;
+}
+
+/* voices go to the bus they're enqueued to, and a new graph takes over
+   between fills */
+int graph_routes_voices() {
+  int16_t buffer[2 * 256];
+  AudioGraph graph = audiograph_make();
+  int muted = audiograph_add_bus(graph, 0);
+  int ii, loud = 0, ok = 1;
+
+  audiograph_set_gain(graph, muted, 0.0f);
+  audio_set_graph(graph);
+  audio_enqueue_bus(sinsampler_make(audio_current_sample(), 512, 440, 8000,
+                                    0.25), muted);
+  audio_fill_buffer(buffer, array_size(buffer));
+  ok &= playlist->graph == graph;
+  for(ii = 0; ii < array_size(buffer); ++ii) {
+    ok &= buffer[ii] == 0;
+  }
+
+  // a bus the graph doesn't have is the master
+  audio_enqueue_bus(sinsampler_make(audio_current_sample(), 512, 440, 8000,
+                                    0.25), 5);
+  audio_fill_buffer(buffer, array_size(buffer));
+  for(ii = 0; ii < array_size(buffer); ++ii) {
+    loud |= buffer[ii] != 0;
+  }
+  ok &= loud;
+
+  // back to a plain master for the golden render
+  audio_set_graph(audiograph_make());
+  audio_fill_buffer(buffer, array_size(buffer));
+  ok &= playlist->graph != graph && playlist->graph->nbuses == 1;
+  return ok;
+}
+
+/* until the sequencer has enqueued n voices, or a couple of seconds */
+int sequencer_reaches(Sequencer seq, long n) {
+  struct timespec ms = {0, 1000000};
+  int ii;
+  for(ii = 0; ii < 2000 && sequencer_voices(seq) < n; ++ii) {
+    nanosleep(&ms, NULL);
+  }
+  return sequencer_voices(seq) == n;
+}
+
+/* four notes an eighth of a second apart looping every half second,
+   a quarter of a second ahead. each note lands on its tick */
+int sequencer_looks_ahead() {
+  int64_t eighth = SAMPLE_FREQ / 8 * NUM_CHANNELS;
+  double song[4 * SEQUENCER_NOTE_FIELDS];
+  int16_t buffer[2 * 1024];
+  struct timespec wait = {0, 20000000};
+  Sequencer seq = sequencer_make(2 * eighth);
+  int64_t start = audio_schedule_sample() + 1000;
+  int ii, ok = 1;
+
+  // backwards, which it sorts
+  for(ii = 0; ii < 4; ++ii) {
+    double* note = &song[(3 - ii) * SEQUENCER_NOTE_FIELDS];
+    note[0] = ii * eighth;
+    note[1] = 600 * NUM_CHANNELS;
+    note[2] = 1000;
+    note[3] = 8000;
+    note[4] = OSC_SAW;
+  }
+  sequencer_play(seq, song, 4, start, 4 * eighth);
+
+  // only the notes within the lookahead, even given time for more
+  ok &= sequencer_reaches(seq, 2);
+  nanosleep(&wait, NULL);
+  ok &= sequencer_voices(seq) == 2;
+
+  audio_fill_buffer(buffer, array_size(buffer));
+  for(ii = 0; ii < 1000; ++ii) {
+    ok &= buffer[ii] == 0;
+  }
+  ok &= buffer[1000 + 2 * NUM_CHANNELS] != 0;
+
+  // half a second later it's into the second pass
+  audio_null_render(NULL, 4 * eighth - array_size(buffer), 0, NULL);
+  ok &= sequencer_reaches(seq, 6);
+  ok &= sequencer_playing(seq);
+
+  sequencer_stop(seq);
+  audio_null_render(NULL, 4 * eighth, 0, NULL);
+  nanosleep(&wait, NULL);
+  ok &= sequencer_voices(seq) == 6 && !sequencer_playing(seq);
+  sequencer_free(seq);
+
+  // let what it enqueued finish
+  audio_null_render(NULL, 4 * eighth, 0, NULL);
+  return ok;
+}
+
+/* a couple of bars of every waveform, scheduled relative to the clock
+   so the render doesn't depend on what played before */
+#define GOLDEN_SAMPLES (SAMPLE_FREQ * NUM_CHANNELS)
+
+/* fnv-1a of the golden score as mixed by an sse2 build. if the mixer
+   changes on purpose, render it again and update this */
+#define GOLDEN_HASH 0xe8908b85u
+
+void golden_score() {
+  static const float freqs[] = {C_(1), E_(1), G_(1), C_(2), A_(0.5)};
+  int64_t now = audio_current_sample();
+  int ii;
+  for(ii = 0; ii < array_size(freqs); ++ii) {
+    int64_t start = now + ii * 4000;
+    audio_enqueue(sinsampler_make(start, 16000, freqs[ii], 4000, 0));
+    audio_enqueue(sawsampler_make(start + 1001, 9000, freqs[ii] / 2, 2500, 0.5));
+    audio_enqueue(squaresampler_make(start + 2003, 7000, freqs[ii], 1500, 0));
+    audio_enqueue(trianglesampler_make(start + 3007, 11000, freqs[ii] * 2,
+                                       3000, 0.25));
+  }
+}
+
+unsigned golden_hash(const char* path, long* data_bytes) {
+  FILE* f = fopen(path, "rb");
+  unsigned char header[44];
+  unsigned hash = 2166136261u;
+  int c;
+
+  *data_bytes = -1;
+  if(!f) return 0;
+  if(fread(header, 1, 44, f) == 44 && memcmp(header, "RIFF", 4) == 0 &&
+     memcmp(&header[8], "WAVEfmt ", 8) == 0 &&
+     memcmp(&header[36], "data", 4) == 0) {
+    *data_bytes = header[40] | header[41] << 8 | header[42] << 16 |
+      (long)header[43] << 24;
+  }
+  while((c = fgetc(f)) != EOF) {
+    hash = (hash ^ c) * 16777619u;
+  }
+  fclose(f);
+  return hash;
+}
+
+int golden_render_matches() {
+  struct AudioRenderStats_ stats;
+  long data_bytes;
+  unsigned hash;
+  FILE* wav = audio_wav_open("mixer_test.wav");
+
+  golden_score();
+  if(!wav) return 0;
+  if(!audio_null_render(wav, GOLDEN_SAMPLES / 2, 0, &stats) ||
+     !audio_null_render(wav, GOLDEN_SAMPLES / 2, 0, NULL) ||
+     !audio_wav_close(wav)) {
+    return 0;
+  }
+  hash = golden_hash("mixer_test.wav", &data_bytes);
+  remove("mixer_test.wav");
+
+  if(stats.nsamples != GOLDEN_SAMPLES / 2 || stats.max_voices < 8) return 0;
+  if(data_bytes != GOLDEN_SAMPLES * 2) return 0;
+  /* taken with the sse2 kernels. the wider x86 ones give the same
+     samples */
+  if(cpu_level() != CPU_SCALAR && cpu_level() != CPU_NEON &&
+     hash != GOLDEN_HASH) {
+    fprintf(stderr, "golden render hash %#x\n", hash);
+    return 0;
+  }
+  return 1;
+}
+
+int stats_recorded() {
+  int16_t buffer[2 * 256];
+  AudioStats stats = audio_stats();
+  int ok = 1;
+
+  audio_stats_reset();
+  audio_stats_device(1000, 8000, 500);
+  audio_stats_device(7999, 8000, 500);
+  audio_stats_device(100, 8000, 500);
+  ok &= stats->callbacks == 3 && stats->underruns == 1;
+  ok &= stats->fill_level[0] == 1 && stats->fill_level[1] == 1;
+  ok &= stats->fill_level[AUDIO_FILL_BUCKETS - 1] == 1;
+
+  // a voice for now is heard after the queued audio, at least
+  audio_enqueue(sinsampler_make(audio_current_sample(), 2000, 440, 8000, 0));
+  // one scheduled ahead doesn't count
+  audio_enqueue(sinsampler_make(audio_current_sample() + 100000, 2000, 440,
+                                8000, 0));
+  audio_fill_buffer(buffer, array_size(buffer));
+  ok &= audio_schedule_sample() == audio_current_sample();
+  ok &= stats->fills == 1 && stats->fill_us[AUDIO_TIME_BUCKETS - 1] == 0;
+  ok &= stats->voices == 1 && stats->max_voices == 1;
+  ok &= stats->latencies == 1;
+  ok &= stats->latency_us_max >= 1e6 * 100 / (NUM_CHANNELS * SAMPLE_FREQ);
+
+  // let both finish so nothing is left for the next test
+  audio_null_render(NULL, 100000 + 2000, 0, NULL);
+  audio_stats_reset();
+  return ok;
+}
+
+/* a voice enqueued at the audio_schedule_sample() read before a fill
+   started misses that fill but still plays from its first frame */
+int late_enqueue_keeps_head() {
+  int16_t buffer[2 * 64];
+  PcmBuffer ramp = pcmbuffer_make(64);
+  float* data = ramp->data;
+  int64_t at;
+  int ii, ok = 1;
+
+  for(ii = 0; ii < 64; ++ii) {
+    data[ii] = 0.25f + ii / 256.0f;
+  }
+
+  at = audio_schedule_sample();
+  audio_fill_buffer(buffer, array_size(buffer));
+  audio_enqueue(pcmsampler_make(ramp, at, 0, 1.0f, 0, 0));
+  pcmbuffer_release(ramp);
+
+  audio_fill_buffer(buffer, array_size(buffer));
+  for(ii = 0; ii < 64; ++ii) {
+    int expected = (int)((0.25f + ii / 256.0f) * INT16_MAX);
+    ok &= abs(buffer[ii * 2] - expected) <= 1;
+  }
+  return ok;
+}
+
+/* simulated realtime takes as long as the audio lasts */
+int realtime_render_paced() {
+  struct AudioRenderStats_ stats;
+  struct timespec t0, t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  audio_null_render(NULL, SAMPLE_FREQ * NUM_CHANNELS / 20, 1, &stats);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9 >= 0.045;
+}
+
+int main(int argc, char ** argv) {
+  audio_init();
+
+  ASSERT(levels_dispatch());
+  ASSERT(at_every_level(kernels_match));
+  ASSERT(at_every_level(osc_bank_matches));
+  ASSERT(osc_phase_exact());
+  ASSERT(at_every_level(biquad_kernels_match));
+  ASSERT(biquad_response());
+  ASSERT(pcm_plays_buffer());
+  ASSERT(pcm_reads_wav());
+  ASSERT(sfxcache_keeps_recent());
+
+  // the reference rounds each voice to int16 before mixing, which
+  // costs up to a step per voice
+  int delta = playlist_max_delta();
+  ASSERT(delta >= 0);
+  ASSERT(delta <= 6);
+
+  ASSERT(playlist_promotes_in_order());
+  ASSERT(clock_past_32_bits());
+  ASSERT(enqueue_recycles());
+  ASSERT(stats_recorded());
+  ASSERT(late_enqueue_keeps_head());
+  ASSERT(filter_voices());
+  ASSERT(envelope_shapes());
+  ASSERT(voices_stolen());
+  ASSERT(sequencer_looks_ahead());
+  ASSERT(graph_processes_buses());
+  ASSERT(graph_routes_voices());
+  ASSERT(at_every_level(resample_kernels_match));
+  ASSERT(resampler_converts());
+  ASSERT(rates_converted());
+  ASSERT(golden_render_matches());
+  ASSERT(realtime_render_paced());
+
+  END_MAIN();
+}
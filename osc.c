@@ -0,0 +1,306 @@
+#include "osc.h"
+#include "cpu.h"
+#include "memory.h"
+
+#include <math.h>
+
+#ifdef CPU_X86
+#include <emmintrin.h>
+#endif
+
+#ifdef CPU_BUILD_NEON
+#include <arm_neon.h>
+#endif
+
+#ifndef M_PI /* strict c99 headers leave it out */
+#define M_PI 3.14159265358979323846
+#endif
+
+#define FRAC_BITS (32 - OSC_TABLE_BITS)
+#define FRAC_MASK ((1u << FRAC_BITS) - 1)
+#define FRAC_SCALE (1.0f / (1u << FRAC_BITS))
+
+/* frames of the bank's running product kept on the stack at a time */
+#define BANK_CHUNK 64
+
+extern FixedAllocator sampler_allocator;
+void sampler_free(void* obj);
+
+/* one table per waveform, each with a copy of its first entry at the
+   end so interpolation never has to wrap */
+static float osc_tables[OSC_NUM_WAVEFORMS * (OSC_TABLE_SIZE + 1)];
+
+#define TABLE(waveform) (&osc_tables[(waveform) * (OSC_TABLE_SIZE + 1)])
+
+void osc_init() {
+  int ii, ww;
+  for(ii = 0; ii < OSC_TABLE_SIZE; ++ii) {
+    float x = (float)ii / OSC_TABLE_SIZE;
+    TABLE(OSC_SINE)[ii] = sin(2 * M_PI * x);
+    TABLE(OSC_SAW)[ii] = -1.0f + 2.0f * x;
+    TABLE(OSC_SQUARE)[ii] = x < 0.5f ? 1.0f : -1.0f;
+    if(x < 0.25f) {
+      TABLE(OSC_TRIANGLE)[ii] = 4.0f * x;
+    } else if(x < 0.75f) {
+      TABLE(OSC_TRIANGLE)[ii] = 2.0f - 4.0f * x;
+    } else {
+      TABLE(OSC_TRIANGLE)[ii] = 4.0f * x - 4.0f;
+    }
+  }
+
+  for(ww = 0; ww < OSC_NUM_WAVEFORMS; ++ww) {
+    TABLE(ww)[OSC_TABLE_SIZE] = TABLE(ww)[0];
+  }
+}
+
+static inline float osc_lookup(const float* table, uint32_t phase) {
+  const float* t = &table[phase >> FRAC_BITS];
+  float frac = (float)(phase & FRAC_MASK) * FRAC_SCALE;
+  return t[0] + frac * (t[1] - t[0]);
+}
+
+static inline uint32_t osc_phase_at(OscSampler osc, int64_t sample) {
+  /* unsigned arithmetic wraps, which is exactly what a phase does */
+  return osc->phase + osc->increment * (uint32_t)(sample - START(osc));
+}
+
+int16_t osc_sample(OscSampler osc, int64_t sample) {
+  return INT16_MAX * osc->amp *
+    osc_lookup(TABLE(osc->waveform), osc_phase_at(osc, sample));
+}
+
+void osc_render(OscSampler osc, int64_t start, int n, float* out) {
+  const float* table = TABLE(osc->waveform);
+  uint32_t phase = osc_phase_at(osc, start);
+  uint32_t step = osc->increment * NUM_CHANNELS;
+  int ii;
+  for(ii = 0; ii < n; ++ii, phase += step) {
+    out[ii] = osc->amp * osc_lookup(table, phase);
+  }
+}
+
+Sampler oscsampler_make(OscWaveform waveform, int64_t start, int64_t duration,
+                        float freq, float amp, float phase) {
+  OscSampler osc = (OscSampler)fixed_allocator_try_alloc(sampler_allocator);
+  if(!osc) return sampler_silence();
+  osc->sampler.function = (SamplerFunction)osc_sample;
+  osc->sampler.render = (SamplerRender)osc_render;
+  osc->sampler.release = sampler_free;
+  osc->sampler.start_sample = start;
+  osc->sampler.duration_samples = duration;
+
+  /* cycles per tick of the sample clock as a 0.32 fixed point value */
+  double cycles = (double)freq / SAMPLE_FREQ;
+  cycles -= floor(cycles);
+  osc->increment = (uint32_t)(cycles * 4294967296.0);
+  osc->phase = (uint32_t)((phase - floor(phase)) * 4294967296.0);
+  osc->amp = amp / INT16_MAX;
+  osc->waveform = waveform;
+
+  return (Sampler)osc;
+}
+
+int sampler_is_osc(Sampler sampler) {
+  return sampler->render == (SamplerRender)osc_render;
+}
+
+void osc_bank_clear(OscBank bank) {
+  bank->nvoices = 0;
+}
+
+void osc_bank_add(OscBank bank, OscSampler osc, int64_t block_start,
+                  int first, int last) {
+  int ii = bank->nvoices++;
+  bank->phase[ii] = osc_phase_at(osc, block_start);
+  bank->step[ii] = osc->increment * NUM_CHANNELS;
+  bank->amp[ii] = osc->amp;
+  bank->table[ii] = osc->waveform * (OSC_TABLE_SIZE + 1);
+  bank->first[ii] = first;
+  bank->last[ii] = last;
+}
+
+/* the bank mixes with bus + v - bus*v like mixer_accumulate. Written as
+   1 - (1 - bus)(1 - v) that's a product, so every lane's (1 - v) is
+   multiplied into keep and the bus is updated once at the end */
+static void bank_apply(float* bus, const float* keep, int n) {
+  int ii;
+  for(ii = 0; ii < n; ++ii) {
+    bus[ii] = 1.0f - (1.0f - bus[ii]) * keep[ii];
+  }
+}
+
+void osc_bank_mix_scalar(OscBank bank, float* bus, int nframes) {
+  float keep[BANK_CHUNK];
+  int base, ff, vv;
+
+  for(base = 0; base < nframes; base += BANK_CHUNK) {
+    int n = MIN(BANK_CHUNK, nframes - base);
+    for(ff = 0; ff < n; ++ff) {
+      keep[ff] = 1.0f;
+    }
+
+    for(vv = 0; vv < bank->nvoices; ++vv) {
+      const float* table = &osc_tables[bank->table[vv]];
+      uint32_t phase = bank->phase[vv] + bank->step[vv] * base;
+      for(ff = 0; ff < n; ++ff, phase += bank->step[vv]) {
+        int frame = base + ff;
+        if(frame < bank->first[vv] || frame >= bank->last[vv]) continue;
+        keep[ff] *= 1.0f - bank->amp[vv] * osc_lookup(table, phase);
+      }
+    }
+
+    bank_apply(&bus[base], keep, n);
+  }
+}
+
+/* inactive lanes and the padding past nvoices have first == last so
+   they never sound */
+static void bank_pad(OscBank bank) {
+  int ii;
+  for(ii = bank->nvoices; ii & (OSC_BANK_LANES - 1); ++ii) {
+    bank->phase[ii] = 0;
+    bank->step[ii] = 0;
+    bank->amp[ii] = 0;
+    bank->table[ii] = 0;
+    bank->first[ii] = 0;
+    bank->last[ii] = 0;
+  }
+}
+
+#ifdef CPU_X86
+
+CPU_TARGET_SSE2
+static void bank_mix_sse2(OscBank bank, float* bus, int nframes) {
+  const __m128i frac_mask = _mm_set1_epi32(FRAC_MASK);
+  const __m128 frac_scale = _mm_set1_ps(FRAC_SCALE);
+  const __m128 one = _mm_set1_ps(1.0f);
+  float keep[BANK_CHUNK];
+  int idx[OSC_BANK_LANES];
+  int base, ff, vv;
+
+  bank_pad(bank);
+  for(base = 0; base < nframes; base += BANK_CHUNK) {
+    int n = MIN(BANK_CHUNK, nframes - base);
+    for(ff = 0; ff < n; ++ff) {
+      keep[ff] = 1.0f;
+    }
+
+    for(vv = 0; vv < bank->nvoices; vv += OSC_BANK_LANES) {
+      __m128i step = _mm_loadu_si128((__m128i*)&bank->step[vv]);
+      __m128i table = _mm_loadu_si128((__m128i*)&bank->table[vv]);
+      __m128i first = _mm_loadu_si128((__m128i*)&bank->first[vv]);
+      __m128i last = _mm_loadu_si128((__m128i*)&bank->last[vv]);
+      __m128 amp = _mm_loadu_ps(&bank->amp[vv]);
+      __m128i phase;
+      int ll;
+
+      /* advance to this chunk. sse2 has no 32 bit multiply */
+      for(ll = 0; ll < OSC_BANK_LANES; ++ll) {
+        idx[ll] = bank->phase[vv + ll] + bank->step[vv + ll] * base;
+      }
+      phase = _mm_loadu_si128((__m128i*)idx);
+
+      for(ff = 0; ff < n; ++ff) {
+        __m128i frame = _mm_set1_epi32(base + ff);
+        __m128i active = _mm_andnot_si128(_mm_cmplt_epi32(frame, first),
+                                          _mm_cmplt_epi32(frame, last));
+        __m128 frac = _mm_mul_ps(
+            _mm_cvtepi32_ps(_mm_and_si128(phase, frac_mask)), frac_scale);
+
+        _mm_storeu_si128((__m128i*)idx,
+                         _mm_add_epi32(table, _mm_srli_epi32(phase, FRAC_BITS)));
+        __m128 t0 = _mm_setr_ps(osc_tables[idx[0]], osc_tables[idx[1]],
+                                osc_tables[idx[2]], osc_tables[idx[3]]);
+        __m128 t1 = _mm_setr_ps(osc_tables[idx[0] + 1], osc_tables[idx[1] + 1],
+                                osc_tables[idx[2] + 1], osc_tables[idx[3] + 1]);
+
+        __m128 v = _mm_mul_ps(amp, _mm_add_ps(t0, _mm_mul_ps(frac, _mm_sub_ps(t1, t0))));
+        v = _mm_and_ps(v, _mm_castsi128_ps(active));
+
+        /* product of the four lanes' (1 - v) */
+        __m128 p = _mm_sub_ps(one, v);
+        p = _mm_mul_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 3, 0, 1)));
+        p = _mm_mul_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 0, 3, 2)));
+        keep[ff] *= _mm_cvtss_f32(p);
+
+        phase = _mm_add_epi32(phase, step);
+      }
+    }
+
+    bank_apply(&bus[base], keep, n);
+  }
+}
+
+#endif
+
+#ifdef CPU_BUILD_NEON
+
+static void bank_mix_neon(OscBank bank, float* bus, int nframes) {
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  float keep[BANK_CHUNK];
+  int idx[OSC_BANK_LANES];
+  float t0s[OSC_BANK_LANES], t1s[OSC_BANK_LANES];
+  int base, ff, vv, ll;
+
+  bank_pad(bank);
+  for(base = 0; base < nframes; base += BANK_CHUNK) {
+    int n = MIN(BANK_CHUNK, nframes - base);
+    for(ff = 0; ff < n; ++ff) {
+      keep[ff] = 1.0f;
+    }
+
+    for(vv = 0; vv < bank->nvoices; vv += OSC_BANK_LANES) {
+      uint32x4_t step = vld1q_u32(&bank->step[vv]);
+      uint32x4_t phase = vmlaq_n_u32(vld1q_u32(&bank->phase[vv]), step, base);
+      int32x4_t table = vld1q_s32(&bank->table[vv]);
+      int32x4_t first = vld1q_s32(&bank->first[vv]);
+      int32x4_t last = vld1q_s32(&bank->last[vv]);
+      float32x4_t amp = vld1q_f32(&bank->amp[vv]);
+
+      for(ff = 0; ff < n; ++ff) {
+        int32x4_t frame = vdupq_n_s32(base + ff);
+        uint32x4_t active = vandq_u32(vcgeq_s32(frame, first),
+                                      vcltq_s32(frame, last));
+        float32x4_t frac = vmulq_n_f32(
+            vcvtq_f32_u32(vandq_u32(phase, vdupq_n_u32(FRAC_MASK))), FRAC_SCALE);
+
+        vst1q_s32(idx, vaddq_s32(table, vreinterpretq_s32_u32(vshrq_n_u32(phase, FRAC_BITS))));
+        for(ll = 0; ll < OSC_BANK_LANES; ++ll) {
+          t0s[ll] = osc_tables[idx[ll]];
+          t1s[ll] = osc_tables[idx[ll] + 1];
+        }
+        float32x4_t t0 = vld1q_f32(t0s);
+        float32x4_t t1 = vld1q_f32(t1s);
+
+        float32x4_t v = vmulq_f32(amp, vmlaq_f32(t0, frac, vsubq_f32(t1, t0)));
+        v = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v), active));
+
+        float32x4_t p = vsubq_f32(one, v);
+        float32x2_t p2 = vmul_f32(vget_low_f32(p), vget_high_f32(p));
+        keep[ff] *= vget_lane_f32(p2, 0) * vget_lane_f32(p2, 1);
+
+        phase = vaddq_u32(phase, step);
+      }
+    }
+
+    bank_apply(&bus[base], keep, n);
+  }
+}
+
+#endif
+
+static void (* const bank_kernels[CPU_NUM_LEVELS])(OscBank, float*, int) = {
+  [CPU_SCALAR] = osc_bank_mix_scalar,
+#ifdef CPU_X86
+  [CPU_SSE2] = bank_mix_sse2,
+  [CPU_SSE41] = bank_mix_sse2,
+  [CPU_AVX2] = bank_mix_sse2,
+#endif
+#ifdef CPU_BUILD_NEON
+  [CPU_NEON] = bank_mix_neon,
+#endif
+};
+
+void osc_bank_mix(OscBank bank, float* bus, int nframes) {
+  bank_kernels[cpu_level()](bank, bus, nframes);
+}
@@ -0,0 +1,72 @@
+#ifndef OSC_H
+#define OSC_H
+
+#include <stdint.h>
+
+#include "sampler.h"
+
+/** Wavetable oscillators. Phase is a 32 bit fixed point fraction of a
+ * cycle that wraps for free, so the phase at any point of the sample
+ * clock is exact: phase at START plus increment times the offset, mod
+ * 2^32. The top OSC_TABLE_BITS select a table entry and the bits below
+ * interpolate linearly towards the next one.
+ */
+
+typedef enum {
+  OSC_SINE = 0,
+  OSC_SAW,
+  OSC_SQUARE,
+  OSC_TRIANGLE,
+  OSC_NUM_WAVEFORMS
+} OscWaveform;
+
+#define OSC_TABLE_BITS 11
+#define OSC_TABLE_SIZE (1 << OSC_TABLE_BITS)
+
+typedef struct OscSampler_ {
+  struct Sampler_ sampler;
+  uint32_t phase; /* at START */
+  uint32_t increment; /* per tick of the sample clock */
+  float amp; /* normalized */
+  int waveform;
+} *OscSampler;
+
+/* builds the tables. called by sampler_init */
+void osc_init();
+
+/* freq in hz, amp in int16 units, phase in cycles [0, 1) */
+Sampler oscsampler_make(OscWaveform waveform, int64_t start, int64_t duration,
+                        float freq, float amp, float phase);
+
+int sampler_is_osc(Sampler sampler);
+
+/** A bank holds oscillator voices in structure of arrays form so that
+ * OSC_BANK_LANES of them advance together, one per SIMD lane. Each
+ * lane only sounds within its [first, last) frames of the block.
+ */
+#define OSC_BANK_LANES 4
+#define OSC_BANK_MAX ((NUM_SAMPLERS + OSC_BANK_LANES - 1) & ~(OSC_BANK_LANES - 1))
+
+typedef struct OscBank_ {
+  int nvoices;
+  uint32_t phase[OSC_BANK_MAX]; /* at the first frame of the block */
+  uint32_t step[OSC_BANK_MAX]; /* per frame */
+  float amp[OSC_BANK_MAX];
+  int table[OSC_BANK_MAX]; /* offset of the waveform's table */
+  int first[OSC_BANK_MAX];
+  int last[OSC_BANK_MAX];
+} *OscBank;
+
+void osc_bank_clear(OscBank bank);
+
+/* add osc, playing frames [first, last) of a block whose first frame
+   is at sample clock block_start */
+void osc_bank_add(OscBank bank, OscSampler osc, int64_t block_start,
+                  int first, int last);
+
+/* mix every voice in the bank into bus the same way mixer_accumulate
+   does */
+void osc_bank_mix(OscBank bank, float* bus, int nframes);
+void osc_bank_mix_scalar(OscBank bank, float* bus, int nframes);
+
+#endif
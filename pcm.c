@@ -0,0 +1,315 @@
+#define _POSIX_C_SOURCE 200112L /* mmap under -std=c99 */
+
+#include "pcm.h"
+#include "memory.h"
+#include "resample.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+extern FixedAllocator sampler_allocator;
+void sampler_free(void* obj);
+
+/* wav is little endian whatever we're running on */
+static uint32_t read_u32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t read_u16(const unsigned char* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static PcmBuffer pcmbuffer_alloc(PcmFormat format, int channels,
+                                 int sample_freq, long nframes) {
+  PcmBuffer buffer = malloc(sizeof(struct PcmBuffer_));
+  buffer->refs = 1;
+  buffer->format = format;
+  buffer->channels = channels;
+  buffer->sample_freq = sample_freq;
+  buffer->nframes = nframes;
+  buffer->data = NULL;
+  buffer->mapping = NULL;
+  buffer->mapping_size = 0;
+  return buffer;
+}
+
+/* finds the fmt and data chunks of the RIFF file in bytes[0, size) */
+static PcmBuffer pcmbuffer_parse_wav(unsigned char* bytes, size_t size) {
+  unsigned char* data = NULL;
+  size_t pos = 12, data_bytes = 0;
+  int format = 0, channels = 0, bits = 0;
+  uint32_t sample_freq = 0;
+  PcmFormat pcm_format;
+
+  if(size < 12 || memcmp(bytes, "RIFF", 4) || memcmp(bytes + 8, "WAVE", 4)) {
+    return NULL;
+  }
+
+  while(pos + 8 <= size) {
+    unsigned char* chunk = bytes + pos + 8;
+    size_t len = read_u32(bytes + pos + 4);
+    len = MIN(len, size - pos - 8);
+
+    if(!memcmp(bytes + pos, "fmt ", 4) && len >= 16) {
+      format = read_u16(chunk);
+      channels = read_u16(chunk + 2);
+      sample_freq = read_u32(chunk + 4);
+      bits = read_u16(chunk + 14);
+      /* the real format is the start of the sub format guid */
+      if(format == WAV_FORMAT_EXTENSIBLE && len >= 26) {
+        format = read_u16(chunk + 24);
+      }
+    } else if(!memcmp(bytes + pos, "data", 4)) {
+      data = chunk;
+      data_bytes = len;
+    }
+
+    /* chunks are padded to an even length */
+    pos += 8 + len + (len & 1);
+  }
+
+  if(format == WAV_FORMAT_PCM && bits == 16) {
+    pcm_format = PCM_INT16;
+  } else if(format == WAV_FORMAT_FLOAT && bits == 32) {
+    pcm_format = PCM_FLOAT;
+  } else {
+    return NULL;
+  }
+  if(data == NULL || (channels != 1 && channels != 2)) return NULL;
+
+  PcmBuffer buffer = pcmbuffer_alloc(pcm_format, channels, sample_freq,
+                                     data_bytes / (channels * bits / 8));
+  buffer->data = data;
+  return buffer;
+}
+
+PcmBuffer pcmbuffer_open_wav(const char* path) {
+  struct stat st;
+  PcmBuffer buffer = NULL;
+  void* mapping;
+  int fd = open(path, O_RDONLY);
+
+  if(fd < 0) return NULL;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  /* the mapping keeps the file open by itself */
+  mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) return NULL;
+
+  buffer = pcmbuffer_parse_wav(mapping, st.st_size);
+  if(buffer == NULL) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+  buffer->mapping = mapping;
+  buffer->mapping_size = st.st_size;
+
+  /* an odd sized chunk ahead of the data can leave it misaligned. the
+     render loops need it aligned, so copy it out in that case */
+  if((uintptr_t)buffer->data % (buffer->format == PCM_FLOAT ? 4 : 2)) {
+    size_t bytes = buffer->nframes * buffer->channels
+      * (buffer->format == PCM_FLOAT ? 4 : 2);
+    void* copy = malloc(bytes);
+    memcpy(copy, buffer->data, bytes);
+    munmap(mapping, st.st_size);
+    buffer->data = copy;
+    buffer->mapping = NULL;
+    buffer->mapping_size = 0;
+  }
+  return buffer;
+}
+
+PcmBuffer pcmbuffer_make(long nframes) {
+  PcmBuffer buffer = pcmbuffer_alloc(PCM_FLOAT, 1, SAMPLE_FREQ, nframes);
+  buffer->data = calloc(nframes > 0 ? nframes : 1, sizeof(float));
+  return buffer;
+}
+
+void pcmbuffer_retain(PcmBuffer buffer) {
+  __atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+void pcmbuffer_release(PcmBuffer buffer) {
+  if(__atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+  if(buffer->mapping) {
+    munmap(buffer->mapping, buffer->mapping_size);
+  } else {
+    free(buffer->data);
+  }
+  free(buffer);
+}
+
+/* n frames from frame on, all inside the buffer. one loop per layout so
+   nothing is decided per sample */
+static void pcm_convert(PcmBuffer buffer, long frame, int n, float gain,
+                        float* out) {
+  int ii;
+
+  if(buffer->format == PCM_INT16) {
+    const int16_t* in = (const int16_t*)buffer->data + frame * buffer->channels;
+    float scale = gain / INT16_MAX;
+    if(buffer->channels == 1) {
+      for(ii = 0; ii < n; ++ii) {
+        out[ii] = in[ii] * scale;
+      }
+    } else {
+      scale *= 0.5f;
+      for(ii = 0; ii < n; ++ii) {
+        out[ii] = (in[2 * ii] + in[2 * ii + 1]) * scale;
+      }
+    }
+  } else {
+    const float* in = (const float*)buffer->data + frame * buffer->channels;
+    if(buffer->channels == 1) {
+      for(ii = 0; ii < n; ++ii) {
+        out[ii] = in[ii] * gain;
+      }
+    } else {
+      float scale = gain * 0.5f;
+      for(ii = 0; ii < n; ++ii) {
+        out[ii] = (in[2 * ii] + in[2 * ii + 1]) * scale;
+      }
+    }
+  }
+}
+
+/* n frames of the buffer from frame on, wrapping if the voice loops
+   and silent wherever there's no buffer */
+static void pcm_read(PcmSampler pcm, long frame, int n, float* out) {
+  long nframes = pcm->buffer->nframes;
+  int ii = 0;
+
+  /* in runs up to the end of the buffer */
+  while(ii < n) {
+    int run;
+    if(frame < 0) {
+      run = MIN(n - ii, -frame);
+      memset(&out[ii], 0, run * sizeof(float));
+    } else {
+      if(pcm->loop && nframes > 0) frame %= nframes;
+      if(frame >= nframes) break;
+      run = MIN(n - ii, nframes - frame);
+      pcm_convert(pcm->buffer, frame, run, pcm->gain, &out[ii]);
+    }
+    ii += run;
+    frame += run;
+  }
+
+  for(; ii < n; ++ii) {
+    out[ii] = 0.0f;
+  }
+}
+
+/* where in the buffer the voice is at sample, in whole frames and a
+   32 bit fraction. exact for the first 2^32 frames */
+static void pcm_position(PcmSampler pcm, int64_t sample, long* whole,
+                         uint32_t* frac) {
+  uint64_t frames = (sample - START(pcm)) / NUM_CHANNELS;
+  uint64_t low = frames * (pcm->step & 0xffffffffu);
+  *whole = pcm->offset + frames * (pcm->step >> 32) + (low >> 32);
+  *frac = (uint32_t)low;
+}
+
+/* output frames converted per pass, which bounds the scratch needed */
+#define CONVERT_CHUNK 64
+
+/* a polyphase windowed sinc over a window of the buffer for every
+   chunk. the phase is the top bits of the fraction */
+static void pcm_render_converted(PcmSampler pcm, int64_t start, int n,
+                                 float* out) {
+  float window[CONVERT_CHUNK * RESAMPLE_VOICE_MAX_STEP + RESAMPLE_TAPS + 1];
+  const float* coeffs = pcm->kernel->coeffs;
+  uint64_t step = pcm->step;
+  uint64_t position;
+  uint32_t frac;
+  long whole;
+  int done = 0, ii;
+
+  pcm_position(pcm, start, &whole, &frac);
+  while(done < n) {
+    int chunk = MIN(n - done, CONVERT_CHUNK);
+    uint64_t span = ((frac + (chunk - 1) * step) >> 32) + RESAMPLE_TAPS;
+    pcm_read(pcm, whole - RESAMPLE_TAPS / 2 + 1, span, window);
+
+    for(ii = 0, position = frac; ii < chunk; ++ii, position += step) {
+      uint32_t phase = (uint32_t)position >> (32 - RESAMPLE_VOICE_PHASE_BITS);
+      out[done + ii] = resample_dot(&coeffs[phase * RESAMPLE_TAPS],
+                                    &window[position >> 32]);
+    }
+
+    whole += position >> 32;
+    frac = (uint32_t)position;
+    done += chunk;
+  }
+}
+
+static void pcm_render(PcmSampler pcm, int64_t start, int n, float* out) {
+  if(pcm->kernel) {
+    pcm_render_converted(pcm, start, n, out);
+  } else {
+    /* at the mix rate the frames go straight through */
+    pcm_read(pcm, pcm->offset + (start - START(pcm)) / NUM_CHANNELS, n, out);
+  }
+}
+
+static int16_t pcm_sample(PcmSampler pcm, int64_t sample) {
+  float value;
+  pcm_render(pcm, sample, 1, &value);
+
+  value *= INT16_MAX;
+  if(value >= INT16_MAX) return INT16_MAX;
+  if(value <= INT16_MIN) return INT16_MIN;
+  return (int16_t)value;
+}
+
+static void pcm_release(PcmSampler pcm) {
+  pcmbuffer_release(pcm->buffer);
+  sampler_free(pcm);
+}
+
+Sampler pcmsampler_make(PcmBuffer buffer, int64_t start, int64_t duration,
+                        float gain, long offset, int loop) {
+  PcmSampler pcm = (PcmSampler)fixed_allocator_try_alloc(sampler_allocator);
+  double step = (double)buffer->sample_freq / SAMPLE_FREQ;
+  int64_t remaining;
+
+  if(!pcm) return sampler_silence();
+  step = MIN(MAX(step, 1.0 / 256), RESAMPLE_VOICE_MAX_STEP);
+  remaining = (int64_t)ceil((buffer->nframes - offset) / step) * NUM_CHANNELS;
+
+  if(!loop && (duration <= 0 || duration > remaining)) {
+    duration = remaining > 0 ? remaining : 0;
+  }
+
+  pcm->sampler.function = (SamplerFunction)pcm_sample;
+  pcm->sampler.render = (SamplerRender)pcm_render;
+  pcm->sampler.release = (ReleaseSampler)pcm_release;
+  pcm->sampler.start_sample = start;
+  pcm->sampler.duration_samples = duration;
+
+  pcmbuffer_retain(buffer);
+  pcm->buffer = buffer;
+  pcm->offset = offset;
+  pcm->loop = loop;
+  pcm->gain = gain;
+  pcm->step = (uint64_t)(step * 4294967296.0);
+  pcm->kernel = buffer->sample_freq == SAMPLE_FREQ
+    ? NULL : resample_voice_kernel(step);
+
+  return (Sampler)pcm;
+}
@@ -0,0 +1,62 @@
+#ifndef PCM_H
+#define PCM_H
+
+#include <stddef.h>
+
+#include "sampler.h"
+
+/** Recorded or pre-rendered sound. A PcmBuffer holds interleaved int16
+ * or float frames, mono or stereo, either in a WAV file mapped into
+ * memory or in memory of its own. Stereo is folded to mono as it
+ * plays since the mix is mono. Buffers are reference counted: every
+ * voice playing one holds a reference, so the owner can release it
+ * whenever it likes.
+ */
+
+typedef enum {
+  PCM_INT16 = 0,
+  PCM_FLOAT
+} PcmFormat;
+
+typedef struct PcmBuffer_ {
+  int refs; /* changed atomically */
+  PcmFormat format;
+  int channels; /* 1 or 2 */
+  int sample_freq; /* of the data. voices convert it to SAMPLE_FREQ */
+  long nframes;
+  void* data;
+  void* mapping; /* the whole file, if data points into one */
+  size_t mapping_size;
+} *PcmBuffer;
+
+/* 16 bit integer or 32 bit float PCM, mono or stereo. NULL if the file
+   can't be read or holds anything else */
+PcmBuffer pcmbuffer_open_wav(const char* path);
+
+/* nframes of mono float at SAMPLE_FREQ for the caller to fill through
+   data, zeroed */
+PcmBuffer pcmbuffer_make(long nframes);
+
+void pcmbuffer_retain(PcmBuffer buffer);
+void pcmbuffer_release(PcmBuffer buffer);
+
+typedef struct PcmSampler_ {
+  struct Sampler_ sampler;
+  PcmBuffer buffer;
+  long offset; /* frame of the buffer heard at START */
+  int loop;
+  float gain;
+  uint64_t step; /* buffer frames per frame played, 32.32 fixed point */
+  struct ResampleKernel_* kernel; /* NULL when the buffer is at SAMPLE_FREQ */
+} *PcmSampler;
+
+/* play buffer from frame offset, scaled by gain. a buffer at another
+   rate is converted as it plays, up to RESAMPLE_VOICE_MAX_STEP times
+   SAMPLE_FREQ. a looping voice wraps
+   back to the first frame of the buffer and plays for duration.
+   otherwise it stops at the end of the buffer, or after duration if
+   that's sooner and more than 0 */
+Sampler pcmsampler_make(PcmBuffer buffer, int64_t start, int64_t duration,
+                        float gain, long offset, int loop);
+
+#endif
@@ -0,0 +1,243 @@
+#include "resample.h"
+#include "cpu.h"
+#include "memory.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#ifdef CPU_BUILD_NEON
+#include <arm_neon.h>
+#endif
+
+#ifndef M_PI /* strict c99 headers leave it out */
+#define M_PI 3.14159265358979323846
+#endif
+
+#define HALF (RESAMPLE_TAPS / 2)
+
+/* passband edge as a fraction of the lower of the two nyquists. the
+   window's transition band straddles it */
+#define CUTOFF 0.45
+
+static double sinc(double x) {
+  return x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+/* blackman over [-1, 1] */
+static double window(double u) {
+  return 0.42 + 0.5 * cos(M_PI * u) + 0.08 * cos(2 * M_PI * u);
+}
+
+void resample_kernel_init(ResampleKernel kernel, int nphases, double cutoff) {
+  int pp, kk;
+
+  kernel->nphases = nphases;
+  kernel->coeffs = malloc(nphases * RESAMPLE_TAPS * sizeof(float));
+  for(pp = 0; pp < nphases; ++pp) {
+    float* phase = &kernel->coeffs[pp * RESAMPLE_TAPS];
+    double x = (double)pp / nphases;
+    double h[RESAMPLE_TAPS];
+    double sum = 0;
+
+    for(kk = 0; kk < RESAMPLE_TAPS; ++kk) {
+      /* from the output to this tap's input, in input frames */
+      double t = kk - HALF + 1 - x;
+      h[kk] = 2 * cutoff * sinc(2 * cutoff * t) * window(t / HALF);
+      sum += h[kk];
+    }
+    /* unity gain at dc whatever the phase */
+    for(kk = 0; kk < RESAMPLE_TAPS; ++kk) {
+      phase[kk] = h[kk] / sum;
+    }
+  }
+}
+
+float resample_dot_scalar(const float* coeffs, const float* x) {
+  float sum = 0.0f;
+  int ii;
+  for(ii = 0; ii < RESAMPLE_TAPS; ++ii) {
+    sum += coeffs[ii] * x[ii];
+  }
+  return sum;
+}
+
+#ifdef CPU_X86
+
+CPU_TARGET_SSE2
+static float dot_sse2(const float* coeffs, const float* x) {
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  int ii;
+  for(ii = 0; ii < RESAMPLE_TAPS; ii += 8) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(&coeffs[ii]),
+                                   _mm_loadu_ps(&x[ii])));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(&coeffs[ii + 4]),
+                                   _mm_loadu_ps(&x[ii + 4])));
+  }
+  s0 = _mm_add_ps(s0, s1);
+  s0 = _mm_add_ps(s0, _mm_shuffle_ps(s0, s0, _MM_SHUFFLE(1, 0, 3, 2)));
+  s0 = _mm_add_ps(s0, _mm_shuffle_ps(s0, s0, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtss_f32(s0);
+}
+
+/* each lane sums the same products as the sse2 lane it stands for and
+   the halves are added the same way, so the result is identical */
+CPU_TARGET_AVX2
+static float dot_avx2(const float* coeffs, const float* x) {
+  __m256 s = _mm256_setzero_ps();
+  __m128 s0;
+  int ii;
+  for(ii = 0; ii < RESAMPLE_TAPS; ii += 8) {
+    s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(&coeffs[ii]),
+                                       _mm256_loadu_ps(&x[ii])));
+  }
+  s0 = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+  s0 = _mm_add_ps(s0, _mm_shuffle_ps(s0, s0, _MM_SHUFFLE(1, 0, 3, 2)));
+  s0 = _mm_add_ps(s0, _mm_shuffle_ps(s0, s0, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtss_f32(s0);
+}
+
+#endif
+
+#ifdef CPU_BUILD_NEON
+
+static float dot_neon(const float* coeffs, const float* x) {
+  float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+  int ii;
+  for(ii = 0; ii < RESAMPLE_TAPS; ii += 8) {
+    s0 = vmlaq_f32(s0, vld1q_f32(&coeffs[ii]), vld1q_f32(&x[ii]));
+    s1 = vmlaq_f32(s1, vld1q_f32(&coeffs[ii + 4]), vld1q_f32(&x[ii + 4]));
+  }
+  s0 = vaddq_f32(s0, s1);
+  float32x2_t s = vadd_f32(vget_low_f32(s0), vget_high_f32(s0));
+  return vget_lane_f32(s, 0) + vget_lane_f32(s, 1);
+}
+
+#endif
+
+static float (* const dot_kernels[CPU_NUM_LEVELS])(const float*, const float*) = {
+  [CPU_SCALAR] = resample_dot_scalar,
+#ifdef CPU_X86
+  [CPU_SSE2] = dot_sse2,
+  [CPU_SSE41] = dot_sse2,
+  [CPU_AVX2] = dot_avx2,
+#endif
+#ifdef CPU_BUILD_NEON
+  [CPU_NEON] = dot_neon,
+#endif
+};
+
+float resample_dot(const float* coeffs, const float* x) {
+  return dot_kernels[cpu_level()](coeffs, x);
+}
+
+static int gcd(int a, int b) {
+  while(b != 0) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+Resampler resampler_make(int in_rate, int out_rate) {
+  Resampler resampler = malloc(sizeof(struct Resampler_));
+  int g = gcd(in_rate, out_rate);
+  double ratio = (double)out_rate / in_rate;
+
+  resampler->in_rate = in_rate;
+  resampler->out_rate = out_rate;
+  resampler->up = out_rate / g;
+  resampler->down = in_rate / g;
+
+  /* going down, the filter has to take out what the new rate can't
+     hold */
+  resample_kernel_init(&resampler->kernel,
+                       MIN(resampler->up, RESAMPLE_MAX_PHASES),
+                       CUTOFF * (ratio < 1 ? ratio : 1));
+
+  /* the history starts as silence up to the first input frame, which
+     is where the first output is. a chunk can need every frame from
+     HALF - 1 behind its first output to HALF past its last */
+  resampler->capacity = RESAMPLE_TAPS + 2
+    + (int)((int64_t)RESAMPLE_CHUNK * resampler->down / resampler->up);
+  resampler->history = calloc(resampler->capacity, sizeof(float));
+  resampler->position = HALF - 1;
+  resampler->frac = 0;
+  resampler->nhistory = HALF - 1;
+  return resampler;
+}
+
+void resampler_free(Resampler resampler) {
+  free(resampler->kernel.coeffs);
+  free(resampler->history);
+  free(resampler);
+}
+
+int resampler_input_frames(Resampler resampler, int nout) {
+  int64_t last, need;
+  if(nout <= 0) return 0;
+
+  last = resampler->position
+    + ((int64_t)resampler->frac + (int64_t)(nout - 1) * resampler->down)
+      / resampler->up;
+  need = last + HALF + 1 - resampler->nhistory;
+  return need > 0 ? need : 0;
+}
+
+float* resampler_input(Resampler resampler, int nframes) {
+  float* at = &resampler->history[resampler->nhistory];
+  resampler->nhistory += nframes;
+  return at;
+}
+
+void resampler_output(Resampler resampler, float* out, int nout) {
+  const float* coeffs = resampler->kernel.coeffs;
+  int nphases = resampler->kernel.nphases;
+  int up = resampler->up, down = resampler->down;
+  int position = resampler->position, frac = resampler->frac;
+  int ii, drop;
+
+  for(ii = 0; ii < nout; ++ii) {
+    int phase = nphases == up ? frac : (int)((int64_t)frac * nphases / up);
+    out[ii] = resample_dot(&coeffs[phase * RESAMPLE_TAPS],
+                           &resampler->history[position - HALF + 1]);
+    frac += down;
+    position += frac / up;
+    frac %= up;
+  }
+
+  /* keep only what the next output's taps reach back to */
+  drop = position - (HALF - 1);
+  if(drop > 0) {
+    memmove(resampler->history, &resampler->history[drop],
+            (resampler->nhistory - drop) * sizeof(float));
+    resampler->nhistory -= drop;
+    position -= drop;
+  }
+  resampler->position = position;
+  resampler->frac = frac;
+}
+
+/* one kernel per octave of step, each cut off for the fastest step it
+   serves */
+#define NUM_VOICE_KERNELS 3
+static struct ResampleKernel_ voice_kernels[NUM_VOICE_KERNELS];
+
+void resample_init() {
+  int ii;
+  if(voice_kernels[0].coeffs) return;
+  for(ii = 0; ii < NUM_VOICE_KERNELS; ++ii) {
+    resample_kernel_init(&voice_kernels[ii], 1 << RESAMPLE_VOICE_PHASE_BITS,
+                         CUTOFF / (1 << ii));
+  }
+}
+
+ResampleKernel resample_voice_kernel(double step) {
+  if(step <= 1) return &voice_kernels[0];
+  if(step <= 2) return &voice_kernels[1];
+  return &voice_kernels[2];
+}
@@ -0,0 +1,77 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+
+/** Windowed sinc sample rate conversion. A kernel holds the filter
+ * split into phases: phase p of nphases holds the RESAMPLE_TAPS
+ * weights that produce an output p / nphases of the way from one input
+ * frame to the next. Output frame x between inputs i and i + 1 is the
+ * dot product of its phase with inputs i - RESAMPLE_TAPS/2 + 1 through
+ * i + RESAMPLE_TAPS/2.
+ */
+
+#define RESAMPLE_TAPS 32
+#define RESAMPLE_MAX_PHASES 1024
+
+/* most frames resampler_output makes at a time */
+#define RESAMPLE_CHUNK 256
+
+typedef struct ResampleKernel_ {
+  int nphases;
+  float* coeffs; /* RESAMPLE_TAPS per phase */
+} *ResampleKernel;
+
+/* cutoff in cycles per input frame. each phase sums to 1 */
+void resample_kernel_init(ResampleKernel kernel, int nphases, double cutoff);
+
+/* sum of RESAMPLE_TAPS products of coeffs and x */
+float resample_dot(const float* coeffs, const float* x);
+float resample_dot_scalar(const float* coeffs, const float* x);
+
+/** A stream of mono frames converted from in_rate to out_rate. With
+ * up/down the ratio in lowest terms, each output advances the input
+ * by down/up frames, kept exactly as a whole frame and a remainder in
+ * 1/up so the two clocks never drift. There are exactly up phases
+ * unless that's more than RESAMPLE_MAX_PHASES, in which case the
+ * nearest of those is used. The first output lines up with the first
+ * input frame, but every output needs RESAMPLE_TAPS/2 input frames past
+ * it before it can be made.
+ */
+typedef struct Resampler_ {
+  int in_rate;
+  int out_rate;
+  int up;
+  int down;
+  struct ResampleKernel_ kernel;
+  int position; /* in history, the input frame at or before the next output */
+  int frac; /* how far past position, in 1/up */
+  int nhistory;
+  int capacity;
+  float* history;
+} *Resampler;
+
+Resampler resampler_make(int in_rate, int out_rate);
+void resampler_free(Resampler resampler);
+
+/* input frames still to be written before nout more frames can be
+   made */
+int resampler_input_frames(Resampler resampler, int nout);
+
+/* where to write nframes of input, at most what's needed for
+   RESAMPLE_CHUNK frames of output */
+float* resampler_input(Resampler resampler, int nframes);
+
+/* make nout frames, at most RESAMPLE_CHUNK, from input that must
+   already be there */
+void resampler_output(Resampler resampler, float* out, int nout);
+
+/* the shared kernels for converting PcmSampler voices, which play at
+   step buffer frames per output frame. built by resample_init */
+#define RESAMPLE_VOICE_PHASE_BITS 8
+#define RESAMPLE_VOICE_MAX_STEP 4
+
+void resample_init();
+ResampleKernel resample_voice_kernel(double step);
+
+#endif
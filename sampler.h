@@ -1,5 +1,5 @@
 #ifndef SAMPLER_H
-#define SAMPLER
+#define SAMPLER_H
 
 #include <stdint.h>
 
@@ -13,66 +13,53 @@
 #define A_(n) N_(n, 440.0)
 #define B_(n) N_(n, 493.9)
 
+/* the rate everything is mixed at. the device can run at another,
+   see audio_set_device_rate */
+#ifndef SAMPLE_FREQ
 #define SAMPLE_FREQ 22050
+#endif
+#define NUM_CHANNELS 2
 #define NUM_SAMPLERS 128
 #define SAMPLE(f, x) (((Sampler)(f))->function(f, x))
+#define RENDER(f, x, n, out) (((Sampler)(f))->render(f, x, n, out))
 #define RELEASE_SAMPLER(f) (((Sampler)(f))->release(f))
 
 #define array_size(a) (sizeof(a)/sizeof(a[0]))
 
-typedef int16_t (*SamplerFunction)(void*, long);
+/* the sample clock counts int16 samples, NUM_CHANNELS per frame. it's
+   64 bits everywhere so it never wraps, even where long is 32 */
+typedef int16_t (*SamplerFunction)(void*, int64_t);
+/* fill out[0..n) with the sampler's value at sample clock start +
+   ii * NUM_CHANNELS, normalized to [-1, 1] */
+typedef void (*SamplerRender)(void*, int64_t start, int n, float* out);
 typedef void (*ReleaseSampler)(void*);
 
 void sampler_init();
 
 typedef struct Sampler_ {
   SamplerFunction function;
+  SamplerRender render;
   ReleaseSampler release;
-  long start_sample;
-  long duration_samples;
+  int64_t start_sample;
+  int64_t duration_samples;
 } *Sampler;
 
-typedef struct SinSampler_ {
-  struct Sampler_ sampler;
-  float phase; /* radians */
-  float radians_per_sample;
-  float amp;
-} *SinSampler;
+/* what the makers hand out when every sampler is taken, so running
+   out of voices loses a sound rather than the game. it plays nothing,
+   lasts no time and releasing it does nothing */
+Sampler sampler_silence();
 
-Sampler sinsampler_make(long start, long duration, 
+Sampler sinsampler_make(int64_t start, int64_t duration,
                         float freq, float amp, float phase);
-
-typedef struct SawSampler_ {
-  struct Sampler_ sampler;
-  long samples_per_period;
-  long phase_samples;
-  float slope;
-  float amp;
-} *SawSampler;
-
-Sampler sawsampler_make(long start, long duration,
+Sampler sawsampler_make(int64_t start, int64_t duration,
                         float freq, float amp, float phase);
+Sampler squaresampler_make(int64_t start, int64_t duration,
+                           float freq, float amp, float phase);
+Sampler trianglesampler_make(int64_t start, int64_t duration,
+                             float freq, float amp, float phase);
 
 #define DURATION(f) (((Sampler)f)->duration_samples)
 #define START(f) (((Sampler)f)->start_sample)
 #define END(f) (START(f) + DURATION(f))
 
-typedef struct Filter_ {
-  int na;
-  int nb;
-  int xi;
-  float yi;
-
-  float *as;
-  float *bs;
-  int16_t *xs;
-  int16_t *ys;
-} *Filter;
-
-Filter filter_make(float* as, int na, float* bs, int nb);
-
-int16_t filter_value(Filter filter, int16_t value);
-
-Filter lowpass_make(float cutoff, float sample_freq);
-
 #endif
@@ -181,7 +181,8 @@
                                        *enemy-bullet-speed*)
                          *enemy-bullets*))
              (set! next-shot (+ (clock-time *game-clock*) shot-period))
-             (audio-enqueue (tone-make 600 (/ *base-volume* 2.) 0.05))))
+             (audio-enqueue-bus (tone-sound 600 (/ *base-volume* 2.) 0.05)
+                                *sfx-bus*)))
        (game-particle-integrate gp dt)))))
 
 (define (spawn-enemies n)
@@ -287,7 +288,7 @@
 
   (set! *player* (spawn-player))
   (set! *enemies* (spawn-enemies *initial-enemies*))
-  (thread-start! (make-thread music)))
+  (music))
 
 (define (integrate-game-particle gp dt)
   (let ((extra (game-particle-extra gp)))
@@ -333,12 +334,22 @@
           (spatial-make (* *screen-width* *spatial-scale-factor*))
           gs))
 
-(define (tone-make freq amp duration)
-  (sinsampler-make (audio-current-sample) (seconds->samples duration)
-                   freq amp 0))
+;; one voice playing the effect key stands for, rendered on first use
+(define (cached-sound key make-samplers)
+  (pcmsampler-make (sfx-cached key make-samplers)
+                   (audio-schedule-sample) 0 1))
+
+(define (tone-sound freq amp duration)
+  (cached-sound (list 'tone freq amp duration)
+                (lambda (start)
+                  (list (sinsampler-make start (seconds->samples duration)
+                                         freq amp 0)))))
 
 (define (explosion-sound duration)
-  (saw-samplers *base-volume* '(100 40) duration))
+  (cached-sound (list 'explosion duration)
+                (lambda (start)
+                  (saw-samplers *base-volume* '(100 40) duration
+                                start: start))))
 
 (define (handle-collisions)
   (if (or (null? *player-bullets*)
@@ -363,7 +374,7 @@
 
        (lambda (player bullet)
          (set! *enemy-bullets* (delete bullet *enemy-bullets*))
-         (enqueue-all (explosion-sound 0.15))
+         (audio-enqueue-bus (explosion-sound 0.15) *sfx-bus*)
          (add-pretty-particles! (spawn-hulk-particle
                                  player
                                  "hero.png"))))))
@@ -442,7 +453,8 @@
 
 (define (disable-game)
   (set! update-view (lambda (dt input) '()))
-  (set! music (lambda () '())))
+  (set! music (lambda () '()))
+  (sequencer-stop! *music-sequencer*))
 
 (define (enqueue-all samplers)
   (for-each audio-enqueue samplers))
@@ -459,10 +471,10 @@
          sampler))
      freqs)))
 
-(define (sin-samplers amp freqs duration #!key (mix #t) (start (audio-current-sample)))
+(define (sin-samplers amp freqs duration #!key (mix #t) (start (audio-schedule-sample)))
   (samplers sinsampler-make amp freqs duration mix start))
 
-(define (saw-samplers amp freqs duration #!key (mix #t) (start (audio-current-sample)))
+(define (saw-samplers amp freqs duration #!key (mix #t) (start (audio-schedule-sample)))
   (samplers sawsampler-make amp freqs duration mix start))
 
 (define +c+ 261.6)
@@ -542,23 +554,25 @@
          (thread-sleep! duration))
        freqs)))))
 
-(define +last-silent-sample+ #f)
+;; songs are written with play, which appends a chord to the song
+;; being recorded. the sequencer plays the whole thing from C, so
+;; nothing here has to keep time
+(define +song+ '())
+(define +song-end+ 0)
+
 (define (play freqs duration)
-  (if (not +last-silent-sample+) (set! +last-silent-sample+ (audio-current-sample)))
-  (if (and (> +last-silent-sample+ 0)
-           (< (audio-current-sample) 0))
-      ;; this is an integer wraparound situation. we'll get an audio mishap
-      (set! +last-silent-sample+ (audio-current-sample)))
-
-  ;; wait till the next silence is two durations
-  (let loop ((delta (- +last-silent-sample+ (audio-current-sample))))
-    (if (> delta (seconds->samples 10))
-        (begin
-          (thread-sleep! 0.1)
-          (loop (- +last-silent-sample+ (audio-current-sample))))))
-
-  (enqueue-all (sin-samplers 1000 freqs duration start: +last-silent-sample+))
-  (set! +last-silent-sample+ (+ +last-silent-sample+ (seconds->samples duration))))
+  (for-each (lambda (freq)
+              (set! +song+ (cons (list +song-end+ duration freq 1000 *osc-sine*)
+                                 +song+)))
+            freqs)
+  (set! +song-end+ (+ +song-end+ duration)))
+
+;; the notes thunk plays and the length of the song
+(define (record-song thunk)
+  (set! +song+ '())
+  (set! +song-end+ 0)
+  (thunk)
+  (values (reverse +song+) +song-end+))
 
 (define (bpm->seconds n notes-per-beat)
   (/ n (* notes-per-beat 60.)))
@@ -594,15 +608,19 @@
     (play (list (* 1/3 base) (* 1 base)) (/ duration 2.))))
 
 (define (music)
-  (progression 100.)
-  (progression 150.)
-  (progression 75.)
-  (progression 50.)
-  (music))
+  (call-with-values
+      (lambda ()
+        (record-song (lambda ()
+                       (progression 100.)
+                       (progression 150.)
+                       (progression 75.)
+                       (progression 50.))))
+    (lambda (notes length)
+      (sequencer-play! *music-sequencer* notes loop: length))))
 
 #|
-(define (music) '())
-(thread-start! (make-thread music))
+(sequencer-stop! *music-sequencer*)
+(music)
 |#
 
 ;;; examples
@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime under -std=c99 */
+
+#include "sequencer.h"
+#include "audio.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/* the thread never sleeps less than this, however short the lookahead */
+#define SEQUENCER_MIN_WAIT_NS 1000000L
+
+static int note_before(const void* a, const void* b) {
+  int64_t ta = ((const struct SequencerNote_*)a)->time;
+  int64_t tb = ((const struct SequencerNote_*)b)->time;
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* enqueue everything up to the horizon, starting over at the end of
+   the song if it loops. with the mutex held */
+static void sequencer_schedule(Sequencer seq) {
+  int64_t horizon;
+
+  /* a sequencer made before audio_init has no clock to read yet */
+  if(!seq->playing) return;
+  horizon = audio_schedule_sample() + seq->lookahead;
+
+  while(seq->playing) {
+    SequencerNote note;
+    int64_t at;
+
+    if(seq->next == seq->nnotes) {
+      if(seq->length <= 0 || seq->nnotes == 0) {
+        seq->playing = 0;
+        break;
+      }
+      seq->next = 0;
+      seq->origin += seq->length;
+    }
+
+    note = &seq->notes[seq->next];
+    at = seq->origin + note->time;
+    if(at >= horizon) break;
+
+    audio_enqueue_bus(oscsampler_make(note->waveform, at, note->duration,
+                                      note->freq, note->amp, 0),
+                      seq->bus);
+    seq->next += 1;
+    seq->voices += 1;
+  }
+}
+
+/* a quarter of the lookahead from now, on the clock cond waits use */
+static void sequencer_deadline(Sequencer seq, struct timespec* ts) {
+  long ns = (long)(seq->lookahead * 1e9 / (4.0 * NUM_CHANNELS * SAMPLE_FREQ));
+  if(ns < SEQUENCER_MIN_WAIT_NS) ns = SEQUENCER_MIN_WAIT_NS;
+
+  clock_gettime(CLOCK_REALTIME, ts);
+  ts->tv_sec += ns / 1000000000L;
+  ts->tv_nsec += ns % 1000000000L;
+  if(ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec += 1;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+static void* sequencer_exec(void* data) {
+  Sequencer seq = data;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&seq->mutex);
+  while(!seq->quit) {
+    sequencer_schedule(seq);
+    sequencer_deadline(seq, &deadline);
+    pthread_cond_timedwait(&seq->wake, &seq->mutex, &deadline);
+  }
+  pthread_mutex_unlock(&seq->mutex);
+  return NULL;
+}
+
+Sequencer sequencer_make(int64_t lookahead) {
+  Sequencer seq = malloc(sizeof(struct Sequencer_));
+  pthread_mutex_init(&seq->mutex, NULL);
+  pthread_cond_init(&seq->wake, NULL);
+  seq->notes = NULL;
+  seq->nnotes = 0;
+  seq->next = 0;
+  seq->origin = 0;
+  seq->length = 0;
+  seq->lookahead = lookahead;
+  seq->bus = 0;
+  seq->playing = 0;
+  seq->quit = 0;
+  seq->voices = 0;
+  pthread_create(&seq->thread, NULL, sequencer_exec, seq);
+  return seq;
+}
+
+void sequencer_free(Sequencer seq) {
+  pthread_mutex_lock(&seq->mutex);
+  seq->quit = 1;
+  pthread_cond_signal(&seq->wake);
+  pthread_mutex_unlock(&seq->mutex);
+  pthread_join(seq->thread, NULL);
+
+  pthread_cond_destroy(&seq->wake);
+  pthread_mutex_destroy(&seq->mutex);
+  free(seq->notes);
+  free(seq);
+}
+
+void sequencer_play(Sequencer seq, const double* notes, int nnotes,
+                    int64_t start, int64_t length) {
+  /* converted and sorted before taking the lock so the thread is
+     never held up by it */
+  struct SequencerNote_* copy
+    = malloc((nnotes > 0 ? nnotes : 1) * sizeof(struct SequencerNote_));
+  int ii;
+
+  for(ii = 0; ii < nnotes; ++ii) {
+    const double* fields = &notes[ii * SEQUENCER_NOTE_FIELDS];
+    int waveform = (int)fields[4];
+    copy[ii].time = (int64_t)fields[0];
+    copy[ii].duration = (int64_t)fields[1];
+    copy[ii].freq = fields[2];
+    copy[ii].amp = fields[3];
+    copy[ii].waveform = waveform >= 0 && waveform < OSC_NUM_WAVEFORMS
+      ? waveform : OSC_SINE;
+  }
+  qsort(copy, nnotes, sizeof(struct SequencerNote_), note_before);
+
+  pthread_mutex_lock(&seq->mutex);
+  free(seq->notes);
+  seq->notes = copy;
+  seq->nnotes = nnotes;
+  seq->next = 0;
+  seq->origin = start;
+  seq->length = length;
+  seq->playing = 1;
+  pthread_cond_signal(&seq->wake);
+  pthread_mutex_unlock(&seq->mutex);
+}
+
+void sequencer_stop(Sequencer seq) {
+  pthread_mutex_lock(&seq->mutex);
+  seq->playing = 0;
+  pthread_mutex_unlock(&seq->mutex);
+}
+
+void sequencer_set_lookahead(Sequencer seq, int64_t lookahead) {
+  pthread_mutex_lock(&seq->mutex);
+  seq->lookahead = lookahead;
+  pthread_cond_signal(&seq->wake);
+  pthread_mutex_unlock(&seq->mutex);
+}
+
+void sequencer_set_bus(Sequencer seq, int bus) {
+  pthread_mutex_lock(&seq->mutex);
+  seq->bus = bus;
+  pthread_mutex_unlock(&seq->mutex);
+}
+
+int sequencer_playing(Sequencer seq) {
+  int playing;
+  pthread_mutex_lock(&seq->mutex);
+  playing = seq->playing;
+  pthread_mutex_unlock(&seq->mutex);
+  return playing;
+}
+
+long sequencer_voices(Sequencer seq) {
+  long voices;
+  pthread_mutex_lock(&seq->mutex);
+  voices = seq->voices;
+  pthread_mutex_unlock(&seq->mutex);
+  return voices;
+}
@@ -0,0 +1,63 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "osc.h"
+
+/** A song of oscillator notes played by a thread of its own. Whenever
+ * it wakes, which is four times per lookahead, it enqueues every note
+ * that starts before audio_schedule_sample() plus the lookahead. Notes
+ * are placed on the sample clock exactly, so how late the thread wakes
+ * only matters if it's later than the lookahead.
+ */
+
+/* a song is handed over as a flat array of doubles, this many per
+   note: start in ticks from the start of the song, duration in ticks,
+   freq in hz, amp in int16 units and the OscWaveform */
+#define SEQUENCER_NOTE_FIELDS 5
+
+typedef struct SequencerNote_ {
+  int64_t time;
+  int64_t duration;
+  float freq;
+  float amp;
+  int waveform;
+} *SequencerNote;
+
+typedef struct Sequencer_ {
+  pthread_t thread;
+  pthread_mutex_t mutex; /* over everything below */
+  pthread_cond_t wake;
+  struct SequencerNote_* notes; /* sorted on time */
+  int nnotes;
+  int next; /* the first note not enqueued yet */
+  int64_t origin; /* the sample clock at time 0 of this pass */
+  int64_t length; /* it starts over every length ticks, never at 0 */
+  int64_t lookahead;
+  int bus; /* what the voices are enqueued to */
+  int playing;
+  int quit;
+  long voices; /* enqueued since it was made */
+} *Sequencer;
+
+/* starts the thread. lookahead in ticks of the sample clock */
+Sequencer sequencer_make(int64_t lookahead);
+/* stops the thread. voices it enqueued play out */
+void sequencer_free(Sequencer seq);
+
+/* play nnotes notes from notes, SEQUENCER_NOTE_FIELDS each, with time 0
+   at start on the sample clock. replaces whatever was playing, though
+   voices already enqueued still play. the notes are copied */
+void sequencer_play(Sequencer seq, const double* notes, int nnotes,
+                    int64_t start, int64_t length);
+void sequencer_stop(Sequencer seq);
+void sequencer_set_lookahead(Sequencer seq, int64_t lookahead);
+/* the master at first, see audio_enqueue_bus */
+void sequencer_set_bus(Sequencer seq, int bus);
+
+int sequencer_playing(Sequencer seq);
+long sequencer_voices(Sequencer seq);
+
+#endif
@@ -0,0 +1,158 @@
+#include "sfxcache.h"
+#include "audio.h"
+#include "memory.h"
+#include "mixer.h"
+
+#include <string.h>
+
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+
+/* fnv-1a */
+static uint32_t key_hash(const char* key) {
+  uint32_t hash = 2166136261u;
+  for(; *key; ++key) {
+    hash = (hash ^ (unsigned char)*key) * 16777619u;
+  }
+  return hash;
+}
+
+static size_t buffer_bytes(PcmBuffer buffer) {
+  return buffer->nframes * buffer->channels
+    * (buffer->format == PCM_FLOAT ? sizeof(float) : sizeof(int16_t));
+}
+
+PcmBuffer pcmbuffer_render(Sampler* samplers, int n) {
+  float voice[MIX_BLOCK_FRAMES];
+  int64_t end = 0;
+  int ii;
+
+  for(ii = 0; ii < n; ++ii) {
+    end = MAX(end, END(samplers[ii]));
+  }
+
+  PcmBuffer buffer = pcmbuffer_make((end + NUM_CHANNELS - 1) / NUM_CHANNELS);
+  float* mix = buffer->data;
+
+  /* each sampler over the frames of [START, END) it covers, in blocks
+     so the scratch buffer stays small */
+  for(ii = 0; ii < n; ++ii) {
+    Sampler sampler = samplers[ii];
+    long frame = (MAX(START(sampler), 0) + NUM_CHANNELS - 1) / NUM_CHANNELS;
+    long last = (END(sampler) + NUM_CHANNELS - 1) / NUM_CHANNELS;
+
+    while(frame < last) {
+      int block = MIN(last - frame, MIX_BLOCK_FRAMES);
+      RENDER(sampler, frame * NUM_CHANNELS, block, voice);
+      mixer_accumulate(&mix[frame], voice, block);
+      frame += block;
+    }
+    RELEASE_SAMPLER(sampler);
+  }
+  return buffer;
+}
+
+SfxCache sfxcache_make(int max_entries, size_t max_bytes) {
+  SfxCache cache = malloc(sizeof(struct SfxCache_));
+  cache->max_entries = max_entries > 0 ? max_entries : 1;
+  cache->nentries = 0;
+  cache->max_bytes = max_bytes;
+  cache->bytes = 0;
+  cache->clock = 0;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+  cache->entries = malloc(cache->max_entries * sizeof(struct SfxCacheEntry_));
+  cache->nstaged = 0;
+  return cache;
+}
+
+static void sfxcache_remove(SfxCache cache, int index) {
+  SfxCacheEntry entry = &cache->entries[index];
+  cache->bytes -= buffer_bytes(entry->buffer);
+  pcmbuffer_release(entry->buffer);
+  free(entry->key);
+
+  /* order doesn't matter, recency is in last_used */
+  *entry = cache->entries[--cache->nentries];
+}
+
+void sfxcache_free(SfxCache cache) {
+  while(cache->nentries > 0) {
+    sfxcache_remove(cache, 0);
+  }
+  free(cache->entries);
+  free(cache);
+}
+
+static int sfxcache_index(SfxCache cache, const char* key) {
+  uint32_t hash = key_hash(key);
+  int ii;
+  for(ii = 0; ii < cache->nentries; ++ii) {
+    SfxCacheEntry entry = &cache->entries[ii];
+    if(entry->hash == hash && strcmp(entry->key, key) == 0) return ii;
+  }
+  return -1;
+}
+
+PcmBuffer sfxcache_find(SfxCache cache, const char* key) {
+  int index = sfxcache_index(cache, key);
+  if(index < 0) {
+    cache->misses += 1;
+    return NULL;
+  }
+
+  cache->hits += 1;
+  cache->entries[index].last_used = ++cache->clock;
+  return cache->entries[index].buffer;
+}
+
+/* drop least recently used entries until there's room for one of
+   bytes more */
+static void sfxcache_make_room(SfxCache cache, size_t bytes) {
+  while(cache->nentries > 0
+        && (cache->nentries >= cache->max_entries
+            || cache->bytes + bytes > cache->max_bytes)) {
+    int ii, oldest = 0;
+    for(ii = 1; ii < cache->nentries; ++ii) {
+      if(cache->entries[ii].last_used < cache->entries[oldest].last_used) {
+        oldest = ii;
+      }
+    }
+    sfxcache_remove(cache, oldest);
+    cache->evictions += 1;
+  }
+}
+
+PcmBuffer sfxcache_insert(SfxCache cache, const char* key,
+                          Sampler* samplers, int n) {
+  PcmBuffer buffer = pcmbuffer_render(samplers, n);
+  int index = sfxcache_index(cache, key);
+  if(index >= 0) sfxcache_remove(cache, index);
+
+  /* a buffer bigger than the whole cache is still returned, it just
+     isn't kept once something else needs the room */
+  sfxcache_make_room(cache, buffer_bytes(buffer));
+
+  SfxCacheEntry entry = &cache->entries[cache->nentries++];
+  entry->key = malloc(strlen(key) + 1);
+  strcpy(entry->key, key);
+  entry->hash = key_hash(key);
+  entry->buffer = buffer;
+  entry->last_used = ++cache->clock;
+  cache->bytes += buffer_bytes(buffer);
+  return buffer;
+}
+
+void sfxcache_stage(SfxCache cache, Sampler sampler) {
+  if(cache->nstaged < NUM_SAMPLERS) {
+    cache->staged[cache->nstaged++] = sampler;
+  } else {
+    RELEASE_SAMPLER(sampler);
+  }
+}
+
+PcmBuffer sfxcache_commit(SfxCache cache, const char* key) {
+  int n = cache->nstaged;
+  cache->nstaged = 0;
+  return sfxcache_insert(cache, key, cache->staged, n);
+}
@@ -0,0 +1,61 @@
+#ifndef SFXCACHE_H
+#define SFXCACHE_H
+
+#include <stddef.h>
+
+#include "pcm.h"
+
+/** Synthesized effects rendered once and kept as PCM. A cache maps a
+ * key describing how an effect was made to the mono buffer it
+ * rendered to, so replaying the effect is one PcmSampler rather than
+ * a fresh sampler graph. It's bounded both in entries and in bytes of
+ * PCM, and evicts the least recently used. Voices hold their own
+ * reference, so eviction never cuts a sound off. Not thread safe: use
+ * a cache from one thread.
+ */
+
+typedef struct SfxCacheEntry_ {
+  char* key;
+  uint32_t hash;
+  PcmBuffer buffer;
+  long last_used;
+} *SfxCacheEntry;
+
+typedef struct SfxCache_ {
+  int max_entries;
+  int nentries;
+  size_t max_bytes;
+  size_t bytes;
+  long clock; /* ticks on every find and insert */
+  long hits;
+  long misses;
+  long evictions;
+  struct SfxCacheEntry_* entries;
+  Sampler staged[NUM_SAMPLERS];
+  int nstaged;
+} *SfxCache;
+
+SfxCache sfxcache_make(int max_entries, size_t max_bytes);
+void sfxcache_free(SfxCache cache);
+
+/* the buffer cached under key or NULL. it's only guaranteed to stay
+   valid until the next insert, so start playing it (or retain it)
+   first */
+PcmBuffer sfxcache_find(SfxCache cache, const char* key);
+
+/* render samplers, mixed like the mixer mixes them, into a buffer that
+   starts at sample clock 0 and ends with the last of them. they're
+   released. the buffer goes in the cache under key, replacing any
+   entry there, and is returned */
+PcmBuffer sfxcache_insert(SfxCache cache, const char* key,
+                          Sampler* samplers, int n);
+
+/* build up the samplers for an insert one at a time, for callers that
+   can't easily pass an array */
+void sfxcache_stage(SfxCache cache, Sampler sampler);
+PcmBuffer sfxcache_commit(SfxCache cache, const char* key);
+
+/* the rendering insert does, without the cache */
+PcmBuffer pcmbuffer_render(Sampler* samplers, int n);
+
+#endif
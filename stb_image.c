@@ -237,6 +237,17 @@ typedef struct
 
 extern stbi_uc *stbi_load_from_callbacks  (stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp);
 
+// decode into memory the caller owns instead of a fresh malloc. buffer
+// must hold x*y*(req_comp ? req_comp : comp) bytes; call stbi_info first
+// to find the dimensions. JPEGs, and PNGs that need no format conversion,
+// are decoded straight into buffer, anything else is copied there.
+// returns buffer, or NULL if the image failed to load or didn't fit.
+// never pass the result to stbi_image_free
+extern stbi_uc *stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, int out_size, int *x, int *y, int *comp, int req_comp);
+#ifndef STBI_NO_STDIO
+extern stbi_uc *stbi_load_into       (char const *filename, stbi_uc *out, int out_size, int *x, int *y, int *comp, int req_comp);
+#endif
+
 #ifndef STBI_NO_HDR
    extern float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
 
@@ -291,6 +302,12 @@ extern void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply
 // or just pass them through "as-is"
 extern void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 
+// use the SSE2/NEON kernels for the JPEG IDCT, chroma upsampling and
+// color conversion and for PNG unfiltering, plus the multi-symbol zlib
+// decoder, when cpu_level() from cpu.h allows them (the default). pass
+// 0 to force the portable code, e.g. to compare the two
+extern void stbi_set_simd(int flag_true_if_should_use_simd);
+
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -346,6 +363,8 @@ extern void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func);
 #include <assert.h>
 #include <stdarg.h>
 
+#include "cpu.h"
+
 #ifndef _MSC_VER
    #ifdef __cplusplus
    #define stbi_inline inline
@@ -356,6 +375,49 @@ extern void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func);
    #define stbi_inline __forceinline
 #endif
 
+// SIMD kernels. the SSE2 versions are compiled with a target attribute so
+// a 32-bit x86 build without -msse2 still carries them; whether they are
+// used is decided at runtime. NEON is only used when the compiler was
+// already told the target has it.
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   #define STBI_SSE2
+   #define STBI_SSE2_TARGET __attribute__((target("sse2")))
+   #include <emmintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+   #define STBI_SSE2
+   #define STBI_SSE2_TARGET
+   #include <emmintrin.h>
+   #include <intrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+   #define STBI_NEON
+   #include <arm_neon.h>
+#endif
+
+static int stbi_simd_allowed = 1;
+
+void stbi_set_simd(int flag_true_if_should_use_simd)
+{
+   stbi_simd_allowed = flag_true_if_should_use_simd;
+}
+
+#ifdef STBI_SSE2
+// the same level every other kernel in the program uses, so CPU_LEVEL
+// reaches these too
+static int stbi_sse2_available(void)
+{
+#ifdef CPU_X86
+   CpuLevel level = cpu_level();
+   return level != CPU_SCALAR && level != CPU_NEON;
+#else
+   int info[4];
+   __cpuid(info, 1);
+   return (info[3] >> 26) & 1;
+#endif
+}
+#endif
+
 
 // implementation:
 typedef unsigned char  uint8;
@@ -404,8 +466,31 @@ typedef struct
 
    uint8 *img_buffer, *img_buffer_end;
    uint8 *img_buffer_original;
+
+   // caller supplied destination for the decoded image, see stbi_out_malloc
+   uint8 *out_buffer;
+   int out_size, out_taken;
 } stbi;
 
+// allocate the final image. the first request that fits in the caller's
+// buffer gets it, everything else comes from malloc
+static uint8 *stbi_out_malloc(stbi *s, int size)
+{
+   if (s->out_buffer && !s->out_taken && size <= s->out_size) {
+      s->out_taken = 1;
+      return s->out_buffer;
+   }
+   return (uint8 *) malloc(size);
+}
+
+static void stbi_out_free(stbi *s, void *p)
+{
+   if (p && p == s->out_buffer)
+      s->out_taken = 0;
+   else
+      free(p);
+}
+
 
 static void refill_buffer(stbi *s);
 
@@ -416,6 +501,7 @@ static void start_mem(stbi *s, uint8 const *buffer, int len)
    s->read_from_callbacks = 0;
    s->img_buffer = s->img_buffer_original = (uint8 *) buffer;
    s->img_buffer_end = (uint8 *) buffer+len;
+   s->out_buffer = NULL;
 }
 
 // initialize a callback-based context
@@ -426,6 +512,7 @@ static void start_callbacks(stbi *s, stbi_io_callbacks *c, void *user)
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->img_buffer_original = s->buffer_start;
+   s->out_buffer = NULL;
    refill_buffer(s);
 }
 
@@ -586,6 +673,48 @@ unsigned char *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *use
    return stbi_load_main(&s,x,y,comp,req_comp);
 }
 
+static stbi_uc *stbi_load_main_into(stbi *s, stbi_uc *out, int out_size, int *x, int *y, int *comp, int req_comp)
+{
+   int size;
+   stbi_uc *result;
+   s->out_buffer = out;
+   s->out_size = out_size;
+   s->out_taken = 0;
+   result = stbi_load_main(s,x,y,comp,req_comp);
+   if (result == NULL || result == out) return result;
+
+   // the loader needed its own allocation, copy it over
+   size = *x * *y * (req_comp ? req_comp : *comp);
+   if (size > out_size) {
+      free(result);
+      return epuc("buffer too small", "Destination buffer too small");
+   }
+   memcpy(out, result, size);
+   free(result);
+   return out;
+}
+
+stbi_uc *stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, int out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   start_mem(&s,buffer,len);
+   return stbi_load_main_into(&s,out,out_size,x,y,comp,req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+stbi_uc *stbi_load_into(char const *filename, stbi_uc *out, int out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   FILE *f = fopen(filename, "rb");
+   stbi_uc *result;
+   if (!f) return epuc("can't fopen", "Unable to open file");
+   start_file(&s,f);
+   result = stbi_load_main_into(&s,out,out_size,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+#endif //!STBI_NO_STDIO
+
 #ifndef STBI_NO_HDR
 
 float *stbi_loadf_main(stbi *s, int *x, int *y, int *comp, int req_comp)
@@ -961,11 +1090,22 @@ typedef struct
    int    delta[17];   // old 'firstsymbol' - old 'firstcode'
 } huffman;
 
+// kernels with vectorized versions. each decode picks its own, see
+// stbi_jpeg_select_kernels
+typedef void (*stbi_idct_func)(uint8 *out, int out_stride, short data[64], uint8 *dequantize);
+typedef uint8 *(*resample_row_func)(uint8 *out, uint8 *in0, uint8 *in1,
+                                    int w, int hs);
+typedef void (*stbi_YCbCr_func)(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step);
+
 typedef struct
 {
    #ifdef STBI_SIMD
    unsigned short dequant2[4][64];
+   #else
+   stbi_idct_func idct_kernel;
    #endif
+   resample_row_func resample_hv_2_kernel;
+   stbi_YCbCr_func YCbCr_kernel;
    stbi *s;
    huffman huff_dc[4];
    huffman huff_ac[4];
@@ -1319,6 +1459,379 @@ void stbi_install_idct(stbi_idct_8x8 func)
 }
 #endif
 
+#ifndef STBI_SIMD
+// vectorized versions of idct_block. both are constructed to give exactly
+// the same results as idct_block for any conforming stream: the
+// dequantized coefficients and the intermediate column results fit in 16
+// bits, and the 32-bit products and sums are formed from the same terms.
+
+#ifdef STBI_SSE2
+STBI_SSE2_TARGET
+static void idct_block_sse2(uint8 *out, int out_stride, short data[64], uint8 *dequantize)
+{
+   __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m128i tmp;
+
+   // dot product constant: even elems=x, odd elems=y
+   #define dct_const(x,y)  _mm_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y))
+
+   // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+   // out(1) = c1[even]*x + c1[odd]*y
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m128i c0##lo = _mm_unpacklo_epi16((x),(y)); \
+      __m128i c0##hi = _mm_unpackhi_epi16((x),(y)); \
+      __m128i out0##_l = _mm_madd_epi16(c0##lo, c0); \
+      __m128i out0##_h = _mm_madd_epi16(c0##hi, c0); \
+      __m128i out1##_l = _mm_madd_epi16(c0##lo, c1); \
+      __m128i out1##_h = _mm_madd_epi16(c0##hi, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+   #define dct_widen(out, in) \
+      __m128i out##_l = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), (in)), 4); \
+      __m128i out##_h = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), (in)), 4)
+
+   #define dct_wadd(out, a, b) \
+      __m128i out##_l = _mm_add_epi32(a##_l, b##_l); \
+      __m128i out##_h = _mm_add_epi32(a##_h, b##_h)
+
+   #define dct_wsub(out, a, b) \
+      __m128i out##_l = _mm_sub_epi32(a##_l, b##_l); \
+      __m128i out##_h = _mm_sub_epi32(a##_h, b##_h)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m128i abiased_l = _mm_add_epi32(a##_l, bias); \
+         __m128i abiased_h = _mm_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm_packs_epi32(_mm_srai_epi32(sum_l, s), _mm_srai_epi32(sum_h, s)); \
+         out1 = _mm_packs_epi32(_mm_srai_epi32(dif_l, s), _mm_srai_epi32(dif_h, s)); \
+      }
+
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+   // IDCT_1D on 8 columns at once
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   __m128i rot0_0 = dct_const(f2f(0.5411961f), f2f(0.5411961f) + f2f(-1.847759065f));
+   __m128i rot0_1 = dct_const(f2f(0.5411961f) + f2f( 0.765366865f), f2f(0.5411961f));
+   __m128i rot1_0 = dct_const(f2f(1.175875602f) + f2f(-0.899976223f), f2f(1.175875602f));
+   __m128i rot1_1 = dct_const(f2f(1.175875602f), f2f(1.175875602f) + f2f(-2.562915447f));
+   __m128i rot2_0 = dct_const(f2f(-1.961570560f) + f2f( 0.298631336f), f2f(-1.961570560f));
+   __m128i rot2_1 = dct_const(f2f(-1.961570560f), f2f(-1.961570560f) + f2f( 3.072711026f));
+   __m128i rot3_0 = dct_const(f2f(-0.390180644f) + f2f( 2.053119869f), f2f(-0.390180644f));
+   __m128i rot3_1 = dct_const(f2f(-0.390180644f), f2f(-0.390180644f) + f2f( 1.501321110f));
+
+   // same rounding biases as the two passes of idct_block
+   __m128i bias_0 = _mm_set1_epi32(512);
+   __m128i bias_1 = _mm_set1_epi32(65536 + (128<<17));
+
+   // load and dequantize
+   __m128i zero = _mm_setzero_si128();
+   #define dct_load(row, i) \
+      row = _mm_mullo_epi16(_mm_loadu_si128((const __m128i *) (data + (i)*8)), \
+                            _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (dequantize + (i)*8)), zero))
+   dct_load(row0, 0);
+   dct_load(row1, 1);
+   dct_load(row2, 2);
+   dct_load(row3, 3);
+   dct_load(row4, 4);
+   dct_load(row5, 5);
+   dct_load(row6, 6);
+   dct_load(row7, 7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack, saturating to 0..255 like clamp() does
+      __m128i p0 = _mm_packus_epi16(row0, row1);
+      __m128i p1 = _mm_packus_epi16(row2, row3);
+      __m128i p2 = _mm_packus_epi16(row4, row5);
+      __m128i p3 = _mm_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      dct_interleave8(p0, p1);
+      dct_interleave8(p2, p3);
+
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+   }
+
+   #undef dct_const
+   #undef dct_rot
+   #undef dct_widen
+   #undef dct_wadd
+   #undef dct_wsub
+   #undef dct_bfly32o
+   #undef dct_interleave8
+   #undef dct_interleave16
+   #undef dct_pass
+   #undef dct_load
+}
+#endif // STBI_SSE2
+
+#ifdef STBI_NEON
+static void idct_block_neon(uint8 *out, int out_stride, short data[64], uint8 *dequantize)
+{
+   int16x8_t row0, row1, row2, row3, row4, row5, row6, row7;
+
+   int16x4_t rot0_0 = vdup_n_s16(f2f(0.5411961f));
+   int16x4_t rot0_1 = vdup_n_s16(f2f(-1.847759065f));
+   int16x4_t rot0_2 = vdup_n_s16(f2f( 0.765366865f));
+   int16x4_t rot1_0 = vdup_n_s16(f2f( 1.175875602f));
+   int16x4_t rot1_1 = vdup_n_s16(f2f(-0.899976223f));
+   int16x4_t rot1_2 = vdup_n_s16(f2f(-2.562915447f));
+   int16x4_t rot2_0 = vdup_n_s16(f2f(-1.961570560f));
+   int16x4_t rot2_1 = vdup_n_s16(f2f(-0.390180644f));
+   int16x4_t rot3_0 = vdup_n_s16(f2f( 0.298631336f));
+   int16x4_t rot3_1 = vdup_n_s16(f2f( 2.053119869f));
+   int16x4_t rot3_2 = vdup_n_s16(f2f( 3.072711026f));
+   int16x4_t rot3_3 = vdup_n_s16(f2f( 1.501321110f));
+
+   #define dct_long_mul(out, inq, coeff) \
+      int32x4_t out##_l = vmull_s16(vget_low_s16(inq), coeff); \
+      int32x4_t out##_h = vmull_s16(vget_high_s16(inq), coeff)
+
+   #define dct_long_mac(out, acc, inq, coeff) \
+      int32x4_t out##_l = vmlal_s16(acc##_l, vget_low_s16(inq), coeff); \
+      int32x4_t out##_h = vmlal_s16(acc##_h, vget_high_s16(inq), coeff)
+
+   #define dct_widen(out, inq) \
+      int32x4_t out##_l = vshll_n_s16(vget_low_s16(inq), 12); \
+      int32x4_t out##_h = vshll_n_s16(vget_high_s16(inq), 12)
+
+   #define dct_wadd(out, a, b) \
+      int32x4_t out##_l = vaddq_s32(a##_l, b##_l); \
+      int32x4_t out##_h = vaddq_s32(a##_h, b##_h)
+
+   #define dct_wsub(out, a, b) \
+      int32x4_t out##_l = vsubq_s32(a##_l, b##_l); \
+      int32x4_t out##_h = vsubq_s32(a##_h, b##_h)
+
+   // butterfly a/b, add bias, then shift by "s" and narrow
+   #define dct_bfly32o(out0,out1, a,b,bias,s) \
+      { \
+         int32x4_t abiased_l = vaddq_s32(a##_l, bias); \
+         int32x4_t abiased_h = vaddq_s32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = vcombine_s16(vqmovn_s32(vshrq_n_s32(sum_l, s)), vqmovn_s32(vshrq_n_s32(sum_h, s))); \
+         out1 = vcombine_s16(vqmovn_s32(vshrq_n_s32(dif_l, s)), vqmovn_s32(vshrq_n_s32(dif_h, s))); \
+      }
+
+   #define dct_pass(bias, shift) \
+      { \
+         /* even part */ \
+         int16x8_t sum26 = vaddq_s16(row2, row6); \
+         dct_long_mul(p1e, sum26, rot0_0); \
+         dct_long_mac(t2e, p1e, row6, rot0_1); \
+         dct_long_mac(t3e, p1e, row2, rot0_2); \
+         int16x8_t sum04 = vaddq_s16(row0, row4); \
+         int16x8_t dif04 = vsubq_s16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         int16x8_t sum15 = vaddq_s16(row1, row5); \
+         int16x8_t sum17 = vaddq_s16(row1, row7); \
+         int16x8_t sum35 = vaddq_s16(row3, row5); \
+         int16x8_t sum37 = vaddq_s16(row3, row7); \
+         int16x8_t sumodd = vaddq_s16(sum17, sum35); \
+         dct_long_mul(p5o, sumodd, rot1_0); \
+         dct_long_mac(p1o, p5o, sum17, rot1_1); \
+         dct_long_mac(p2o, p5o, sum35, rot1_2); \
+         dct_long_mul(p3o, sum37, rot2_0); \
+         dct_long_mul(p4o, sum15, rot2_1); \
+         dct_wadd(sump13o, p1o, p3o); \
+         dct_wadd(sump14o, p1o, p4o); \
+         dct_wadd(sump23o, p2o, p3o); \
+         dct_wadd(sump24o, p2o, p4o); \
+         dct_long_mac(x4, sump13o, row7, rot3_0); \
+         dct_long_mac(x5, sump24o, row5, rot3_1); \
+         dct_long_mac(x6, sump23o, row3, rot3_2); \
+         dct_long_mac(x7, sump14o, row1, rot3_3); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   int32x4_t bias_0 = vdupq_n_s32(512);
+   int32x4_t bias_1 = vdupq_n_s32(65536 + (128<<17));
+
+   // load and dequantize
+   #define dct_load(row, i) \
+      row = vmulq_s16(vld1q_s16(data + (i)*8), \
+                      vreinterpretq_s16_u16(vmovl_u8(vld1_u8(dequantize + (i)*8))))
+   dct_load(row0, 0);
+   dct_load(row1, 1);
+   dct_load(row2, 2);
+   dct_load(row3, 3);
+   dct_load(row4, 4);
+   dct_load(row5, 5);
+   dct_load(row6, 6);
+   dct_load(row7, 7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose
+      #define dct_trn16(x, y) { int16x8x2_t t = vtrnq_s16(x, y); x = t.val[0]; y = t.val[1]; }
+      #define dct_trn32(x, y) { int32x4x2_t t = vtrnq_s32(vreinterpretq_s32_s16(x), vreinterpretq_s32_s16(y)); x = vreinterpretq_s16_s32(t.val[0]); y = vreinterpretq_s16_s32(t.val[1]); }
+      #define dct_trn64(x, y) { int16x8_t x0 = x; int16x8_t y0 = y; x = vcombine_s16(vget_low_s16(x0), vget_low_s16(y0)); y = vcombine_s16(vget_high_s16(x0), vget_high_s16(y0)); }
+
+      dct_trn16(row0, row1);
+      dct_trn16(row2, row3);
+      dct_trn16(row4, row5);
+      dct_trn16(row6, row7);
+
+      dct_trn32(row0, row2);
+      dct_trn32(row1, row3);
+      dct_trn32(row4, row6);
+      dct_trn32(row5, row7);
+
+      dct_trn64(row0, row4);
+      dct_trn64(row1, row5);
+      dct_trn64(row2, row6);
+      dct_trn64(row3, row7);
+
+      #undef dct_trn16
+      #undef dct_trn32
+      #undef dct_trn64
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      uint8x8_t p0 = vqmovun_s16(row0);
+      uint8x8_t p1 = vqmovun_s16(row1);
+      uint8x8_t p2 = vqmovun_s16(row2);
+      uint8x8_t p3 = vqmovun_s16(row3);
+      uint8x8_t p4 = vqmovun_s16(row4);
+      uint8x8_t p5 = vqmovun_s16(row5);
+      uint8x8_t p6 = vqmovun_s16(row6);
+      uint8x8_t p7 = vqmovun_s16(row7);
+
+      // 8bit 8x8 transpose
+      #define dct_trn8_8(x, y) { uint8x8x2_t t = vtrn_u8(x, y); x = t.val[0]; y = t.val[1]; }
+      #define dct_trn8_16(x, y) { uint16x4x2_t t = vtrn_u16(vreinterpret_u16_u8(x), vreinterpret_u16_u8(y)); x = vreinterpret_u8_u16(t.val[0]); y = vreinterpret_u8_u16(t.val[1]); }
+      #define dct_trn8_32(x, y) { uint32x2x2_t t = vtrn_u32(vreinterpret_u32_u8(x), vreinterpret_u32_u8(y)); x = vreinterpret_u8_u32(t.val[0]); y = vreinterpret_u8_u32(t.val[1]); }
+
+      dct_trn8_8(p0, p1);
+      dct_trn8_8(p2, p3);
+      dct_trn8_8(p4, p5);
+      dct_trn8_8(p6, p7);
+
+      dct_trn8_16(p0, p2);
+      dct_trn8_16(p1, p3);
+      dct_trn8_16(p4, p6);
+      dct_trn8_16(p5, p7);
+
+      dct_trn8_32(p0, p4);
+      dct_trn8_32(p1, p5);
+      dct_trn8_32(p2, p6);
+      dct_trn8_32(p3, p7);
+
+      vst1_u8(out, p0); out += out_stride;
+      vst1_u8(out, p1); out += out_stride;
+      vst1_u8(out, p2); out += out_stride;
+      vst1_u8(out, p3); out += out_stride;
+      vst1_u8(out, p4); out += out_stride;
+      vst1_u8(out, p5); out += out_stride;
+      vst1_u8(out, p6); out += out_stride;
+      vst1_u8(out, p7);
+
+      #undef dct_trn8_8
+      #undef dct_trn8_16
+      #undef dct_trn8_32
+   }
+
+   #undef dct_long_mul
+   #undef dct_long_mac
+   #undef dct_widen
+   #undef dct_wadd
+   #undef dct_wsub
+   #undef dct_bfly32o
+   #undef dct_pass
+   #undef dct_load
+}
+#endif // STBI_NEON
+#endif // !STBI_SIMD
+
 #define MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -1374,7 +1887,7 @@ static int parse_entropy_coded_data(jpeg *z)
             #ifdef STBI_SIMD
             stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
             #else
-            idct_block(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
+            z->idct_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
             #endif
             // every data block is an MCU, so countdown the restart interval
             if (--z->todo <= 0) {
@@ -1404,7 +1917,7 @@ static int parse_entropy_coded_data(jpeg *z)
                      #ifdef STBI_SIMD
                      stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
                      #else
-                     idct_block(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
+                     z->idct_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
                      #endif
                   }
                }
@@ -1651,9 +2164,6 @@ static int decode_jpeg_image(jpeg *j)
 
 // static jfif-centered resampling (across block boundaries)
 
-typedef uint8 *(*resample_row_func)(uint8 *out, uint8 *in0, uint8 *in1,
-                                    int w, int hs);
-
 #define div4(x) ((uint8) ((x) >> 2))
 
 static uint8 *resample_row_1(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
@@ -1729,6 +2239,133 @@ static uint8 *resample_row_hv_2(uint8 *out, uint8 *in_near, uint8 *in_far, int w
    return out;
 }
 
+#ifdef STBI_SSE2
+// same arithmetic as resample_row_hv_2, 8 input pixels at a time
+STBI_SSE2_TARGET
+static uint8 *resample_row_hv_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   // the last pixel of the row needs the edge case, so stop before it
+   for (; i < ((w-1) & ~7); i += 8) {
+      // vertical pass: 3*near + far = 4*near + (far - near)
+      __m128i zero  = _mm_setzero_si128();
+      __m128i farb  = _mm_loadl_epi64((__m128i *) (in_far + i));
+      __m128i nearb = _mm_loadl_epi64((__m128i *) (in_near + i));
+      __m128i farw  = _mm_unpacklo_epi8(farb, zero);
+      __m128i nearw = _mm_unpacklo_epi8(nearb, zero);
+      __m128i diff  = _mm_sub_epi16(farw, nearw);
+      __m128i nears = _mm_slli_epi16(nearw, 2);
+      __m128i curr  = _mm_add_epi16(nears, diff);
+
+      // the horizontal pass needs the row shifted one pixel each way,
+      // pulling in the neighbours of this block of 8
+      __m128i prv0 = _mm_slli_si128(curr, 2);
+      __m128i nxt0 = _mm_srli_si128(curr, 2);
+      __m128i prev = _mm_insert_epi16(prv0, t1, 0);
+      __m128i next = _mm_insert_epi16(nxt0, 3*in_near[i+8] + in_far[i+8], 7);
+
+      // even = 3*cur + prev, odd = 3*cur + next, both plus the rounding bias
+      __m128i bias = _mm_set1_epi16(8);
+      __m128i curs = _mm_slli_epi16(curr, 2);
+      __m128i prvd = _mm_sub_epi16(prev, curr);
+      __m128i nxtd = _mm_sub_epi16(next, curr);
+      __m128i curb = _mm_add_epi16(curs, bias);
+      __m128i even = _mm_add_epi16(prvd, curb);
+      __m128i odd  = _mm_add_epi16(nxtd, curb);
+
+      __m128i int0 = _mm_unpacklo_epi16(even, odd);
+      __m128i int1 = _mm_unpackhi_epi16(even, odd);
+      __m128i de0  = _mm_srli_epi16(int0, 4);
+      __m128i de1  = _mm_srli_epi16(int1, 4);
+
+      _mm_storeu_si128((__m128i *) (out + i*2), _mm_packus_epi16(de0, de1));
+
+      t1 = 3*in_near[i+7] + in_far[i+7];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif // STBI_SSE2
+
+#ifdef STBI_NEON
+static uint8 *resample_row_hv_2_neon(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   for (; i < ((w-1) & ~7); i += 8) {
+      // vertical pass
+      uint8x8_t farb  = vld1_u8(in_far + i);
+      uint8x8_t nearb = vld1_u8(in_near + i);
+      int16x8_t diff  = vreinterpretq_s16_u16(vsubl_u8(farb, nearb));
+      int16x8_t nears = vreinterpretq_s16_u16(vshll_n_u8(nearb, 2));
+      int16x8_t curr  = vaddq_s16(nears, diff);
+
+      // neighbours for the horizontal pass
+      int16x8_t prv0 = vextq_s16(curr, curr, 7);
+      int16x8_t nxt0 = vextq_s16(curr, curr, 1);
+      int16x8_t prev = vsetq_lane_s16(t1, prv0, 0);
+      int16x8_t next = vsetq_lane_s16(3*in_near[i+8] + in_far[i+8], nxt0, 7);
+
+      int16x8_t curs = vshlq_n_s16(curr, 2);
+      int16x8_t prvd = vsubq_s16(prev, curr);
+      int16x8_t nxtd = vsubq_s16(next, curr);
+      int16x8_t even = vaddq_s16(curs, prvd);
+      int16x8_t odd  = vaddq_s16(curs, nxtd);
+
+      // undo scaling and round, then interleave on store
+      uint8x8x2_t o;
+      o.val[0] = vqrshrun_n_s16(even, 4);
+      o.val[1] = vqrshrun_n_s16(odd,  4);
+      vst2_u8(out + i*2, o);
+
+      t1 = 3*in_near[i+7] + in_far[i+7];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif // STBI_NEON
+
 static uint8 *resample_row_generic(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -1764,11 +2401,182 @@ static void YCbCr_to_RGB_row(uint8 *out, const uint8 *y, const uint8 *pcb, const
       out[0] = (uint8)r;
       out[1] = (uint8)g;
       out[2] = (uint8)b;
-      out[3] = 255;
+      if (step == 4) out[3] = 255;
       out += step;
    }
 }
 
+// the vectorized color conversions work in 16-bit fixed point (4 fraction
+// bits on y, 12 on the coefficients) where YCbCr_to_RGB_row uses 16.16, so
+// a channel can come out one step away from the portable result.
+
+#define float2fixed12(x) ((short) ((x) * 4096.0f + 0.5f))
+
+#ifdef STBI_SSE2
+STBI_SSE2_TARGET
+static void YCbCr_to_RGB_row_sse2(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step)
+{
+   int i = 0;
+   __m128i signflip  = _mm_set1_epi8(-0x80);
+   __m128i cr_const0 = _mm_set1_epi16(  float2fixed12(1.40200f));
+   __m128i cr_const1 = _mm_set1_epi16(- float2fixed12(0.71414f));
+   __m128i cb_const0 = _mm_set1_epi16(- float2fixed12(0.34414f));
+   __m128i cb_const1 = _mm_set1_epi16(  float2fixed12(1.77200f));
+   __m128i y_bias = _mm_set1_epi8((char) (unsigned char) 128);
+   __m128i xw = _mm_set1_epi16(255); // alpha channel
+   __m128i low_rgb = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+   __m128i high_rgb = _mm_set_epi32(0x00FFFFFF, 0, 0x00FFFFFF, 0);
+   __m128i low_half = _mm_set_epi32(0, 0, -1, -1);
+
+   for (; i+7 < count; i += 8) {
+      __m128i y_bytes = _mm_loadl_epi64((const __m128i *) (y+i));
+      __m128i cr_bytes = _mm_loadl_epi64((const __m128i *) (pcr+i));
+      __m128i cb_bytes = _mm_loadl_epi64((const __m128i *) (pcb+i));
+      __m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+      __m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+      // unpack to short: y*256 + 128, cr and cb shifted up by 8
+      __m128i yw  = _mm_unpacklo_epi8(y_bias, y_bytes);
+      __m128i crw = _mm_unpacklo_epi8(_mm_setzero_si128(), cr_biased);
+      __m128i cbw = _mm_unpacklo_epi8(_mm_setzero_si128(), cb_biased);
+
+      __m128i yws = _mm_srli_epi16(yw, 4);
+      __m128i cr0 = _mm_mulhi_epi16(cr_const0, crw);
+      __m128i cb0 = _mm_mulhi_epi16(cb_const0, cbw);
+      __m128i cb1 = _mm_mulhi_epi16(cbw, cb_const1);
+      __m128i cr1 = _mm_mulhi_epi16(crw, cr_const1);
+      __m128i rws = _mm_add_epi16(cr0, yws);
+      __m128i gwt = _mm_add_epi16(cb0, yws);
+      __m128i bws = _mm_add_epi16(yws, cb1);
+      __m128i gws = _mm_add_epi16(gwt, cr1);
+
+      __m128i rw = _mm_srai_epi16(rws, 4);
+      __m128i bw = _mm_srai_epi16(bws, 4);
+      __m128i gw = _mm_srai_epi16(gws, 4);
+
+      // back to bytes and interleave to rgba
+      __m128i brb = _mm_packus_epi16(rw, bw);
+      __m128i gxb = _mm_packus_epi16(gw, xw);
+      __m128i t0 = _mm_unpacklo_epi8(brb, gxb);
+      __m128i t1 = _mm_unpackhi_epi8(brb, gxb);
+      __m128i o0 = _mm_unpacklo_epi16(t0, t1);
+      __m128i o1 = _mm_unpackhi_epi16(t0, t1);
+
+      if (step == 4) {
+         _mm_storeu_si128((__m128i *) (out + 0), o0);
+         _mm_storeu_si128((__m128i *) (out + 16), o1);
+         out += 32;
+      } else {
+         // squeeze the alpha bytes out of each pair of pixels, then
+         // close the gap between the two pairs: 12 bytes per register
+         o0 = _mm_or_si128(_mm_and_si128(o0, low_rgb),
+                           _mm_srli_epi64(_mm_and_si128(o0, high_rgb), 8));
+         o1 = _mm_or_si128(_mm_and_si128(o1, low_rgb),
+                           _mm_srli_epi64(_mm_and_si128(o1, high_rgb), 8));
+         o0 = _mm_or_si128(_mm_and_si128(o0, low_half),
+                           _mm_srli_si128(_mm_andnot_si128(low_half, o0), 2));
+         o1 = _mm_or_si128(_mm_and_si128(o1, low_half),
+                           _mm_srli_si128(_mm_andnot_si128(low_half, o1), 2));
+         int tail0 = _mm_cvtsi128_si32(_mm_srli_si128(o0, 8));
+         int tail1 = _mm_cvtsi128_si32(_mm_srli_si128(o1, 8));
+         _mm_storel_epi64((__m128i *) (out + 0), o0);
+         memcpy(out + 8, &tail0, 4);
+         _mm_storel_epi64((__m128i *) (out + 12), o1);
+         memcpy(out + 20, &tail1, 4);
+         out += 24;
+      }
+   }
+
+   YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif // STBI_SSE2
+
+#ifdef STBI_NEON
+static void YCbCr_to_RGB_row_neon(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step)
+{
+   int i = 0;
+   uint8x8_t signflip = vdup_n_u8(0x80);
+   int16x8_t cr_const0 = vdupq_n_s16(  float2fixed12(1.40200f));
+   int16x8_t cr_const1 = vdupq_n_s16(- float2fixed12(0.71414f));
+   int16x8_t cb_const0 = vdupq_n_s16(- float2fixed12(0.34414f));
+   int16x8_t cb_const1 = vdupq_n_s16(  float2fixed12(1.77200f));
+
+   for (; i+7 < count; i += 8) {
+      uint8x8_t y_bytes  = vld1_u8(y + i);
+      uint8x8_t cr_bytes = vld1_u8(pcr + i);
+      uint8x8_t cb_bytes = vld1_u8(pcb + i);
+      int8x8_t cr_biased = vreinterpret_s8_u8(vsub_u8(cr_bytes, signflip));
+      int8x8_t cb_biased = vreinterpret_s8_u8(vsub_u8(cb_bytes, signflip));
+
+      // expand to s16: y with 4 fraction bits, cr/cb scaled for vqdmulh
+      int16x8_t yws = vreinterpretq_s16_u16(vshll_n_u8(y_bytes, 4));
+      int16x8_t crw = vshll_n_s8(cr_biased, 7);
+      int16x8_t cbw = vshll_n_s8(cb_biased, 7);
+
+      int16x8_t cr0 = vqdmulhq_s16(crw, cr_const0);
+      int16x8_t cb0 = vqdmulhq_s16(cbw, cb_const0);
+      int16x8_t cr1 = vqdmulhq_s16(crw, cr_const1);
+      int16x8_t cb1 = vqdmulhq_s16(cbw, cb_const1);
+      int16x8_t rws = vaddq_s16(yws, cr0);
+      int16x8_t gws = vaddq_s16(vaddq_s16(yws, cb0), cr1);
+      int16x8_t bws = vaddq_s16(yws, cb1);
+
+      if (step == 4) {
+         uint8x8x4_t o;
+         o.val[0] = vqrshrun_n_s16(rws, 4);
+         o.val[1] = vqrshrun_n_s16(gws, 4);
+         o.val[2] = vqrshrun_n_s16(bws, 4);
+         o.val[3] = vdup_n_u8(255);
+         vst4_u8(out, o);
+         out += 8*4;
+      } else {
+         uint8x8x3_t o;
+         o.val[0] = vqrshrun_n_s16(rws, 4);
+         o.val[1] = vqrshrun_n_s16(gws, 4);
+         o.val[2] = vqrshrun_n_s16(bws, 4);
+         vst3_u8(out, o);
+         out += 8*3;
+      }
+   }
+
+   YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif // STBI_NEON
+
+// pick the kernels for this decode; cheap enough to do per image and it
+// lets stbi_set_simd take effect between loads. they live in the jpeg so
+// concurrent decodes never see each other's choice
+static void stbi_jpeg_select_kernels(jpeg *z)
+{
+#ifndef STBI_SIMD
+   z->idct_kernel = idct_block;
+#endif
+   z->resample_hv_2_kernel = resample_row_hv_2;
+   z->YCbCr_kernel = YCbCr_to_RGB_row;
+
+   if (!stbi_simd_allowed) return;
+
+#ifdef STBI_SSE2
+   if (stbi_sse2_available()) {
+   #ifndef STBI_SIMD
+      z->idct_kernel = idct_block_sse2;
+   #endif
+      z->resample_hv_2_kernel = resample_row_hv_2_sse2;
+      z->YCbCr_kernel = YCbCr_to_RGB_row_sse2;
+   }
+#endif
+
+#ifdef STBI_NEON
+   if (cpu_level() == CPU_NEON) {
+   #ifndef STBI_SIMD
+      z->idct_kernel = idct_block_neon;
+   #endif
+      z->resample_hv_2_kernel = resample_row_hv_2_neon;
+      z->YCbCr_kernel = YCbCr_to_RGB_row_neon;
+   }
+#endif
+}
+
 #ifdef STBI_SIMD
 static stbi_YCbCr_to_RGB_run stbi_YCbCr_installed = YCbCr_to_RGB_row;
 
@@ -1850,12 +2658,12 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
          if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
          else if (r->hs == 1 && r->vs == 2) r->resample = resample_row_v_2;
          else if (r->hs == 2 && r->vs == 1) r->resample = resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = resample_row_hv_2;
+         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_hv_2_kernel;
          else                               r->resample = resample_row_generic;
       }
 
       // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s->img_x * z->s->img_y + 1);
+      output = stbi_out_malloc(z->s, n * z->s->img_x * z->s->img_y);
       if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
@@ -1881,12 +2689,12 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
                #ifdef STBI_SIMD
                stbi_YCbCr_installed(out, y, coutput[1], coutput[2], z->s.img_x, n);
                #else
-               YCbCr_to_RGB_row(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               z->YCbCr_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
                #endif
             } else
                for (i=0; i < z->s->img_x; ++i) {
                   out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
+                  if (n == 4) out[3] = 255;
                   out += n;
                }
          } else {
@@ -1909,6 +2717,7 @@ static unsigned char *stbi_jpeg_load(stbi *s, int *x, int *y, int *comp, int req
 {
    jpeg j;
    j.s = s;
+   stbi_jpeg_select_kernels(&j);
    return load_jpeg_image(&j, x,y,comp,req_comp);
 }
 
@@ -2026,6 +2835,32 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
    return 1;
 }
 
+// multi-symbol lookup for the literal/length tree: most of a typical
+// PNG stream is literals of 5-8 bits, so one lookup of ZPAIR_BITS bits
+// often resolves two of them. entries are 0 if the low bits don't start
+// with a literal the fast table resolves, otherwise
+//   lit0 | lit1 << 8 | bits consumed << 16 | literal count << 24
+#define ZPAIR_BITS  (ZFAST_BITS+1)
+#define ZPAIR_MASK  ((1 << ZPAIR_BITS) - 1)
+
+static void zbuild_literal_pairs(uint32 *pair, zhuffman *z)
+{
+   int k;
+   for (k=0; k < (1 << ZPAIR_BITS); ++k) {
+      int b = z->fast[k & ZFAST_MASK], s, b2, s2;
+      pair[k] = 0;
+      if (b == 0xffff || z->value[b] >= 256) continue;
+      s = z->size[b];
+      pair[k] = z->value[b] | (s << 16) | (1 << 24);
+      // the second code must fit entirely in the bits left in k
+      b2 = z->fast[(k >> s) & ZFAST_MASK];
+      if (b2 == 0xffff || z->value[b2] >= 256) continue;
+      s2 = z->size[b2];
+      if (s + s2 > ZPAIR_BITS) continue;
+      pair[k] = z->value[b] | (z->value[b2] << 8) | ((s+s2) << 16) | (2 << 24);
+   }
+}
+
 // zlib-from-memory implementation for PNG reading
 //    because PNG allows splitting the zlib stream arbitrarily,
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
@@ -2044,6 +2879,9 @@ typedef struct
    int   z_expandable;
 
    zhuffman z_length, z_distance;
+
+   // literal pairs for the length tree, see zbuild_literal_pairs
+   uint32 zpair[1 << ZPAIR_BITS];
 } zbuf;
 
 stbi_inline static int zget8(zbuf *z)
@@ -2157,6 +2995,59 @@ static int parse_huffman_block(zbuf *a)
    }
 }
 
+// same as parse_huffman_block, but takes literals two at a time from
+// the pair table and copies matches in bulk where they don't overlap
+static int parse_huffman_block_fast(zbuf *a)
+{
+   zbuild_literal_pairs(a->zpair, &a->z_length);
+   for(;;) {
+      uint32 entry;
+      int z;
+      if (a->num_bits < 16) fill_bits(a);
+      entry = a->zpair[a->code_buffer & ZPAIR_MASK];
+      if (entry) {
+         int n = entry >> 24, s = (entry >> 16) & 0xff;
+         if (a->zout + n > a->zout_end) if (!expand(a, n)) return 0;
+         a->zout[0] = (char) (entry & 0xff);
+         if (n == 2) a->zout[1] = (char) ((entry >> 8) & 0xff);
+         a->zout += n;
+         a->code_buffer >>= s;
+         a->num_bits -= s;
+         continue;
+      }
+      z = zhuffman_decode(a, &a->z_length);
+      if (z < 256) {
+         if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
+         if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
+         *a->zout++ = (char) z;
+      } else {
+         uint8 *p;
+         int len,dist;
+         if (z == 256) return 1;
+         z -= 257;
+         len = length_base[z];
+         if (length_extra[z]) len += zreceive(a, length_extra[z]);
+         z = zhuffman_decode(a, &a->z_distance);
+         if (z < 0) return e("bad huffman code","Corrupt PNG");
+         dist = dist_base[z];
+         if (dist_extra[z]) dist += zreceive(a, dist_extra[z]);
+         if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
+         if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
+         p = (uint8 *) (a->zout - dist);
+         if (dist == 1) { // run of one byte
+            memset(a->zout, *p, len);
+            a->zout += len;
+         } else if (dist >= len) {
+            memcpy(a->zout, p, len);
+            a->zout += len;
+         } else {
+            while (len--)
+               *a->zout++ = *p++;
+         }
+      }
+   }
+}
+
 static int compute_huffman_codes(zbuf *a)
 {
    static uint8 length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
@@ -2282,7 +3173,11 @@ static int parse_zlib(zbuf *a, int parse_header)
          } else {
             if (!compute_huffman_codes(a)) return 0;
          }
-         if (!parse_huffman_block(a)) return 0;
+         if (stbi_simd_allowed) {
+            if (!parse_huffman_block_fast(a)) return 0;
+         } else {
+            if (!parse_huffman_block(a)) return 0;
+         }
       }
       if (stbi_png_partial && a->zout - a->zout_start > 65536)
          break;
@@ -2439,6 +3334,181 @@ static int paeth(int a, int b, int c)
    return c;
 }
 
+// vectorized unfiltering for rows of 3 or 4 byte pixels. Sub, Avg and
+// Paeth depend on the pixel to the left, so these work a pixel at a time
+// with the channels in parallel; Up has no such dependency and goes 16
+// bytes at a time. cur, raw and prior point at the second pixel of the
+// row, n is the number of pixels left in it.
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+stbi_inline static uint32 png_load_px(const uint8 *p, int bpp)
+{
+   uint32 v = 0;
+   memcpy(&v, p, bpp);
+   return v;
+}
+#endif
+
+#ifdef STBI_SSE2
+#define png_load_sse2(p,bpp) _mm_cvtsi32_si128((int) png_load_px(p,bpp))
+
+STBI_SSE2_TARGET
+static void png_store_sse2(uint8 *p, __m128i v, int bpp)
+{
+   uint32 t = (uint32) _mm_cvtsi128_si32(v);
+   memcpy(p, &t, bpp);
+}
+
+STBI_SSE2_TARGET
+static int png_unfilter_row_sse2(int filter, uint8 *cur, uint8 *raw, uint8 *prior, int bpp, uint32 n)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i a, b, c, d;
+   uint32 i, len = n * bpp;
+
+   switch (filter) {
+      case F_up:
+         for (i=0; i+16 <= len; i += 16) {
+            d = _mm_loadu_si128((__m128i *) (raw + i));
+            b = _mm_loadu_si128((__m128i *) (prior + i));
+            _mm_storeu_si128((__m128i *) (cur + i), _mm_add_epi8(d, b));
+         }
+         for (; i < len; ++i)
+            cur[i] = raw[i] + prior[i];
+         return 1;
+
+      case F_sub:
+         a = png_load_sse2(cur - bpp, bpp);
+         for (i=0; i < n; ++i, cur += bpp, raw += bpp) {
+            a = _mm_add_epi8(a, png_load_sse2(raw, bpp));
+            png_store_sse2(cur, a, bpp);
+         }
+         return 1;
+
+      case F_avg:
+         // (a+b)>>1 is the rounded-up average less the rounding bit
+         a = png_load_sse2(cur - bpp, bpp);
+         for (i=0; i < n; ++i, cur += bpp, raw += bpp, prior += bpp) {
+            b = png_load_sse2(prior, bpp);
+            c = _mm_sub_epi8(_mm_avg_epu8(a, b),
+                             _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+            a = _mm_add_epi8(png_load_sse2(raw, bpp), c);
+            png_store_sse2(cur, a, bpp);
+         }
+         return 1;
+
+      case F_paeth:
+         // in 16 bit lanes: pa = |b-c|, pb = |a-c|, pc = |a+b-2c|,
+         // then prefer a, b, c in that order among the smallest
+         a = _mm_unpacklo_epi8(png_load_sse2(cur - bpp, bpp), zero);
+         c = _mm_unpacklo_epi8(png_load_sse2(prior - bpp, bpp), zero);
+         for (i=0; i < n; ++i, cur += bpp, raw += bpp, prior += bpp) {
+            __m128i pa, pb, pc, smallest, pred;
+            b = _mm_unpacklo_epi8(png_load_sse2(prior, bpp), zero);
+            pa = _mm_sub_epi16(b, c);
+            pb = _mm_sub_epi16(a, c);
+            pc = _mm_add_epi16(pa, pb);
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+            d = _mm_cmpeq_epi16(smallest, pb);
+            pred = _mm_or_si128(_mm_and_si128(d, b), _mm_andnot_si128(d, c));
+            d = _mm_cmpeq_epi16(smallest, pa);
+            pred = _mm_or_si128(_mm_and_si128(d, a), _mm_andnot_si128(d, pred));
+
+            d = _mm_add_epi8(png_load_sse2(raw, bpp), _mm_packus_epi16(pred, pred));
+            png_store_sse2(cur, d, bpp);
+            a = _mm_unpacklo_epi8(d, zero);
+            c = b;
+         }
+         return 1;
+   }
+   return 0;
+}
+#endif // STBI_SSE2
+
+#ifdef STBI_NEON
+#define png_load_neon(p,bpp) vreinterpret_u8_u32(vdup_n_u32(png_load_px(p,bpp)))
+
+static void png_store_neon(uint8 *p, uint8x8_t v, int bpp)
+{
+   uint32 t = vget_lane_u32(vreinterpret_u32_u8(v), 0);
+   memcpy(p, &t, bpp);
+}
+
+static int png_unfilter_row_neon(int filter, uint8 *cur, uint8 *raw, uint8 *prior, int bpp, uint32 n)
+{
+   uint8x8_t a, b, c, d;
+   uint32 i, len = n * bpp;
+
+   switch (filter) {
+      case F_up:
+         for (i=0; i+16 <= len; i += 16)
+            vst1q_u8(cur + i, vaddq_u8(vld1q_u8(raw + i), vld1q_u8(prior + i)));
+         for (; i < len; ++i)
+            cur[i] = raw[i] + prior[i];
+         return 1;
+
+      case F_sub:
+         a = png_load_neon(cur - bpp, bpp);
+         for (i=0; i < n; ++i, cur += bpp, raw += bpp) {
+            a = vadd_u8(a, png_load_neon(raw, bpp));
+            png_store_neon(cur, a, bpp);
+         }
+         return 1;
+
+      case F_avg:
+         a = png_load_neon(cur - bpp, bpp);
+         for (i=0; i < n; ++i, cur += bpp, raw += bpp, prior += bpp) {
+            b = png_load_neon(prior, bpp);
+            a = vadd_u8(png_load_neon(raw, bpp), vhadd_u8(a, b));
+            png_store_neon(cur, a, bpp);
+         }
+         return 1;
+
+      case F_paeth:
+         a = png_load_neon(cur - bpp, bpp);
+         c = png_load_neon(prior - bpp, bpp);
+         for (i=0; i < n; ++i, cur += bpp, raw += bpp, prior += bpp) {
+            uint16x8_t pa, pb, pc;
+            uint8x8_t smallest, pick;
+            b = png_load_neon(prior, bpp);
+            pa = vabdl_u8(b, c);
+            pb = vabdl_u8(a, c);
+            pc = vabdq_u16(vaddl_u8(a, b), vshll_n_u8(c, 1));
+            // pa and pb never exceed 255, so saturating pc there can't change
+            // which of them is smallest
+            smallest = vmin_u8(vqmovn_u16(pc), vmin_u8(vqmovn_u16(pa), vqmovn_u16(pb)));
+            pick = vbsl_u8(vceq_u8(smallest, vqmovn_u16(pb)), b, c);
+            pick = vbsl_u8(vceq_u8(smallest, vqmovn_u16(pa)), a, pick);
+            a = vadd_u8(png_load_neon(raw, bpp), pick);
+            png_store_neon(cur, a, bpp);
+            c = b;
+         }
+         return 1;
+   }
+   return 0;
+}
+#endif // STBI_NEON
+
+// returns 0 if the row was left for the portable code
+static int png_unfilter_row_simd(int filter, uint8 *cur, uint8 *raw, uint8 *prior, int bpp, uint32 n)
+{
+   if (!stbi_simd_allowed || (bpp != 3 && bpp != 4)) return 0;
+#ifdef STBI_SSE2
+   if (stbi_sse2_available())
+      return png_unfilter_row_sse2(filter, cur, raw, prior, bpp, n);
+#endif
+#ifdef STBI_NEON
+   if (cpu_level() == CPU_NEON)
+      return png_unfilter_row_neon(filter, cur, raw, prior, bpp, n);
+#endif
+   STBI_NOTUSED(filter); STBI_NOTUSED(cur); STBI_NOTUSED(raw);
+   STBI_NOTUSED(prior); STBI_NOTUSED(n);
+   return 0;
+}
+
 // create the png data from post-deflated data
 static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, uint32 x, uint32 y)
 {
@@ -2448,7 +3518,7 @@ static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, u
    int img_n = s->img_n; // copy it into a local for later
    assert(out_n == s->img_n || out_n == s->img_n+1);
    if (stbi_png_partial) y = 1;
-   a->out = (uint8 *) malloc(x * y * out_n);
+   a->out = stbi_out_malloc(s, x * y * out_n);
    if (!a->out) return e("outofmem", "Out of memory");
    if (!stbi_png_partial) {
       if (s->img_x == x && s->img_y == y) {
@@ -2481,7 +3551,9 @@ static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, u
       cur += out_n;
       prior += out_n;
       // this is a little gross, so that we don't switch per-pixel or per-component
-      if (img_n == out_n) {
+      if (img_n == out_n && x > 1 && png_unfilter_row_simd(filter, cur, raw, prior, img_n, x-1)) {
+         raw += (x-1) * img_n;
+      } else if (img_n == out_n) {
          #define CASE(f) \
              case f:     \
                 for (i=x-1; i >= 1; --i, raw+=img_n,cur+=img_n,prior+=img_n) \
@@ -2527,8 +3599,9 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int i
    save = stbi_png_partial;
    stbi_png_partial = 0;
 
-   // de-interlacing
-   final = (uint8 *) malloc(a->s->img_x * a->s->img_y * out_n);
+   // de-interlacing. final takes the caller's buffer, if any, so the
+   // passes come from malloc
+   final = stbi_out_malloc(a->s, a->s->img_x * a->s->img_y * out_n);
    for (p=0; p < 7; ++p) {
       int xorig[] = { 0,4,0,2,0,1,0 };
       int yorig[] = { 0,0,4,0,2,0,1 };
@@ -2540,14 +3613,14 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int i
       y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
       if (x && y) {
          if (!create_png_image_raw(a, raw, raw_len, out_n, x, y)) {
-            free(final);
+            stbi_out_free(a->s, final);
             return 0;
          }
          for (j=0; j < y; ++j)
             for (i=0; i < x; ++i)
                memcpy(final + (j*yspc[p]+yorig[p])*a->s->img_x*out_n + (i*xspc[p]+xorig[p])*out_n,
                       a->out + (j*x+i)*out_n, out_n);
-         free(a->out);
+         stbi_out_free(a->s, a->out);
          raw += (x*out_n+1)*y;
          raw_len -= (x*out_n+1)*y;
       }
@@ -2788,6 +3861,10 @@ static int parse_png_file(png *z, int scan, int req_comp)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
+            // palette expansion and format conversion replace the image,
+            // so only decode into the caller's buffer when neither happens
+            if (pal_img_n || (req_comp && req_comp != s->img_out_n))
+               s->out_buffer = NULL;
             if (!create_png_image(z, z->expanded, raw_len, s->img_out_n, interlace)) return 0;
             if (has_trans)
                if (!compute_transparency(z, tc, s->img_out_n)) return 0;
@@ -2843,7 +3920,7 @@ static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   free(p->out);      p->out      = NULL;
+   stbi_out_free(p->s, p->out); p->out = NULL;
    free(p->expanded); p->expanded = NULL;
    free(p->idata);    p->idata    = NULL;
 
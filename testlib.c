@@ -10,6 +10,7 @@ ThreadBarrier render_barrier;
 FixedAllocator clock_allocator;
 FixedAllocator image_resource_allocator;
 StackAllocator frame_allocator;
+StackAllocator image_staging_allocator;
 FixedAllocator command_allocator;
 Queue render_queue;
 
@@ -40,6 +41,7 @@ void lib_init() {
   clock_allocator = fixed_allocator_make(sizeof(struct Clock_), MAX_NUM_CLOCKS, "clock_allocator");
   image_resource_allocator = fixed_allocator_make(sizeof(struct ImageResource_), MAX_NUM_IMAGES, "image_resource_allocator");
   frame_allocator = stack_allocator_make(1024 * 1024, "frame_allocator");
+  image_staging_allocator = stack_allocator_make(IMAGE_STAGING_SIZE, "image_staging_allocator");
   command_allocator = fixed_allocator_make(sizeof(struct Command_), MAX_NUM_COMMANDS, "command_allocator");
   render_queue = queue_make();
   render_barrier = threadbarrier_make(2);
@@ -77,6 +79,10 @@ void begin_frame() {
 
 void end_frame() {
   renderer_enqueue_sync(signal_render_complete, NULL);
+
+  // the renderer has caught up, so every pending upload is done with
+  // its pixels
+  stack_allocator_freeall(image_staging_allocator);
 }
 
 static LLNode last_resource = NULL;
@@ -89,21 +95,68 @@ int image_height(ImageResource resource) {
   return resource->h;
 }
 
+static int default_image_format = IMAGE_NATIVE;
+
+void image_default_format_set(int format) {
+  default_image_format = format;
+}
+
+int image_default_format() {
+  return default_image_format;
+}
+
 ImageResource image_load(char * file) {
-  int w, h, channels;
-  unsigned char *data = stbi_load(file, &w, &h, &channels, 0);
+  return image_load_format(file, default_image_format);
+}
+
+/* decode into the staging arena when there is room, otherwise fall
+   back to a malloc'd buffer that the renderer frees after upload */
+static unsigned char* image_decode(char * file, int req_comp,
+                                   int *w, int *h, int *channels,
+                                   int *malloced) {
+  unsigned char *data = NULL;
+  if(stbi_info(file, w, h, channels)) {
+    int size = *w * *h * (req_comp ? req_comp : *channels);
+    unsigned char *staging = stack_allocator_try_alloc(image_staging_allocator, size);
+    if(staging) {
+      data = stbi_load_into(file, staging, size, w, h, channels, req_comp);
+    }
+  }
+
+  *malloced = (data == NULL);
+  if(data == NULL) {
+    data = stbi_load(file, w, h, channels, req_comp);
+  }
+  return data;
+}
+
+ImageResource image_load_format(char * file, int format) {
+  int w, h, channels, malloced;
+  int native, req_comp;
+  unsigned char *data;
+
+  format = imageconv_resolve_format(format);
+  native = (format == IMAGE_NATIVE);
+  req_comp = native ? 0 : 4;
+  data = image_decode(file, req_comp, &w, &h, &channels, &malloced);
 
   if(data == NULL) {
     fprintf(stderr, "failed to load %s\n", file);
     return NULL;
   }
 
+  if(!native) {
+    imageconv_convert(data, w * h, format);
+  }
+
   ImageResource resource = (ImageResource)fixed_allocator_alloc(image_resource_allocator);
   resource->w = w;
   resource->h = h;
-  resource->channels = channels;
+  resource->channels = req_comp ? req_comp : channels;
+  resource->format = format;
   resource->node.next = last_resource;
   resource->data = data;
+  resource->data_malloced = malloced;
   last_resource = (LLNode)resource;
 
   renderer_enqueue(renderer_finish_image_load, resource);
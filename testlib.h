@@ -15,6 +15,7 @@
 #define MAX_NUM_CLOCKS 20
 #define MAX_NUM_IMAGES 40
 #define MAX_NUM_COMMANDS 60
+#define IMAGE_STAGING_SIZE (8 * 1024 * 1024)
 
 #include <pthread.h>
 #include <stdint.h>
@@ -23,12 +24,14 @@
 #include "memory.h"
 #include "listlib.h"
 #include "audio.h"
+#include "imageconv.h"
 
 /* allocators */
 extern ThreadBarrier render_barrier;
 extern FixedAllocator clock_allocator;
 extern FixedAllocator image_resource_allocator;
 extern StackAllocator frame_allocator;
+extern StackAllocator image_staging_allocator;
 extern FixedAllocator command_allocator;
 extern Queue render_queue;
 
@@ -85,10 +88,17 @@ typedef struct ImageResource_ {
   int w, h;
   unsigned int texture;
   int channels;
+  int format; /* ImageFormat, possibly | IMAGE_PREMULTIPLIED */
   unsigned char* data; /* shortlived, internal */
+  int data_malloced; /* data is not in image_staging_allocator */
 } *ImageResource;
 
+/* format used by image_load. defaults to IMAGE_NATIVE */
+void image_default_format_set(int format);
+int image_default_format();
+
 ImageResource image_load(char * file);
+ImageResource image_load_format(char * file, int format);
 int image_width(ImageResource resource);
 int image_height(ImageResource resource);
 void images_free();
@@ -48,6 +48,9 @@ void renderer_gl_init() {
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+  // rows of RGB888 and 16 bit texels aren't always 4 byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
   glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
   glViewport(0, 0, screen_width, screen_height);
   glMatrixMode(GL_PROJECTION);
@@ -75,13 +78,30 @@ void renderer_begin_frame(void* empty) {
 void renderer_finish_image_load(ImageResource resource) {
   GLuint texture;
   GLenum texture_format;
-  GLint num_colors;
+  GLenum texel_type = GL_UNSIGNED_BYTE;
 
-  num_colors = resource->channels;
-  if(num_colors == 4) {
+  switch(image_format_layout(resource->format)) {
+  case IMAGE_NATIVE:
+    texture_format = resource->channels == 4 ? GL_RGBA : GL_RGB;
+    break;
+  case IMAGE_RGBA8888:
     texture_format = GL_RGBA;
-  } else {
+    break;
+  case IMAGE_RGB888:
     texture_format = GL_RGB;
+    break;
+  case IMAGE_RGB565:
+    texture_format = GL_RGB;
+    texel_type = GL_UNSIGNED_SHORT_5_6_5;
+    break;
+  case IMAGE_RGBA4444:
+    texture_format = GL_RGBA;
+    texel_type = GL_UNSIGNED_SHORT_4_4_4_4;
+    break;
+  case IMAGE_RGBA5551:
+    texture_format = GL_RGBA;
+    texel_type = GL_UNSIGNED_SHORT_5_5_5_1;
+    break;
   }
 
   gl_check(glGenTextures(1, &texture));
@@ -90,11 +110,14 @@ void renderer_finish_image_load(ImageResource resource) {
   gl_check(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
   gl_check(glTexImage2D(GL_TEXTURE_2D, 0, texture_format,
                         resource->w, resource->h, 0,
-                        texture_format, GL_UNSIGNED_BYTE, resource->data));
+                        texture_format, texel_type, resource->data));
 
   resource->texture = texture;
 
-  free(resource->data);
+  if(resource->data_malloced) {
+    free(resource->data);
+  }
+  resource->data = NULL;
 }
 
 void renderer_finish_image_free(void* texturep) {
@@ -103,11 +126,22 @@ void renderer_finish_image_free(void* texturep) {
 }
 
 GLuint last_texture = -1;
+int last_premultiplied = 0;
 
 void sprite_render_to_screen(Sprite sprite) {
   if(sprite->resource->texture != last_texture) {
     glBindTexture(GL_TEXTURE_2D, sprite->resource->texture);
     last_texture = sprite->resource->texture;
+
+    int premultiplied = image_format_premultiplied(sprite->resource->format);
+    if(premultiplied != last_premultiplied) {
+      if(premultiplied) {
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+      } else {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      }
+      last_premultiplied = premultiplied;
+    }
   }
 
   glPushMatrix();
@@ -1,6 +1,100 @@
+#include <string.h>
+
 #include "memory.h"
+#include "threadlib.h"
 #include "testcase.h"
 
+#define NUM_PINGS 1000
+
+Semaphore ping, pong;
+
+/* answer every ping with a pong */
+void* ponger(void* data) {
+  int ii;
+  for(ii = 0; ii < NUM_PINGS; ++ii) {
+    semaphore_wait(ping);
+    semaphore_post(pong);
+  }
+  return NULL;
+}
+
+#define NUM_PUSHERS 4
+#define PUSHES 10000
+
+AtomicStack stack;
+
+void* pusher(void* data) {
+  struct DLLNode_* nodes = (struct DLLNode_*)data;
+  int ii;
+  for(ii = 0; ii < PUSHES; ++ii) {
+    atomicstack_push(stack, &nodes[ii]);
+  }
+  return NULL;
+}
+
+/* every node pushed from several threads is taken exactly once */
+int atomicstack_loses_nothing() {
+  static struct DLLNode_ nodes[NUM_PUSHERS][PUSHES];
+  pthread_t threads[NUM_PUSHERS];
+  int ii, taken = 0;
+
+  stack = atomicstack_make();
+  for(ii = 0; ii < NUM_PUSHERS; ++ii) {
+    pthread_create(&threads[ii], NULL, pusher, nodes[ii]);
+  }
+  while(taken < NUM_PUSHERS * PUSHES) {
+    DLLNode node;
+    for(node = atomicstack_take_all(stack); node; node = node->next) {
+      ++taken;
+    }
+  }
+  for(ii = 0; ii < NUM_PUSHERS; ++ii) {
+    pthread_join(threads[ii], NULL);
+  }
+
+  int ok = taken == NUM_PUSHERS * PUSHES && atomicstack_take_all(stack) == NULL;
+  atomicstack_free(stack);
+  return ok;
+}
+
+#define STREAM_BYTES 1000000
+
+/* the producer writes a counting byte stream in uneven pieces */
+void* spsc_producer(void* data) {
+  SPSCBuffer spsc = (SPSCBuffer)data;
+  char chunk[97];
+  int sent = 0, ii;
+  while(sent < STREAM_BYTES) {
+    int n = MIN(STREAM_BYTES - sent, 1 + sent % 97);
+    for(ii = 0; ii < n; ++ii) {
+      chunk[ii] = (char)(sent + ii);
+    }
+    sent += spscbuffer_insert(spsc, chunk, n);
+  }
+  return NULL;
+}
+
+/* and the consumer checks it arrives intact */
+int spsc_stream_intact(SPSCBuffer spsc) {
+  pthread_t thread;
+  char chunk[61];
+  int received = 0, ok = 1, ii;
+
+  pthread_create(&thread, NULL, spsc_producer, spsc);
+  while(received < STREAM_BYTES) {
+    int n = spscbuffer_read(spsc, chunk, 1 + received % 61);
+    for(ii = 0; ii < n; ++ii) {
+      ok &= chunk[ii] == (char)(received + ii);
+    }
+    received += n;
+  }
+  pthread_join(thread, NULL);
+
+  ok &= spscbuffer_bytes_readable(spsc) == 0;
+  spscbuffer_free(spsc);
+  return ok;
+}
+
 int main(int argc, char ** argv) {
   int ii;
 
@@ -10,7 +104,7 @@ int main(int argc, char ** argv) {
     ASSERT((last = fixed_allocator_alloc(fa)) != NULL);
   }
 
-  //ASSERT(fixed_allocator_alloc(fa) == NULL);
+  ASSERT(fixed_allocator_try_alloc(fa) == NULL);
   fixed_allocator_free(fa, last);
   ASSERT(fixed_allocator_alloc(fa) != NULL);
 
@@ -20,8 +114,10 @@ int main(int argc, char ** argv) {
   }
 
   //ASSERT(stack_allocator_alloc(sa, sizeof(long)) == NULL);
+  ASSERT(stack_allocator_try_alloc(sa, sizeof(long)) == NULL);
   stack_allocator_freeall(sa);
   ASSERT(stack_allocator_alloc(sa, sizeof(long) * 5) != NULL);
+  ASSERT(stack_allocator_try_alloc(sa, sizeof(long) * 95) != NULL);
 
   CircularBuffer buffer = circularbuffer_make(100);
   ASSERT(circularbuffer_bytes_writable(buffer) == 100);
@@ -59,5 +155,83 @@ int main(int argc, char ** argv) {
     }
   }
 
+  SPSCBuffer spsc = spscbuffer_make(100);
+  int s1, s2;
+  char *b1, *b2;
+  ASSERT(spscbuffer_bytes_writable(spsc) == 100);
+  ASSERT(spscbuffer_insert(spsc, bytes, 70) == 70);
+  ASSERT(spscbuffer_read(spsc, morebytes, 50) == 50);
+  ASSERT(morebytes[49] == 49);
+
+  // 20 left, room for 80 split over the end of the ring
+  spscbuffer_write_buffers(spsc, &b1, &s1, &b2, &s2, 1000);
+  ASSERT(s1 == 30 && s2 == 50 && b2 == spsc->data);
+  ASSERT(spscbuffer_bytes_readable(spsc) == 20);
+
+  // nothing is visible to the reader until it's committed
+  spscbuffer_write_buffers(spsc, &b1, &s1, &b2, &s2, 40);
+  ASSERT(s1 == 30 && s2 == 10);
+  memcpy(b1, bytes, s1);
+  memcpy(b2, &bytes[s1], s2);
+  ASSERT(spscbuffer_bytes_readable(spsc) == 20);
+  spscbuffer_write_commit(spsc, 40);
+  ASSERT(spscbuffer_bytes_readable(spsc) == 60);
+
+  // fill it all the way up, full and empty must not be confused
+  ASSERT(spscbuffer_insert(spsc, bytes, 100) == 40);
+  ASSERT(spscbuffer_bytes_writable(spsc) == 0);
+  ASSERT(spscbuffer_bytes_readable(spsc) == 100);
+  ASSERT(spscbuffer_read(spsc, morebytes, 100) == 100);
+  ASSERT(morebytes[0] == 50 && morebytes[20] == 0 && morebytes[59] == 39);
+  ASSERT(morebytes[60] == 0 && morebytes[99] == 39);
+  ASSERT(spscbuffer_bytes_readable(spsc) == 0);
+  spscbuffer_free(spsc);
+
+  ASSERT(spsc_stream_intact(spscbuffer_make(100)));
+
+  // a mirrored ring hands back one span across the wrap
+  spsc = spscbuffer_make_mirrored(100);
+  ASSERT(spsc->size >= 100);
+#ifdef __linux__
+  ASSERT(spsc->mirrored);
+#endif
+  char* big = malloc(spsc->size);
+  for(ii = 0; ii < spsc->size; ++ii) {
+    big[ii] = ii;
+  }
+  spscbuffer_insert(spsc, big, spsc->size - 10);
+  spscbuffer_read(spsc, big, spsc->size - 20);
+  spscbuffer_write_buffers(spsc, &b1, &s1, &b2, &s2, 30);
+  ASSERT(s1 == 30 && (s2 == 0 || !spsc->mirrored));
+  if(spsc->mirrored) {
+    memset(b1, 7, 30);
+    // the tail of the span is the start of the ring
+    ASSERT(spsc->data[19] == 7 && spsc->data[20] != 7);
+  }
+  free(big);
+  spscbuffer_free(spsc);
+
+  ASSERT(spsc_stream_intact(spscbuffer_make_mirrored(100)));
+
+  ASSERT(atomicstack_loses_nothing());
+
+  ping = semaphore_make(0);
+  pong = semaphore_make(0);
+  pthread_t thread;
+  pthread_create(&thread, NULL, ponger, NULL);
+  for(ii = 0; ii < NUM_PINGS; ++ii) {
+    semaphore_post(ping);
+    semaphore_wait(pong);
+  }
+  pthread_join(thread, NULL);
+
+  // posts are counted, not lost, when nobody is waiting yet
+  semaphore_post(ping);
+  semaphore_post(ping);
+  semaphore_wait(ping);
+  semaphore_wait(ping);
+  semaphore_free(ping);
+  semaphore_free(pong);
+
   END_MAIN();
 }
@@ -44,6 +44,28 @@ DLLNode dequeue_noblock(Queue queue) {
  return result;
 }
 
+AtomicStack atomicstack_make() {
+  AtomicStack stack = (AtomicStack)malloc(sizeof(struct AtomicStack_));
+  stack->head = NULL;
+  return stack;
+}
+
+void atomicstack_free(AtomicStack stack) {
+  free(stack);
+}
+
+void atomicstack_push(AtomicStack stack, DLLNode item) {
+  DLLNode head = __atomic_load_n(&stack->head, __ATOMIC_RELAXED);
+  do {
+    item->next = head;
+  } while(!__atomic_compare_exchange_n(&stack->head, &head, item, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+DLLNode atomicstack_take_all(AtomicStack stack) {
+  return __atomic_exchange_n(&stack->head, NULL, __ATOMIC_ACQUIRE);
+}
+
 ThreadBarrier threadbarrier_make(int nthreads) {
   ThreadBarrier barrier = (ThreadBarrier)malloc(sizeof(struct ThreadBarrier_));
   pthread_mutex_init(&barrier->mutex, NULL);
@@ -72,3 +94,40 @@ void threadbarrier_wait(ThreadBarrier barrier) {
 
   pthread_mutex_unlock(&barrier->mutex);
 }
+
+Semaphore semaphore_make(int value) {
+  Semaphore semaphore = (Semaphore)malloc(sizeof(struct Semaphore_));
+#ifdef __APPLE__
+  semaphore->sem = dispatch_semaphore_create(value);
+#else
+  sem_init(&semaphore->sem, 0, value);
+#endif
+  return semaphore;
+}
+
+void semaphore_free(Semaphore semaphore) {
+#ifdef __APPLE__
+  dispatch_release(semaphore->sem);
+#else
+  sem_destroy(&semaphore->sem);
+#endif
+  free(semaphore);
+}
+
+void semaphore_post(Semaphore semaphore) {
+#ifdef __APPLE__
+  dispatch_semaphore_signal(semaphore->sem);
+#else
+  sem_post(&semaphore->sem);
+#endif
+}
+
+void semaphore_wait(Semaphore semaphore) {
+#ifdef __APPLE__
+  dispatch_semaphore_wait(semaphore->sem, DISPATCH_TIME_FOREVER);
+#else
+  /* retry if a signal interrupts the wait */
+  while(sem_wait(&semaphore->sem) != 0)
+    ;
+#endif
+}
@@ -5,6 +5,13 @@
 #include <pthread.h>
 #include "listlib.h"
 
+#ifdef __APPLE__
+/* unnamed posix semaphores are unimplemented on darwin */
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
 typedef struct Queue_ {
   struct DLL_ list;
   pthread_mutex_t mutex;
@@ -18,6 +25,21 @@ void enqueue(Queue queue, DLLNode item);
 DLLNode dequeue(Queue queue);
 DLLNode dequeue_noblock(Queue queue);
 
+/* a lock free stack any number of threads can push onto while one
+   thread takes everything at once. taking the whole list means a node
+   can't be popped and pushed back under a reader, so there's no ABA
+   problem */
+typedef struct AtomicStack_ {
+  DLLNode head;
+} *AtomicStack;
+
+AtomicStack atomicstack_make();
+void atomicstack_free(AtomicStack stack);
+
+void atomicstack_push(AtomicStack stack, DLLNode item);
+/* everything pushed so far, newest first, linked through next */
+DLLNode atomicstack_take_all(AtomicStack stack);
+
 typedef struct ThreadBarrier_ {
   pthread_mutex_t mutex;
   pthread_cond_t cond;
@@ -30,4 +52,20 @@ void threadbarrier_free(ThreadBarrier barrier);
 
 void threadbarrier_wait(ThreadBarrier barrier);
 
+/* a counting semaphore. post is safe to call from an audio callback:
+   it never blocks and takes no locks */
+typedef struct Semaphore_ {
+#ifdef __APPLE__
+  dispatch_semaphore_t sem;
+#else
+  sem_t sem;
+#endif
+} *Semaphore;
+
+Semaphore semaphore_make(int value);
+void semaphore_free(Semaphore semaphore);
+
+void semaphore_post(Semaphore semaphore);
+void semaphore_wait(Semaphore semaphore);
+
 #endif